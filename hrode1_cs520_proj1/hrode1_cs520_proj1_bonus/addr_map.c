@@ -0,0 +1,144 @@
+/*
+ *  addr_map.c
+ *  Linear probing hash map keyed by simulated addresses
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "addr_map.h"
+
+static size_t
+slot_of(const AddrMap* map, uint32_t key)
+{
+  return (size_t)((key * 2654435761u) & (uint32_t)(map->capacity - 1));
+}
+
+int
+addr_map_init(AddrMap* map, size_t capacity)
+{
+  size_t cap = 16;
+  while (cap < capacity) {
+    cap <<= 1;
+  }
+  map->keys = malloc(sizeof(*map->keys) * cap);
+  map->values = malloc(sizeof(*map->values) * cap);
+  map->used = calloc(cap, 1);
+  map->capacity = cap;
+  map->count = 0;
+  if (!map->keys || !map->values || !map->used) {
+    addr_map_free(map);
+    return -1;
+  }
+  return 0;
+}
+
+void
+addr_map_free(AddrMap* map)
+{
+  free(map->keys);
+  free(map->values);
+  free(map->used);
+  map->keys = NULL;
+  map->values = NULL;
+  map->used = NULL;
+  map->capacity = 0;
+  map->count = 0;
+}
+
+void
+addr_map_clear(AddrMap* map)
+{
+  memset(map->used, 0, map->capacity);
+  map->count = 0;
+}
+
+/* Returns the value slot of 'key', NULL when it is not present */
+uint64_t*
+addr_map_get(AddrMap* map, uint32_t key)
+{
+  size_t mask = map->capacity - 1;
+  for (size_t i = slot_of(map, key); map->used[i]; i = (i + 1) & mask) {
+    if (map->keys[i] == key) {
+      return &map->values[i];
+    }
+  }
+  return NULL;
+}
+
+/* Doubles the table once it is more than half full */
+static int
+grow(AddrMap* map)
+{
+  AddrMap bigger;
+  if (addr_map_init(&bigger, map->capacity * 2) != 0) {
+    return -1;
+  }
+  for (size_t i = 0; i < map->capacity; ++i) {
+    if (map->used[i]) {
+      *addr_map_put(&bigger, map->keys[i]) = map->values[i];
+    }
+  }
+  addr_map_free(map);
+  *map = bigger;
+  return 0;
+}
+
+/*
+ * Returns the value slot of 'key', inserting it with value 0 when it is
+ * not present. NULL only if the table could not grow.
+ */
+uint64_t*
+addr_map_put(AddrMap* map, uint32_t key)
+{
+  uint64_t* value = addr_map_get(map, key);
+  if (value) {
+    return value;
+  }
+  if (2 * (map->count + 1) > map->capacity && grow(map) != 0) {
+    return NULL;
+  }
+  size_t mask = map->capacity - 1;
+  size_t i = slot_of(map, key);
+  while (map->used[i]) {
+    i = (i + 1) & mask;
+  }
+  map->used[i] = 1;
+  map->keys[i] = key;
+  map->values[i] = 0;
+  map->count++;
+  return &map->values[i];
+}
+
+/*
+ * Removes 'key', shifting later entries of its probe run back so no
+ * tombstones are needed
+ */
+int
+addr_map_remove(AddrMap* map, uint32_t key)
+{
+  size_t mask = map->capacity - 1;
+  size_t i = slot_of(map, key);
+  while (map->used[i] && map->keys[i] != key) {
+    i = (i + 1) & mask;
+  }
+  if (!map->used[i]) {
+    return -1;
+  }
+  map->used[i] = 0;
+  map->count--;
+
+  size_t j = (i + 1) & mask;
+  while (map->used[j]) {
+    size_t home = slot_of(map, map->keys[j]);
+    /* Move entry j into the hole at i if i lies on its probe path */
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      map->keys[i] = map->keys[j];
+      map->values[i] = map->values[j];
+      map->used[i] = 1;
+      map->used[j] = 0;
+      i = j;
+    }
+    j = (j + 1) & mask;
+  }
+  return 0;
+}
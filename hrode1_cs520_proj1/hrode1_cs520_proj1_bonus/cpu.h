@@ -8,6 +8,11 @@
  *  Gaurav Kothari (gkothar1@binghamton.edu)
  *  State University of New York, Binghamton
  */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hooks.h"
+#include "mem.h"
 
 enum
 {
@@ -19,14 +24,51 @@ enum
   NUM_STAGES
 };
 
-/* Format of an APEX instruction  */
+/* Decoded operation codes, OP_NOP also covers unknown opcodes */
+enum
+{
+  OP_NOP,
+  OP_MOVC,
+  OP_STORE,
+  OP_LOAD,
+  OP_ADD,
+  OP_SUB,
+  OP_AND,
+  OP_OR,
+  OP_EXOR,
+  OP_MUL,
+  OP_HALT,
+  OP_BZ,
+  OP_BNZ,
+  OP_JUMP,
+  NUM_OPCODES
+};
+
+/* Operand usage flags returned by get_opcode_operands() */
+enum
+{
+  READS_RS1 = 0x01,
+  READS_RS2 = 0x02,
+  WRITES_RD = 0x04,
+  READS_FLAG = 0x08,
+  WRITES_FLAG = 0x10,   // Every instruction going through an ALU
+  READS_MEM = 0x20,
+  WRITES_MEM = 0x40,
+  IS_BRANCH = 0x80
+};
+
+/*
+ * Format of an APEX instruction in code memory, 8 bytes. The layout
+ * matches the records of object files (object.h), which are used as
+ * code memory in place. get_opcode_name() gives the opcode string
+ */
 typedef struct APEX_Instruction
 {
-  char opcode[128];	// Operation Code
-  int rd;		    // Destination Register Address
-  int rs1;		    // Source-1 Register Address
-  int rs2;		    // Source-2 Register Address
-  int imm;		    // Literal Value
+  uint8_t op;		// Decoded Operation Code
+  uint8_t rd;		// Destination Register Address
+  uint8_t rs1;		// Source-1 Register Address
+  uint8_t rs2;		// Source-2 Register Address
+  int32_t imm;		// Literal Value
 } APEX_Instruction;
 
 /* Model of CPU stage latch */
@@ -44,6 +86,7 @@ typedef struct CPU_Stage
   int mem_address;	// Computed Memory Address
   int busy;		    // Flag to indicate, stage is performing some action
   int stalled;		// Flag to indicate, stage is stalled
+  int op;		    // Decoded Operation Code
 } CPU_Stage;
 
 /* Model of APEX CPU */
@@ -62,27 +105,62 @@ typedef struct APEX_CPU
   /* Array of 5 CPU_stage */
   CPU_Stage stage[5];
 
-  /* Code Memory where instructions are stored */
-  APEX_Instruction* code_memory;
+  /* Code Memory where instructions are stored, either allocated or
+   * inside the mapped object file 'code_map' */
+  const APEX_Instruction* code_memory;
   int code_memory_size;
+  void* code_map;
+  size_t code_map_size;
 
-  /* Data Memory */
-  int data_memory[4000];
+  /* Data Memory, sparse over the 32 bit byte address space */
+  APEX_Memory data_memory;
 
   /* Some stats */
   int ins_completed;
 
+  /* Analysis tools attached to this CPU */
+  APEX_Hooks hooks;
+
 } APEX_CPU;
 
+/* Zero flag, set by every ALU operation */
+extern int zeroFlag;
+
+/* Version of the text program syntax and its meaning (labels, blank
+ * lines, register limits, ...) as create_code_memory() parses it. Cached
+ * objects carry it in their name, so bump it whenever parsing changes */
+#define APEX_PARSER_VERSION 1
+
 APEX_Instruction*
 create_code_memory(const char* filename, int* size);
 
+int
+get_opcode(const char* name);
+
+const char*
+get_opcode_name(int op);
+
+int
+get_opcode_operands(int op);
+
 APEX_CPU*
 APEX_cpu_init(const char* filename);
 
 int
 APEX_cpu_run(APEX_CPU* cpu, char* operation, int cycles);
 
+int
+APEX_cpu_cycle(APEX_CPU* cpu);
+
+/* Most values APEX_cpu_save_globals() writes */
+#define APEX_CPU_MAX_GLOBALS 16
+
+int
+APEX_cpu_save_globals(int* values);
+
+void
+APEX_cpu_restore_globals(const int* values);
+
 void
 APEX_cpu_stop(APEX_CPU* cpu);
 
@@ -104,6 +182,9 @@ writeback(APEX_CPU* cpu);
 void 
 printRegValues(APEX_CPU* cpu);
 
+void
+printMemoryData(APEX_CPU* cpu);
+
 int 
 integerALU(int input1, int input2);
 
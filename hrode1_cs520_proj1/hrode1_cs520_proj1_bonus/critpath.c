@@ -0,0 +1,204 @@
+/*
+ *  critpath.c
+ *  Dynamic dataflow critical path and ideal IPC analysis
+ *
+ *  Every retired instruction becomes a node of the RAW dependence graph,
+ *  with edges from the last writers of its source registers, of the
+ *  memory word it loads and of the zero flag it tests. Scheduling each
+ *  node as soon as its inputs are ready (unbounded resources, perfect
+ *  branch prediction) gives the dataflow limit the real pipeline is
+ *  compared against.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "addr_map.h"
+#include "tools.h"
+
+typedef struct CritPath
+{
+  APEX_Tool tool;
+  int latency[NUM_OPCODES];
+
+  /* Cycle at which the last value written to each location is ready */
+  uint64_t reg_ready[16];
+  uint64_t flag_ready;
+  AddrMap mem_ready;
+
+  /* Whether the location was ever written, to count real edges only */
+  int reg_written[16];
+  int flag_written;
+
+  uint64_t instructions;
+  uint64_t reg_edges;
+  uint64_t mem_edges;
+  uint64_t flag_edges;
+  uint64_t length;
+  int last_pc;
+} CritPath;
+
+static void
+set_default_latencies(int* latency)
+{
+  for (int op = 0; op < NUM_OPCODES; ++op) {
+    latency[op] = 1;
+  }
+  latency[OP_MUL] = 2;
+  latency[OP_LOAD] = 2;
+  latency[OP_NOP] = 0;
+}
+
+/* Parses "OP:N,OP:N" overrides, returns -1 on a malformed entry */
+static int
+parse_latencies(int* latency, const char* spec)
+{
+  char name[16];
+  const char* p = spec;
+  while (p && *p) {
+    const char* colon = strchr(p, ':');
+    if (!colon || colon - p >= (long)sizeof(name)) {
+      return -1;
+    }
+    memcpy(name, p, colon - p);
+    name[colon - p] = '\0';
+    int op = get_opcode(name);
+    if (op == OP_NOP) {
+      return -1;
+    }
+    latency[op] = atoi(colon + 1);
+    p = strchr(colon, ',');
+    if (p) {
+      p++;
+    }
+  }
+  return 0;
+}
+
+static uint64_t
+max_u64(uint64_t a, uint64_t b)
+{
+  return a > b ? a : b;
+}
+
+static void
+on_retire(void* ctx, const APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  CritPath* cp = ctx;
+  int op = stage->op;
+  int operands = get_opcode_operands(op);
+  uint64_t start = 0;
+  uint32_t word = (uint32_t)stage->mem_address >> 2;
+  (void)cpu;
+
+  if (operands & READS_RS1) {
+    start = max_u64(start, cp->reg_ready[stage->rs1 & 15]);
+    cp->reg_edges += cp->reg_written[stage->rs1 & 15];
+  }
+  if (operands & READS_RS2) {
+    start = max_u64(start, cp->reg_ready[stage->rs2 & 15]);
+    cp->reg_edges += cp->reg_written[stage->rs2 & 15];
+  }
+  if (operands & READS_MEM) {
+    uint64_t* ready = addr_map_get(&cp->mem_ready, word);
+    if (ready) {
+      start = max_u64(start, *ready);
+      cp->mem_edges++;
+    }
+  }
+  if (operands & READS_FLAG) {
+    start = max_u64(start, cp->flag_ready);
+    cp->flag_edges += cp->flag_written;
+  }
+
+  uint64_t finish = start + cp->latency[op];
+  if (operands & WRITES_RD) {
+    cp->reg_ready[stage->rd & 15] = finish;
+    cp->reg_written[stage->rd & 15] = 1;
+  }
+  if (operands & WRITES_FLAG) {
+    cp->flag_ready = finish;
+    cp->flag_written = 1;
+  }
+  if (operands & WRITES_MEM) {
+    uint64_t* ready = addr_map_put(&cp->mem_ready, word);
+    if (ready) {
+      *ready = finish;
+    }
+  }
+
+  if (finish > cp->length) {
+    cp->length = finish;
+    cp->last_pc = stage->pc;
+  }
+  cp->instructions++;
+}
+
+static void
+on_finish(void* ctx, const APEX_CPU* cpu)
+{
+  CritPath* cp = ctx;
+  uint64_t cycles = cpu->clock > 0 ? (uint64_t)cpu->clock : 1;
+  uint64_t length = cp->length > 0 ? cp->length : 1;
+
+  printf("--------------------------------\n");
+  printf("------DATAFLOW CRITICAL PATH------\n");
+  printf("--------------------------------\n");
+  printf("Instructions retired     : %llu\n",
+         (unsigned long long)cp->instructions);
+  printf("RAW edges                : register %llu, memory %llu, zero flag %llu\n",
+         (unsigned long long)cp->reg_edges,
+         (unsigned long long)cp->mem_edges,
+         (unsigned long long)cp->flag_edges);
+  printf("Critical path length     : %llu cycles (ends at pc(%d))\n",
+         (unsigned long long)cp->length, cp->last_pc);
+  printf("Ideal IPC                : %.3f\n",
+         (double)cp->instructions / (double)length);
+  printf("Simulated cycles         : %d\n", cpu->clock);
+  printf("Simulated IPC            : %.3f\n",
+         (double)cp->instructions / (double)cycles);
+  if ((uint64_t)cpu->clock >= cp->length) {
+    printf("Cycles above dataflow    : %llu (%.1f%% of simulated cycles)\n",
+           (unsigned long long)(cycles - cp->length),
+           100.0 * (double)(cycles - cp->length) / (double)cycles);
+  }
+}
+
+static void
+on_release(void* ctx)
+{
+  CritPath* cp = ctx;
+  addr_map_free(&cp->mem_ready);
+  free(cp);
+}
+
+int
+APEX_critpath_attach(APEX_CPU* cpu, const char* latencies)
+{
+  CritPath* cp = calloc(1, sizeof(*cp));
+  if (!cp) {
+    return -1;
+  }
+  set_default_latencies(cp->latency);
+  if (latencies && parse_latencies(cp->latency, latencies) != 0) {
+    fprintf(stderr, "APEX_Error : Invalid latency list '%s'\n", latencies);
+    free(cp);
+    return -1;
+  }
+  if (addr_map_init(&cp->mem_ready, 1024) != 0) {
+    free(cp);
+    return -1;
+  }
+
+  cp->tool.name = "critpath";
+  cp->tool.ctx = cp;
+  cp->tool.on_retire = on_retire;
+  cp->tool.on_finish = on_finish;
+  cp->tool.on_release = on_release;
+  if (APEX_hooks_register(cpu, &cp->tool) != 0) {
+    on_release(cp);
+    return -1;
+  }
+  return 0;
+}
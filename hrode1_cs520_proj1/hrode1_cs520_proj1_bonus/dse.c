@@ -0,0 +1,567 @@
+/*
+ *  dse.c
+ *  Design space exploration over the parameters of the timing model
+ *
+ *  Without forwarding the STORE bypass has nothing to bypass, so the
+ *  space holds such points once, with store_bypass:0. Parameters the
+ *  space does not cover keep the values of this variant.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dse.h"
+#include "forkpool.h"
+
+typedef struct DseRecorder
+{
+  APEX_Tool tool;
+  APEX_DseProgram* program;
+  uint64_t capacity;
+  int failed;
+  int taken_pc;  // Branch that redirected fetch, 0 if none
+  int taken_target;
+  int last_retire;  // Cycle of the last retirement, counted from 1
+} DseRecorder;
+
+static DseRecorder recorder;
+
+static uint64_t
+mix64(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+static void
+record_flush(void* ctx, const APEX_CPU* cpu, int pc, int target)
+{
+  DseRecorder* dr = ctx;
+  (void)cpu;
+  dr->taken_pc = pc;
+  dr->taken_target = target;
+}
+
+static void
+record_retire(void* ctx, const APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  DseRecorder* dr = ctx;
+  APEX_DseProgram* p = dr->program;
+  if (dr->failed) {
+    return;
+  }
+  if (p->num_records == dr->capacity) {
+    uint64_t capacity = dr->capacity ? 2 * dr->capacity : 4096;
+    APEX_TraceRecord* grown = realloc(p->records, sizeof(*grown) * capacity);
+    if (!grown) {
+      dr->failed = 1;
+      return;
+    }
+    p->records = grown;
+    dr->capacity = capacity;
+  }
+  APEX_trace_fill(&p->records[p->num_records++], stage, &dr->taken_pc, dr->taken_target);
+  dr->last_retire = cpu->clock + 1;
+}
+
+/* APEX_DSE_* bits of the parameters the stream of 'p' depends on */
+static int
+exercised(const APEX_DseProgram* p)
+{
+  int bits = 0;
+  for (uint64_t r = 0; r < p->num_records; ++r) {
+    const APEX_TraceRecord* rec = &p->records[r];
+    int op = APEX_TRACE_OP(rec);
+    int operands = get_opcode_operands(op);
+    bits |= op == OP_MUL ? APEX_DSE_MUL : 0;
+    bits |= (rec->op & APEX_TRACE_TAKEN) ? APEX_DSE_BRANCH : 0;
+    if (op == OP_STORE && r > 0 && APEX_TRACE_OP(&p->records[r - 1]) == OP_LOAD &&
+        p->records[r - 1].addr == rec->addr) {
+      bits |= APEX_DSE_STORE_BYPASS;
+    }
+    /* Values forwarding would give sooner, with the writer still in the pipeline */
+    for (uint64_t back = 1; back <= 3 && back <= r; ++back) {
+      const APEX_TraceRecord* w = &p->records[r - back];
+      if ((get_opcode_operands(APEX_TRACE_OP(w)) & WRITES_RD) &&
+          (((operands & READS_RS1) && rec->rs1 == w->rd) ||
+           ((operands & READS_RS2) && rec->rs2 == w->rd))) {
+        bits |= APEX_DSE_FORWARDING;
+      }
+    }
+  }
+  return bits;
+}
+
+void
+APEX_dse_space_defaults(APEX_DseSpace* space)
+{
+  memset(space, 0, sizeof(*space));
+  space->num_forwarding = 2;
+  space->forwarding[1] = 1;
+  space->num_store_bypass = 2;
+  space->store_bypass[1] = 1;
+  space->num_mul = 4;
+  for (int i = 0; i < 4; ++i) {
+    space->mul_latency[i] = i + 1;
+  }
+  space->num_branch = 2;
+  space->branch_stage[0] = EX;
+  space->branch_stage[1] = MEM;
+}
+
+/*
+ * Reads the '/' separated values of one item into 'values'. Numbers may
+ * be ranges "A-B"; "EX" and "MEM" stand for the stages when 'stages' is
+ * set. Returns how many, -1 if a value is out of [low, high] or there
+ * are too many
+ */
+static int
+parse_values(char* list, int* values, int max, int low, int high, int stages)
+{
+  int count = 0;
+  for (char* value = strtok(list, "/"); value; value = strtok(NULL, "/")) {
+    int first;
+    int last;
+    char* end;
+    if (stages && (strcmp(value, "EX") == 0 || strcmp(value, "MEM") == 0)) {
+      first = last = strcmp(value, "EX") == 0 ? EX : MEM;
+    }
+    else if (stages) {
+      return -1;
+    }
+    else {
+      first = last = (int)strtol(value, &end, 10);
+      if (*end == '-') {
+        last = (int)strtol(end + 1, &end, 10);
+      }
+      if (*end || first < low || last > high || first > last) {
+        return -1;
+      }
+    }
+    for (int v = first; v <= last; ++v) {
+      int seen = 0;
+      for (int i = 0; i < count; ++i) {
+        seen |= values[i] == v;
+      }
+      if (seen) {
+        continue;
+      }
+      if (count == max) {
+        return -1;
+      }
+      values[count++] = v;
+    }
+  }
+  return count ? count : -1;
+}
+
+/*
+ * Replaces the values of the parameters 'spec' names, e.g.
+ * "forward:1,mul:1-4,branch:EX/MEM". Returns -1 on a malformed spec
+ */
+int
+APEX_dse_space_parse(APEX_DseSpace* space, const char* spec)
+{
+  char buf[256];
+  if (snprintf(buf, sizeof(buf), "%s", spec) >= (int)sizeof(buf)) {
+    return -1;
+  }
+  /* Items first, strtok cannot split items and values at once */
+  char* items[8];
+  int num_items = 0;
+  for (char* item = strtok(buf, ","); item; item = strtok(NULL, ",")) {
+    if (num_items == 8) {
+      return -1;
+    }
+    items[num_items++] = item;
+  }
+  for (int i = 0; i < num_items; ++i) {
+    char* value = strchr(items[i], ':');
+    if (!value) {
+      return -1;
+    }
+    *value++ = '\0';
+    int n;
+    if (strcmp(items[i], "forward") == 0) {
+      n = space->num_forwarding = parse_values(value, space->forwarding, 2, 0, 1, 0);
+    }
+    else if (strcmp(items[i], "store_bypass") == 0) {
+      n = space->num_store_bypass = parse_values(value, space->store_bypass, 2, 0, 1, 0);
+    }
+    else if (strcmp(items[i], "mul") == 0) {
+      n = space->num_mul =
+        parse_values(value, space->mul_latency, APEX_DSE_MAX_VALUES, 1, 64, 0);
+    }
+    else if (strcmp(items[i], "branch") == 0) {
+      n = space->num_branch = parse_values(value, space->branch_stage, 2, 0, 0, 1);
+    }
+    else {
+      return -1;
+    }
+    if (n < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Runs the pipeline of 'cpu' from its start up to cycle 'cycles' (0 for
+ * the end of the program) and keeps the committed instruction stream.
+ * The globals of cpu.c are reset first, so each program starts from a
+ * fresh pipeline
+ */
+int
+APEX_dse_add_program(APEX_Dse* dse, APEX_CPU* cpu, const char* name, int cycles)
+{
+  if (dse->num_programs == APEX_DSE_MAX_PROGRAMS) {
+    fprintf(stderr, "APEX_Error : At most %d programs can be explored\n",
+            APEX_DSE_MAX_PROGRAMS);
+    return -1;
+  }
+  APEX_DseProgram* p = &dse->programs[dse->num_programs];
+  memset(p, 0, sizeof(*p));
+  p->name = strdup(name);
+  if (!p->name) {
+    fprintf(stderr, "APEX_Error : Out of memory for program %s\n", name);
+    return -1;
+  }
+  dse->num_programs++;
+
+  int globals[APEX_CPU_MAX_GLOBALS] = { 0 };
+  APEX_cpu_restore_globals(globals);
+  memset(&recorder, 0, sizeof(recorder));
+  recorder.tool.name = "dse";
+  recorder.tool.ctx = &recorder;
+  recorder.tool.on_retire = record_retire;
+  recorder.tool.on_flush = record_flush;
+  recorder.program = p;
+  if (APEX_hooks_register(cpu, &recorder.tool) != 0) {
+    return -1;
+  }
+  while ((cycles <= 0 || cpu->clock < cycles) && !APEX_cpu_cycle(cpu)) {
+  }
+  if (recorder.failed) {
+    fprintf(stderr, "APEX_Error : Out of memory recording %s\n", name);
+    return -1;
+  }
+  if (!p->num_records) {
+    fprintf(stderr, "APEX_Error : %s retired no instructions\n", name);
+    return -1;
+  }
+  p->cycles = (uint64_t)recorder.last_retire;
+  p->exercised = exercised(p);
+
+  /* The design points are only comparable if the model is exact here */
+  APEX_TimingConfig defaults;
+  APEX_timing_defaults(&defaults);
+  APEX_Timing t;
+  APEX_timing_init(&t, &defaults);
+  for (uint64_t r = 0; r < p->num_records; ++r) {
+    APEX_timing_step(&t, &p->records[r]);
+  }
+  p->model_cycles = t.retire;
+  if (p->model_cycles != p->cycles) {
+    fprintf(stderr,
+            "APEX_Error : The timing model takes %llu cycles for %s with the defaults "
+            "of this pipeline, which took %llu, so its design points would not be "
+            "comparable\n",
+            (unsigned long long)p->model_cycles, name, (unsigned long long)p->cycles);
+    return -1;
+  }
+  return 0;
+}
+
+static double
+point_cost(const APEX_TimingConfig* c)
+{
+  double cost = APEX_DSE_COST_BASE + APEX_DSE_COST_MUL / c->mul_latency;
+  if (c->forwarding) {
+    cost += APEX_DSE_COST_FORWARDING;
+    cost += c->store_bypass ? APEX_DSE_COST_STORE_BYPASS : 0;
+  }
+  return cost + (c->branch_stage == EX ? APEX_DSE_COST_BRANCH_EX : 0);
+}
+
+/*
+ * Keeps the parameters in 'unexercised' (APEX_DSE_* bits) at the values
+ * of this variant
+ */
+static void
+pin_unexercised(APEX_DseSpace* space, int unexercised)
+{
+  APEX_TimingConfig defaults;
+  APEX_timing_defaults(&defaults);
+  if (unexercised & APEX_DSE_FORWARDING) {
+    space->num_forwarding = 1;
+    space->forwarding[0] = defaults.forwarding;
+  }
+  if (unexercised & APEX_DSE_STORE_BYPASS) {
+    space->num_store_bypass = 1;
+    space->store_bypass[0] = defaults.store_bypass;
+  }
+  if (unexercised & APEX_DSE_MUL) {
+    space->num_mul = 1;
+    space->mul_latency[0] = defaults.mul_latency;
+  }
+  if (unexercised & APEX_DSE_BRANCH) {
+    space->num_branch = 1;
+    space->branch_stage[0] = defaults.branch_stage;
+  }
+}
+
+/* Every point of 'space', in order, returns how many */
+static int
+enumerate(const APEX_DseSpace* space, APEX_TimingConfig* configs)
+{
+  int count = 0;
+  for (int f = 0; f < space->num_forwarding; ++f) {
+    for (int s = 0; s < space->num_store_bypass; ++s) {
+      if (!space->forwarding[f] && s) {
+        continue;
+      }
+      for (int m = 0; m < space->num_mul; ++m) {
+        for (int b = 0; b < space->num_branch; ++b) {
+          APEX_TimingConfig* c = &configs[count++];
+          APEX_timing_defaults(c);
+          c->forwarding = space->forwarding[f];
+          c->store_bypass = space->forwarding[f] ? space->store_bypass[s] : 0;
+          c->mul_latency = space->mul_latency[m];
+          c->branch_stage = space->branch_stage[b];
+        }
+      }
+    }
+  }
+  return count;
+}
+
+typedef struct DseChild
+{
+  const APEX_Dse* dse;
+  const APEX_TimingConfig* config;
+} DseChild;
+
+/* Body of a child, replays every program under one configuration */
+static void
+run_child(void* arg, void* out)
+{
+  const DseChild* child = arg;
+  APEX_DseResult* result = out;
+  for (int i = 0; i < child->dse->num_programs; ++i) {
+    const APEX_DseProgram* p = &child->dse->programs[i];
+    APEX_Timing t;
+    APEX_timing_init(&t, child->config);
+    for (uint64_t r = 0; r < p->num_records; ++r) {
+      APEX_timing_step(&t, &p->records[r]);
+    }
+    result->cycles[i] = t.retire;
+  }
+}
+
+static int
+compare_ints(const void* a, const void* b)
+{
+  return *(const int*)a - *(const int*)b;
+}
+
+/*
+ * Explores every point of 'space', or 'sample' of them picked at random
+ * when 'sample' is positive and smaller, 'jobs' children at a time (0
+ * for one per CPU). Parameters no program exercises are not explored.
+ * Returns -1 if a child failed
+ */
+int
+APEX_dse_run(APEX_Dse* dse, const APEX_DseSpace* space, int sample, unsigned seed,
+             int jobs)
+{
+  int exercised_bits = 0;
+  for (int p = 0; p < dse->num_programs; ++p) {
+    exercised_bits |= dse->programs[p].exercised;
+  }
+  dse->unexercised = ~exercised_bits & (APEX_DSE_FORWARDING | APEX_DSE_STORE_BYPASS |
+                                        APEX_DSE_MUL | APEX_DSE_BRANCH);
+  APEX_DseSpace pinned = *space;
+  pin_unexercised(&pinned, dse->unexercised);
+  space = &pinned;
+
+  int most = space->num_forwarding * space->num_store_bypass * space->num_mul *
+             space->num_branch;
+  APEX_TimingConfig* configs = calloc(most, sizeof(*configs));
+  int* chosen = calloc(most, sizeof(*chosen));
+  if (!configs || !chosen) {
+    free(configs);
+    free(chosen);
+    fprintf(stderr, "APEX_Error : Out of memory for %d design points\n", most);
+    return -1;
+  }
+  dse->space_size = enumerate(space, configs);
+  int count = dse->space_size;
+  for (int i = 0; i < count; ++i) {
+    chosen[i] = i;
+  }
+  if (sample > 0 && sample < count) {
+    /* The first 'sample' of a Fisher-Yates shuffle, back in space order */
+    for (int i = 0; i < sample; ++i) {
+      int j = i + (int)(mix64(((uint64_t)seed << 32) ^ (uint64_t)i) % (uint64_t)(count - i));
+      int swap = chosen[i];
+      chosen[i] = chosen[j];
+      chosen[j] = swap;
+    }
+    count = sample;
+    qsort(chosen, count, sizeof(*chosen), compare_ints);
+  }
+
+  dse->points = calloc(count, sizeof(*dse->points));
+  APEX_ForkPool pool;
+  int status = dse->points ? APEX_forkpool_init(&pool, count, sizeof(APEX_DseResult), jobs)
+                           : -1;
+  if (status != 0) {
+    free(dse->points);
+    dse->points = NULL;
+    free(configs);
+    free(chosen);
+    return -1;
+  }
+  dse->num_points = count;
+  for (int i = 0; i < count; ++i) {
+    APEX_DsePoint* point = &dse->points[i];
+    point->config = configs[chosen[i]];
+    point->cost = point_cost(&point->config);
+    DseChild child = { dse, &point->config };
+    APEX_forkpool_spawn(&pool, i, run_child, &child);
+  }
+  APEX_forkpool_wait(&pool);
+
+  for (int i = 0; i < count; ++i) {
+    APEX_DsePoint* point = &dse->points[i];
+    const APEX_DseResult* r = APEX_forkpool_result(&pool, i);
+    if (!r) {
+      fprintf(stderr, "APEX_Error : Design point %d failed\n", i);
+      point->cpi = -1;
+      status = -1;
+      continue;
+    }
+    point->result = *r;
+    double log_sum = 0;
+    for (int p = 0; p < dse->num_programs; ++p) {
+      log_sum += log((double)r->cycles[p] / dse->programs[p].num_records);
+    }
+    point->cpi = exp(log_sum / dse->num_programs);
+  }
+  APEX_forkpool_free(&pool);
+
+  /* Pareto front, lower cost and lower CPI are better */
+  for (int i = 0; i < count; ++i) {
+    APEX_DsePoint* a = &dse->points[i];
+    a->pareto = a->cpi >= 0;
+    for (int j = 0; a->pareto && j < count; ++j) {
+      const APEX_DsePoint* b = &dse->points[j];
+      if (j != i && b->cpi >= 0 && b->cost <= a->cost && b->cpi <= a->cpi &&
+          (b->cost < a->cost || b->cpi < a->cpi)) {
+        a->pareto = 0;
+      }
+    }
+  }
+  free(configs);
+  free(chosen);
+  return status;
+}
+
+static void
+print_config(const APEX_TimingConfig* c)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "forward:%d,store_bypass:%d,mul:%d,branch:%s", c->forwarding,
+           c->store_bypass, c->mul_latency, c->branch_stage == EX ? "EX" : "MEM");
+  printf("%-44s", buf);
+}
+
+static int
+compare_cost(const void* a, const void* b)
+{
+  const APEX_DsePoint* x = *(const APEX_DsePoint* const*)a;
+  const APEX_DsePoint* y = *(const APEX_DsePoint* const*)b;
+  return (x->cost > y->cost) - (x->cost < y->cost);
+}
+
+void
+APEX_dse_report(const APEX_Dse* dse)
+{
+  printf("--------------------------------\n");
+  printf("------DESIGN SPACE------\n");
+  printf("--------------------------------\n");
+  for (int p = 0; p < dse->num_programs; ++p) {
+    const APEX_DseProgram* program = &dse->programs[p];
+    printf("Program %-13d: %s, %llu instructions, %llu cycles, the defaults of this "
+           "variant deviate by %lld\n",
+           p, program->name, (unsigned long long)program->num_records,
+           (unsigned long long)program->cycles,
+           (long long)(program->model_cycles - program->cycles));
+  }
+  if (dse->unexercised) {
+    static const char* names[] = { "forward", "store_bypass", "mul", "branch" };
+    printf("Not exercised        :");
+    for (int i = 0, listed = 0; i < 4; ++i) {
+      if (dse->unexercised & (1 << i)) {
+        printf("%s %s", listed++ ? "," : "", names[i]);
+      }
+    }
+    printf(", kept at the values of this variant\n");
+  }
+  printf("Points               : %d of %d\n", dse->num_points, dse->space_size);
+  printf("%-5s %-44s %-8s ", "#", "Configuration", "Cost");
+  for (int p = 0; p < dse->num_programs; ++p) {
+    char column[24];
+    snprintf(column, sizeof(column), "Cycles %d", p);
+    printf("%-12s ", column);
+  }
+  printf("%-8s %s\n", "CPI", "Pareto");
+  for (int i = 0; i < dse->num_points; ++i) {
+    const APEX_DsePoint* point = &dse->points[i];
+    printf("%-5d ", i);
+    print_config(&point->config);
+    printf(" %-8.1f ", point->cost);
+    if (point->cpi < 0) {
+      printf("failed\n");
+      continue;
+    }
+    for (int p = 0; p < dse->num_programs; ++p) {
+      printf("%-12llu ", (unsigned long long)point->result.cycles[p]);
+    }
+    printf("%-8.4f %s\n", point->cpi, point->pareto ? "*" : "");
+  }
+
+  const APEX_DsePoint** front = malloc(sizeof(*front) * (dse->num_points ? dse->num_points : 1));
+  if (!front) {
+    return;
+  }
+  int size = 0;
+  for (int i = 0; i < dse->num_points; ++i) {
+    if (dse->points[i].pareto) {
+      front[size++] = &dse->points[i];
+    }
+  }
+  qsort(front, size, sizeof(*front), compare_cost);
+  printf("Pareto front         : %d point%s, by cost\n", size, size == 1 ? "" : "s");
+  for (int i = 0; i < size; ++i) {
+    printf("%-5d ", (int)(front[i] - dse->points));
+    print_config(&front[i]->config);
+    printf(" %-8.1f %.4f\n", front[i]->cost, front[i]->cpi);
+  }
+  free(front);
+}
+
+void
+APEX_dse_free(APEX_Dse* dse)
+{
+  for (int p = 0; p < dse->num_programs; ++p) {
+    free(dse->programs[p].name);
+    free(dse->programs[p].records);
+  }
+  free(dse->points);
+  memset(dse, 0, sizeof(*dse));
+}
@@ -0,0 +1,118 @@
+#ifndef _APEX_DSE_H_
+#define _APEX_DSE_H_
+/**
+ *  dse.h
+ *  Design space exploration over the parameters of the timing model
+ *
+ *  Each program runs once in the pipeline and its committed instruction
+ *  stream is kept in memory (trace.h). Its replay with the defaults of
+ *  the variant must take the cycles the pipeline took, or the run stops
+ *  there: the cycle axis is only as good as the timing model. The space
+ *  is every combination of the values given for each timing parameter
+ *  (timing.h), or a random sample of them. A parameter no program
+ *  exercises (no MUL, no taken branch, no STORE to the address of the
+ *  LOAD before it, no register read within three instructions of its
+ *  write) is not explored but kept at the value of this variant, and the
+ *  report names it, so the front does not present it as a free saving. One child process per design point (forkpool.h)
+ *  replays every trace through the timing model with its parameters.
+ *  Points are ranked by the geometric mean CPI over the programs against
+ *  a hardware cost proxy, and the report marks the Pareto front: points
+ *  no other point matches or beats on both.
+ *
+ *  The cost proxy is relative, in units of the pipeline without
+ *  forwarding that resolves branches in Memory: forwarding paths from
+ *  Execute and Memory to both operands, the STORE bypass, a
+ *  multiplier whose area grows as its latency shrinks, and a branch
+ *  comparator and redirect path in Execute.
+ */
+#include <stdint.h>
+
+#include "cpu.h"
+#include "timing.h"
+#include "trace.h"
+
+#define APEX_DSE_MAX_PROGRAMS 64
+
+/* Most values of one parameter */
+#define APEX_DSE_MAX_VALUES 16
+
+#define APEX_DSE_COST_BASE 100.0
+#define APEX_DSE_COST_FORWARDING 25.0
+#define APEX_DSE_COST_STORE_BYPASS 5.0
+#define APEX_DSE_COST_MUL 64.0  // Divided by the MUL latency
+#define APEX_DSE_COST_BRANCH_EX 10.0
+
+/* Parameters, as bits of what a program exercises */
+#define APEX_DSE_FORWARDING 0x1
+#define APEX_DSE_STORE_BYPASS 0x2
+#define APEX_DSE_MUL 0x4
+#define APEX_DSE_BRANCH 0x8
+
+/* Values of each parameter, from items such as "mul:1-4" or "branch:EX/MEM" */
+typedef struct APEX_DseSpace
+{
+  int num_forwarding;
+  int forwarding[2];
+  int num_store_bypass;
+  int store_bypass[2];
+  int num_mul;
+  int mul_latency[APEX_DSE_MAX_VALUES];
+  int num_branch;
+  int branch_stage[2];
+} APEX_DseSpace;
+
+typedef struct APEX_DseProgram
+{
+  char* name;
+  APEX_TraceRecord* records;  // Committed instruction stream
+  uint64_t num_records;
+  uint64_t cycles;            // Pipeline cycle of the last retirement
+  uint64_t model_cycles;      // Timing model with the defaults of this variant
+  int exercised;              // APEX_DSE_* bits
+} APEX_DseProgram;
+
+/* Written by a child to its pipe */
+typedef struct APEX_DseResult
+{
+  uint64_t cycles[APEX_DSE_MAX_PROGRAMS];
+} APEX_DseResult;
+
+typedef struct APEX_DsePoint
+{
+  APEX_TimingConfig config;
+  double cost;
+  double cpi;  // Geometric mean over the programs
+  int pareto;
+  APEX_DseResult result;
+} APEX_DsePoint;
+
+typedef struct APEX_Dse
+{
+  int num_programs;
+  APEX_DseProgram programs[APEX_DSE_MAX_PROGRAMS];
+  int num_points;
+  int space_size;  // Points in the whole space
+  int unexercised; // APEX_DSE_* bits kept at the values of this variant
+  APEX_DsePoint* points;
+} APEX_Dse;
+
+void
+APEX_dse_space_defaults(APEX_DseSpace* space);
+
+int
+APEX_dse_space_parse(APEX_DseSpace* space, const char* spec);
+
+int
+APEX_dse_add_program(APEX_Dse* dse, APEX_CPU* cpu, const char* name, int cycles);
+
+int
+APEX_dse_run(APEX_Dse* dse, const APEX_DseSpace* space, int sample, unsigned seed,
+             int jobs);
+
+void
+APEX_dse_report(const APEX_Dse* dse);
+
+void
+APEX_dse_free(APEX_Dse* dse);
+
+#endif
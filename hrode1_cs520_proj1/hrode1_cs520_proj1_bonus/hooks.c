@@ -0,0 +1,192 @@
+/*
+ *  hooks.c
+ *  Registration and dispatch of analysis tool hooks
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+
+static void
+add_to_event(APEX_Hooks* hooks, int ev, APEX_Tool* tool)
+{
+  hooks->by_event[ev][hooks->count[ev]] = tool;
+  hooks->count[ev]++;
+}
+
+/*
+ * Attaches a tool to the CPU. Only the callbacks the tool provides are
+ * added to the dispatch lists, so the remaining events stay free.
+ */
+int
+APEX_hooks_register(APEX_CPU* cpu, APEX_Tool* tool)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  if (!tool || hooks->num_tools == APEX_MAX_TOOLS) {
+    fprintf(stderr, "APEX_Error : Unable to register tool\n");
+    return -1;
+  }
+  hooks->tools[hooks->num_tools] = tool;
+  hooks->num_tools++;
+
+  if (tool->on_fetch) {
+    add_to_event(hooks, APEX_EV_FETCH, tool);
+  }
+  if (tool->on_decode) {
+    add_to_event(hooks, APEX_EV_DECODE, tool);
+  }
+  if (tool->on_issue) {
+    add_to_event(hooks, APEX_EV_ISSUE, tool);
+  }
+  if (tool->on_memory) {
+    add_to_event(hooks, APEX_EV_MEMORY, tool);
+  }
+  if (tool->on_retire) {
+    add_to_event(hooks, APEX_EV_RETIRE, tool);
+  }
+  if (tool->on_flush) {
+    add_to_event(hooks, APEX_EV_FLUSH, tool);
+  }
+  if (tool->on_stall) {
+    add_to_event(hooks, APEX_EV_STALL, tool);
+  }
+  if (tool->on_show) {
+    add_to_event(hooks, APEX_EV_SHOW, tool);
+  }
+  if (tool->on_cycle) {
+    add_to_event(hooks, APEX_EV_CYCLE, tool);
+  }
+  return 0;
+}
+
+/*
+ * Dispatch functions, bubbles (pc 0) moving through the pipeline
+ * are not reported to tools
+ */
+void
+APEX_hooks_fetch(APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  for (int i = 0; i < hooks->count[APEX_EV_FETCH]; ++i) {
+    APEX_Tool* tool = hooks->by_event[APEX_EV_FETCH][i];
+    tool->on_fetch(tool->ctx, cpu, stage);
+  }
+}
+
+void
+APEX_hooks_decode(APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  if (stage->pc == 0) {
+    return;
+  }
+  for (int i = 0; i < hooks->count[APEX_EV_DECODE]; ++i) {
+    APEX_Tool* tool = hooks->by_event[APEX_EV_DECODE][i];
+    tool->on_decode(tool->ctx, cpu, stage);
+  }
+}
+
+void
+APEX_hooks_issue(APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  if (stage->pc == 0) {
+    return;
+  }
+  for (int i = 0; i < hooks->count[APEX_EV_ISSUE]; ++i) {
+    APEX_Tool* tool = hooks->by_event[APEX_EV_ISSUE][i];
+    tool->on_issue(tool->ctx, cpu, stage);
+  }
+}
+
+void
+APEX_hooks_memory(APEX_CPU* cpu, const CPU_Stage* stage, int address,
+                  int value, int is_store)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  for (int i = 0; i < hooks->count[APEX_EV_MEMORY]; ++i) {
+    APEX_Tool* tool = hooks->by_event[APEX_EV_MEMORY][i];
+    tool->on_memory(tool->ctx, cpu, stage, address, value, is_store);
+  }
+}
+
+void
+APEX_hooks_retire(APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  if (stage->pc == 0) {
+    return;
+  }
+  for (int i = 0; i < hooks->count[APEX_EV_RETIRE]; ++i) {
+    APEX_Tool* tool = hooks->by_event[APEX_EV_RETIRE][i];
+    tool->on_retire(tool->ctx, cpu, stage);
+  }
+}
+
+void
+APEX_hooks_flush(APEX_CPU* cpu, int pc, int target)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  for (int i = 0; i < hooks->count[APEX_EV_FLUSH]; ++i) {
+    APEX_Tool* tool = hooks->by_event[APEX_EV_FLUSH][i];
+    tool->on_flush(tool->ctx, cpu, pc, target);
+  }
+}
+
+void
+APEX_hooks_stall(APEX_CPU* cpu, int stage_id)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  for (int i = 0; i < hooks->count[APEX_EV_STALL]; ++i) {
+    APEX_Tool* tool = hooks->by_event[APEX_EV_STALL][i];
+    tool->on_stall(tool->ctx, cpu, stage_id);
+  }
+}
+
+void
+APEX_hooks_show(APEX_CPU* cpu, int stage_id, const CPU_Stage* stage)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  for (int i = 0; i < hooks->count[APEX_EV_SHOW]; ++i) {
+    APEX_Tool* tool = hooks->by_event[APEX_EV_SHOW][i];
+    tool->on_show(tool->ctx, cpu, stage_id, stage);
+  }
+}
+
+void
+APEX_hooks_cycle(APEX_CPU* cpu)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  for (int i = 0; i < hooks->count[APEX_EV_CYCLE]; ++i) {
+    APEX_Tool* tool = hooks->by_event[APEX_EV_CYCLE][i];
+    tool->on_cycle(tool->ctx, cpu);
+  }
+}
+
+/* Gives every attached tool the chance to print its report */
+void
+APEX_hooks_finish(APEX_CPU* cpu)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  for (int i = 0; i < hooks->num_tools; ++i) {
+    APEX_Tool* tool = hooks->tools[i];
+    if (tool->on_finish) {
+      tool->on_finish(tool->ctx, cpu);
+    }
+  }
+}
+
+/* Detaches and frees every tool, called when the CPU is destroyed */
+void
+APEX_hooks_release(APEX_CPU* cpu)
+{
+  APEX_Hooks* hooks = &cpu->hooks;
+  for (int i = 0; i < hooks->num_tools; ++i) {
+    APEX_Tool* tool = hooks->tools[i];
+    if (tool->on_release) {
+      tool->on_release(tool->ctx);
+    }
+  }
+  memset(hooks, 0, sizeof(*hooks));
+}
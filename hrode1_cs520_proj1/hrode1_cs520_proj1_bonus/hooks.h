@@ -0,0 +1,174 @@
+#ifndef _APEX_HOOKS_H_
+#define _APEX_HOOKS_H_
+/**
+ *  hooks.h
+ *  Event hook interface for external analysis tools
+ *
+ *  A tool fills in an APEX_Tool with the callbacks it is interested in
+ *  and registers it with APEX_hooks_register(). Callbacks left NULL are
+ *  never dispatched. Building with -DENABLE_HOOKS=0 removes every hook
+ *  site from the pipeline; otherwise an unregistered event costs a
+ *  single counter test.
+ */
+
+/* Set this flag to 0 to compile all hook sites out of the pipeline */
+#ifndef ENABLE_HOOKS
+#define ENABLE_HOOKS 1
+#endif
+
+/* Maximum number of tools attached to one CPU */
+#define APEX_MAX_TOOLS 8
+
+struct APEX_CPU;
+struct CPU_Stage;
+
+enum
+{
+  APEX_EV_FETCH,
+  APEX_EV_DECODE,
+  APEX_EV_ISSUE,
+  APEX_EV_MEMORY,
+  APEX_EV_RETIRE,
+  APEX_EV_FLUSH,
+  APEX_EV_STALL,
+  APEX_EV_SHOW,
+  APEX_EV_CYCLE,
+  APEX_NUM_EVENTS
+};
+
+/* Callbacks of an analysis tool, NULL entries are not registered */
+typedef struct APEX_Tool
+{
+  const char* name;
+  void* ctx;
+
+  /* Fetch and decode may report wrong-path instructions that a later
+   * flush squashes, issue and retire only see the committed stream */
+
+  /* Instruction read from code memory into the Fetch latch */
+  void (*on_fetch)(void* ctx, const struct APEX_CPU* cpu,
+                   const struct CPU_Stage* stage);
+
+  /* Instruction read its operands in Decode/RF and moved to Execute */
+  void (*on_decode)(void* ctx, const struct APEX_CPU* cpu,
+                    const struct CPU_Stage* stage);
+
+  /* Instruction performed its operation in Execute */
+  void (*on_issue)(void* ctx, const struct APEX_CPU* cpu,
+                   const struct CPU_Stage* stage);
+
+  /* LOAD/STORE accessed data memory at byte address 'address' */
+  void (*on_memory)(void* ctx, const struct APEX_CPU* cpu,
+                    const struct CPU_Stage* stage, int address, int value,
+                    int is_store);
+
+  /* Instruction completed Writeback */
+  void (*on_retire)(void* ctx, const struct APEX_CPU* cpu,
+                    const struct CPU_Stage* stage);
+
+  /* Control transfer at 'pc' redirected fetch to 'target' */
+  void (*on_flush)(void* ctx, const struct APEX_CPU* cpu, int pc, int target);
+
+  /* Stage 'stage_id' (F, DRF, EX, ...) held its instruction this cycle */
+  void (*on_stall)(void* ctx, const struct APEX_CPU* cpu, int stage_id);
+
+  /* Stage 'stage_id' shows 'stage' this cycle, as printed by display
+   * mode (bubbles included, in the order the stages run) */
+  void (*on_show)(void* ctx, const struct APEX_CPU* cpu, int stage_id,
+                  const struct CPU_Stage* stage);
+
+  /* Cycle ended, cpu->clock cycles have completed */
+  void (*on_cycle)(void* ctx, const struct APEX_CPU* cpu);
+
+  /* Simulation finished, print any report */
+  void (*on_finish)(void* ctx, const struct APEX_CPU* cpu);
+
+  /* CPU is being destroyed, free the tool */
+  void (*on_release)(void* ctx);
+} APEX_Tool;
+
+/* Per CPU registry, one list of tools per event */
+typedef struct APEX_Hooks
+{
+  int num_tools;
+  APEX_Tool* tools[APEX_MAX_TOOLS];
+  int count[APEX_NUM_EVENTS];
+  APEX_Tool* by_event[APEX_NUM_EVENTS][APEX_MAX_TOOLS];
+} APEX_Hooks;
+
+int
+APEX_hooks_register(struct APEX_CPU* cpu, APEX_Tool* tool);
+
+void
+APEX_hooks_fetch(struct APEX_CPU* cpu, const struct CPU_Stage* stage);
+
+void
+APEX_hooks_decode(struct APEX_CPU* cpu, const struct CPU_Stage* stage);
+
+void
+APEX_hooks_issue(struct APEX_CPU* cpu, const struct CPU_Stage* stage);
+
+void
+APEX_hooks_memory(struct APEX_CPU* cpu, const struct CPU_Stage* stage,
+                  int address, int value, int is_store);
+
+void
+APEX_hooks_retire(struct APEX_CPU* cpu, const struct CPU_Stage* stage);
+
+void
+APEX_hooks_flush(struct APEX_CPU* cpu, int pc, int target);
+
+void
+APEX_hooks_stall(struct APEX_CPU* cpu, int stage_id);
+
+void
+APEX_hooks_show(struct APEX_CPU* cpu, int stage_id,
+                const struct CPU_Stage* stage);
+
+void
+APEX_hooks_cycle(struct APEX_CPU* cpu);
+
+void
+APEX_hooks_finish(struct APEX_CPU* cpu);
+
+void
+APEX_hooks_release(struct APEX_CPU* cpu);
+
+/*
+ * Hook sites used by the pipeline. The dispatch function is only called
+ * when at least one tool registered for the event.
+ */
+#if ENABLE_HOOKS
+#define APEX_HOOK(cpu, ev, call)                                               \
+  do {                                                                         \
+    if ((cpu)->hooks.count[ev]) {                                              \
+      call;                                                                    \
+    }                                                                          \
+  } while (0)
+#else
+#define APEX_HOOK(cpu, ev, call)                                               \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#define APEX_HOOK_FETCH(cpu, stage)                                            \
+  APEX_HOOK(cpu, APEX_EV_FETCH, APEX_hooks_fetch((cpu), (stage)))
+#define APEX_HOOK_DECODE(cpu, stage)                                           \
+  APEX_HOOK(cpu, APEX_EV_DECODE, APEX_hooks_decode((cpu), (stage)))
+#define APEX_HOOK_ISSUE(cpu, stage)                                            \
+  APEX_HOOK(cpu, APEX_EV_ISSUE, APEX_hooks_issue((cpu), (stage)))
+#define APEX_HOOK_MEMORY(cpu, stage, address, value, is_store)                 \
+  APEX_HOOK(cpu, APEX_EV_MEMORY,                                               \
+            APEX_hooks_memory((cpu), (stage), (address), (value), (is_store)))
+#define APEX_HOOK_RETIRE(cpu, stage)                                           \
+  APEX_HOOK(cpu, APEX_EV_RETIRE, APEX_hooks_retire((cpu), (stage)))
+#define APEX_HOOK_FLUSH(cpu, pc, target)                                       \
+  APEX_HOOK(cpu, APEX_EV_FLUSH, APEX_hooks_flush((cpu), (pc), (target)))
+#define APEX_HOOK_STALL(cpu, stage_id)                                         \
+  APEX_HOOK(cpu, APEX_EV_STALL, APEX_hooks_stall((cpu), (stage_id)))
+#define APEX_HOOK_SHOW(cpu, stage_id, stage)                                   \
+  APEX_HOOK(cpu, APEX_EV_SHOW, APEX_hooks_show((cpu), (stage_id), (stage)))
+#define APEX_HOOK_CYCLE(cpu)                                                   \
+  APEX_HOOK(cpu, APEX_EV_CYCLE, APEX_hooks_cycle((cpu)))
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ *  insmix.c
+ *  Dynamic instruction mix and branch behaviour statistics
+ *
+ *  Counters are indexed by the decoded OP_* code and updated from the
+ *  Writeback (retire) and Memory (flush) hooks, so no strings are
+ *  touched while simulating.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "addr_map.h"
+#include "tools.h"
+
+#define IM_BUCKETS 8
+
+/* Dynamic behaviour of one static BZ/BNZ/JUMP */
+typedef struct BranchSite
+{
+  int pc;
+  int op;
+  uint64_t taken;
+  uint64_t not_taken;
+} BranchSite;
+
+typedef struct InsMix
+{
+  APEX_Tool tool;
+
+  uint64_t retired;
+  uint64_t count[NUM_OPCODES];
+
+  /* Register dependence distance, in retired instructions */
+  uint64_t reg_producer[16];
+  uint64_t dep_sum[NUM_OPCODES];
+  uint64_t dep_edges[NUM_OPCODES];
+
+  /* Zero flag producer to BZ/BNZ consumer distance */
+  uint64_t flag_producer;
+  uint64_t flag_sum;
+  uint64_t flag_edges;
+  uint64_t flag_hist[IM_BUCKETS];
+
+  /* Branch sites, the map gives the index into 'sites' */
+  AddrMap site_index;
+  BranchSite* sites;
+  int num_sites;
+  int max_sites;
+  int taken_pc;  // Branch that redirected fetch in Memory, 0 if none
+} InsMix;
+
+static int
+bucket_of(uint64_t distance)
+{
+  int b = 0;
+  while (distance > 1 && b < IM_BUCKETS - 1) {
+    distance = (distance + 1) >> 1;
+    b++;
+  }
+  return b;
+}
+
+static BranchSite*
+find_site(InsMix* im, const CPU_Stage* stage)
+{
+  uint64_t* index = addr_map_get(&im->site_index, (uint32_t)stage->pc);
+  if (index) {
+    return &im->sites[*index];
+  }
+  if (im->num_sites == im->max_sites) {
+    int max = im->max_sites ? 2 * im->max_sites : 64;
+    BranchSite* sites = realloc(im->sites, sizeof(*sites) * max);
+    if (!sites) {
+      return NULL;
+    }
+    im->sites = sites;
+    im->max_sites = max;
+  }
+  index = addr_map_put(&im->site_index, (uint32_t)stage->pc);
+  if (!index) {
+    return NULL;
+  }
+  *index = im->num_sites;
+  BranchSite* site = &im->sites[im->num_sites++];
+  site->pc = stage->pc;
+  site->op = stage->op;
+  site->taken = 0;
+  site->not_taken = 0;
+  return site;
+}
+
+static void
+on_flush(void* ctx, const APEX_CPU* cpu, int pc, int target)
+{
+  InsMix* im = ctx;
+  (void)cpu;
+  (void)target;
+  im->taken_pc = pc;
+}
+
+static void
+record_dependence(InsMix* im, int op, int reg)
+{
+  uint64_t producer = im->reg_producer[reg & 15];
+  if (producer) {
+    im->dep_sum[op] += im->retired - producer;
+    im->dep_edges[op]++;
+  }
+}
+
+static void
+on_retire(void* ctx, const APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  InsMix* im = ctx;
+  int op = stage->op;
+  int operands = get_opcode_operands(op);
+  (void)cpu;
+
+  /* Sequence numbers start at 1 so 0 means "no producer yet" */
+  im->retired++;
+  im->count[op]++;
+
+  if (operands & READS_RS1) {
+    record_dependence(im, op, stage->rs1);
+  }
+  if (operands & READS_RS2) {
+    record_dependence(im, op, stage->rs2);
+  }
+  if ((operands & READS_FLAG) && im->flag_producer) {
+    uint64_t distance = im->retired - im->flag_producer;
+    im->flag_sum += distance;
+    im->flag_edges++;
+    im->flag_hist[bucket_of(distance)]++;
+  }
+  if (operands & WRITES_RD) {
+    im->reg_producer[stage->rd & 15] = im->retired;
+  }
+  if (operands & WRITES_FLAG) {
+    im->flag_producer = im->retired;
+  }
+
+  if (operands & IS_BRANCH) {
+    BranchSite* site = find_site(im, stage);
+    if (site) {
+      if (im->taken_pc == stage->pc) {
+        site->taken++;
+      }
+      else {
+        site->not_taken++;
+      }
+    }
+    im->taken_pc = 0;
+  }
+}
+
+static int
+by_pc(const void* a, const void* b)
+{
+  const BranchSite* x = a;
+  const BranchSite* y = b;
+  return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+static void
+on_finish(void* ctx, const APEX_CPU* cpu)
+{
+  InsMix* im = ctx;
+  uint64_t retired = im->retired ? im->retired : 1;
+  (void)cpu;
+
+  printf("--------------------------------\n");
+  printf("------INSTRUCTION MIX------\n");
+  printf("--------------------------------\n");
+  printf("%-9s %12s %7s %14s\n", "opcode", "count", "share", "avg dep dist");
+  for (int op = 0; op < NUM_OPCODES; ++op) {
+    if (!im->count[op]) {
+      continue;
+    }
+    printf("%-9s %12llu %6.1f%% ", get_opcode_name(op),
+           (unsigned long long)im->count[op],
+           100.0 * im->count[op] / retired);
+    if (im->dep_edges[op]) {
+      printf("%14.2f\n", (double)im->dep_sum[op] / im->dep_edges[op]);
+    }
+    else {
+      printf("%14s\n", "-");
+    }
+  }
+  printf("%-9s %12llu\n", "total", (unsigned long long)im->retired);
+
+  printf("Zero flag producer -> BZ/BNZ distance : ");
+  if (im->flag_edges) {
+    printf("avg %.2f over %llu branches\n",
+           (double)im->flag_sum / im->flag_edges,
+           (unsigned long long)im->flag_edges);
+    for (int b = 0; b < IM_BUCKETS; ++b) {
+      if (!im->flag_hist[b]) {
+        continue;
+      }
+      uint64_t lo = b ? (1ull << (b - 1)) + 1 : 1;
+      uint64_t hi = 1ull << b;
+      if (b == IM_BUCKETS - 1) {
+        printf("  %4llu +       : %10llu\n", (unsigned long long)lo,
+               (unsigned long long)im->flag_hist[b]);
+      }
+      else {
+        printf("  %4llu - %-4llu : %10llu\n", (unsigned long long)lo,
+               (unsigned long long)hi, (unsigned long long)im->flag_hist[b]);
+      }
+    }
+  }
+  else {
+    printf("-\n");
+  }
+
+  printf("Branch sites : %d\n", im->num_sites);
+  qsort(im->sites, im->num_sites, sizeof(*im->sites), by_pc);
+  for (int i = 0; i < im->num_sites; ++i) {
+    BranchSite* site = &im->sites[i];
+    uint64_t total = site->taken + site->not_taken;
+    printf("  pc(%d) %-5s taken %10llu  not taken %10llu  %5.1f%% taken\n",
+           site->pc, get_opcode_name(site->op),
+           (unsigned long long)site->taken,
+           (unsigned long long)site->not_taken,
+           total ? 100.0 * site->taken / total : 0.0);
+  }
+}
+
+static void
+on_release(void* ctx)
+{
+  InsMix* im = ctx;
+  addr_map_free(&im->site_index);
+  free(im->sites);
+  free(im);
+}
+
+int
+APEX_insmix_attach(APEX_CPU* cpu)
+{
+  InsMix* im = calloc(1, sizeof(*im));
+  if (!im) {
+    return -1;
+  }
+  if (addr_map_init(&im->site_index, 64) != 0) {
+    free(im);
+    return -1;
+  }
+  im->tool.name = "insmix";
+  im->tool.ctx = im;
+  im->tool.on_retire = on_retire;
+  im->tool.on_flush = on_flush;
+  im->tool.on_finish = on_finish;
+  im->tool.on_release = on_release;
+  if (APEX_hooks_register(cpu, &im->tool) != 0) {
+    on_release(im);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,356 @@
+/*
+ *  jit.c
+ *  Translation of basic block bodies to native x86-64 code, see jit.h
+ *
+ *  A compiled body keeps the guest register file where it is, in
+ *  cpu->regs, and works on it with memory operands:
+ *
+ *    rbx  regs           r13  zero flag
+ *    r12  data memory    r14d return status
+ *
+ *  LOAD and STORE walk the page table of mem.h inline. Directory, table
+ *  and word indexes are masked out of the 32 bit address, so every
+ *  address lands in the table and no access can leave data memory; a
+ *  missing page reads as 0, and a STORE to one calls mem_write() to
+ *  allocate it. Only the last instruction of a body that sets the zero
+ *  flag writes it, with the value integerALU()/mulALU() would leave.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Bytes of code generated for one instruction at most, and for entry and exit */
+#define MAX_INS_CODE 128
+#define MAX_FRAME_CODE 48
+
+_Static_assert(offsetof(APEX_Memory, tables) == 0, "tables at the start of memory");
+_Static_assert(offsetof(APEX_MemTable, pages) == 0, "pages at the start of a table");
+
+static uint8_t*
+emit1(uint8_t* p, int b)
+{
+  *p++ = (uint8_t)b;
+  return p;
+}
+
+static uint8_t*
+emit4(uint8_t* p, uint32_t v)
+{
+  memcpy(p, &v, 4);
+  return p + 4;
+}
+
+static uint8_t*
+emit_bytes(uint8_t* p, const uint8_t* bytes, size_t n)
+{
+  memcpy(p, bytes, n);
+  return p + n;
+}
+
+#define EMIT(p, ...)                                                          \
+  emit_bytes((p), (const uint8_t[]){ __VA_ARGS__ },                          \
+             sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+/* Byte offset of a guest register from rbx */
+#define REG(r) (uint8_t)(4 * ((r) & 15))
+
+/* Patches the rel8 displacement at 'at' to jump to 'to' */
+static void
+patch_rel8(uint8_t* at, const uint8_t* to)
+{
+  *at = (uint8_t)(to - (at + 1));
+}
+
+/* zero flag = (eax == 0) */
+static uint8_t*
+emit_flag(uint8_t* p)
+{
+  return EMIT(p, 0x31, 0xd2,                // xor edx, edx
+              0x85, 0xc0,                   // test eax, eax
+              0x0f, 0x94, 0xc2,             // sete dl
+              0x41, 0x89, 0x55, 0x00);      // mov [r13], edx
+}
+
+/* eax = regs[rs] + imm, the LOAD/STORE address */
+static uint8_t*
+emit_address(uint8_t* p, int rs, int32_t imm)
+{
+  p = EMIT(p, 0x8b, 0x43, REG(rs));         // mov eax, [rbx + rs]
+  if (imm) {
+    p = emit1(p, 0x05);                     // add eax, imm
+    p = emit4(p, (uint32_t)imm);
+  }
+  return p;
+}
+
+/*
+ * Looks up the page holding address eax into rcx, jumping with a rel8
+ * to be patched when the table or page is missing. Returns the two
+ * displacements in 'miss'
+ */
+static uint8_t*
+emit_page_walk(uint8_t* p, uint8_t** miss)
+{
+  p = EMIT(p, 0x89, 0xc2,                   // mov edx, eax
+           0xc1, 0xea, 32 - MEM_DIR_BITS,   // shr edx, dir shift
+           0x49, 0x8b, 0x0c, 0xd4,          // mov rcx, [r12 + rdx * 8]
+           0x48, 0x85, 0xc9,                // test rcx, rcx
+           0x74, 0x00);                     // jz miss
+  miss[0] = p - 1;
+  p = EMIT(p, 0x89, 0xc2,                   // mov edx, eax
+           0xc1, 0xea, MEM_PAGE_BITS,       // shr edx, page shift
+           0x81, 0xe2);                     // and edx, table mask
+  p = emit4(p, MEM_TABLE_SIZE - 1);
+  p = EMIT(p, 0x48, 0x8b, 0x0c, 0xd1,       // mov rcx, [rcx + rdx * 8]
+           0x48, 0x85, 0xc9,                // test rcx, rcx
+           0x74, 0x00);                     // jz miss
+  miss[1] = p - 1;
+  return p;
+}
+
+/* Allocates the page of a STORE, returns -1 when out of memory */
+static int
+jit_store(APEX_Memory* mem, uint32_t address, int value)
+{
+  if (mem_write(mem, address, value) != 0) {
+    fprintf(stderr, "APEX_Error : Out of memory storing to address %d\n",
+            (int)address);
+    return -1;
+  }
+  return 0;
+}
+
+static uint8_t*
+emit_load(uint8_t* p, const APEX_Instruction* ins, int set_flag)
+{
+  uint8_t* miss[2];
+  p = emit_address(p, ins->rs1, ins->imm);
+  if (set_flag) {
+    p = emit_flag(p);
+  }
+  p = emit_page_walk(p, miss);
+  p = EMIT(p, 0xc1, 0xe8, 0x02,             // shr eax, 2
+           0x25);                           // and eax, word mask
+  p = emit4(p, MEM_PAGE_WORDS - 1);
+  p = EMIT(p, 0x8b, 0x04, 0x81,             // mov eax, [rcx + rax * 4]
+           0xeb, 0x00);                     // jmp done
+  uint8_t* done = p - 1;
+  patch_rel8(miss[0], p);
+  patch_rel8(miss[1], p);
+  p = EMIT(p, 0x31, 0xc0);                  // miss: xor eax, eax
+  patch_rel8(done, p);
+  return EMIT(p, 0x89, 0x43, REG(ins->rd)); // done: mov [rbx + rd], eax
+}
+
+static uint8_t*
+emit_store(uint8_t* p, const APEX_Instruction* ins, int set_flag)
+{
+  uint8_t* miss[2];
+  p = emit_address(p, ins->rs2, ins->imm);
+  if (set_flag) {
+    p = emit_flag(p);
+  }
+  p = emit_page_walk(p, miss);
+  p = EMIT(p, 0x89, 0xc2,                   // mov edx, eax
+           0xc1, 0xea, 0x02,                // shr edx, 2
+           0x81, 0xe2);                     // and edx, word mask
+  p = emit4(p, MEM_PAGE_WORDS - 1);
+  p = EMIT(p, 0x8b, 0x73, REG(ins->rs1),    // mov esi, [rbx + rs1]
+           0x89, 0x34, 0x91,                // mov [rcx + rdx * 4], esi
+           0xeb, 0x00);                     // jmp done
+  uint8_t* done[2] = { p - 1, NULL };
+
+  patch_rel8(miss[0], p);
+  patch_rel8(miss[1], p);
+  p = EMIT(p, 0x4c, 0x89, 0xe7,             // miss: mov rdi, r12
+           0x89, 0xc6,                      // mov esi, eax
+           0x8b, 0x53, REG(ins->rs1),       // mov edx, [rbx + rs1]
+           0x48, 0xb8);                     // mov rax, jit_store
+  uint64_t fn = (uint64_t)(uintptr_t)&jit_store;
+  memcpy(p, &fn, 8);
+  p += 8;
+  p = EMIT(p, 0xff, 0xd0,                   // call rax
+           0x85, 0xc0,                      // test eax, eax
+           0x74, 0x00);                     // jz done
+  done[1] = p - 1;
+  p = EMIT(p, 0x41, 0xbe, 0xff, 0xff, 0xff, 0xff);  // mov r14d, -1
+  patch_rel8(done[0], p);
+  patch_rel8(done[1], p);
+  return p;
+}
+
+/* rd = rs1 <op> rs2 */
+static uint8_t*
+emit_alu(uint8_t* p, const APEX_Instruction* ins, int set_flag)
+{
+  p = EMIT(p, 0x8b, 0x43, REG(ins->rs1));   // mov eax, [rbx + rs1]
+  switch (ins->op) {
+    case OP_ADD:  p = EMIT(p, 0x03); break;         // add eax, r/m32
+    case OP_SUB:  p = EMIT(p, 0x2b); break;         // sub
+    case OP_AND:  p = EMIT(p, 0x23); break;         // and
+    case OP_OR:   p = EMIT(p, 0x0b); break;         // or
+    case OP_EXOR: p = EMIT(p, 0x33); break;         // xor
+    default:      p = EMIT(p, 0x0f, 0xaf); break;   // imul, low 32 bits
+  }
+  p = EMIT(p, 0x43, REG(ins->rs2),          // [rbx + rs2]
+           0x89, 0x43, REG(ins->rd));       // mov [rbx + rd], eax
+  return set_flag ? emit_flag(p) : p;
+}
+
+static uint8_t*
+emit_movc(uint8_t* p, const APEX_Instruction* ins, int set_flag)
+{
+  p = EMIT(p, 0xc7, 0x43, REG(ins->rd));    // mov dword [rbx + rd], imm
+  p = emit4(p, (uint32_t)ins->imm);
+  if (set_flag) {
+    p = EMIT(p, 0x41, 0xc7, 0x45, 0x00);    // mov dword [r13], imm == 0
+    p = emit4(p, ins->imm == 0);
+  }
+  return p;
+}
+
+static int
+sets_flag(int op)
+{
+  return op >= OP_MOVC && op <= OP_MUL;
+}
+
+int
+APEX_jit_init(APEX_Jit* jit)
+{
+  memset(jit, 0, sizeof(*jit));
+  void* code = mmap(NULL, APEX_JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (code == MAP_FAILED) {
+    fprintf(stderr, "APEX_Error : Unable to map %u bytes of JIT code buffer\n",
+            APEX_JIT_CODE_SIZE);
+    return -1;
+  }
+  jit->code = code;
+  jit->size = APEX_JIT_CODE_SIZE;
+  return 0;
+}
+
+void
+APEX_jit_free(APEX_Jit* jit)
+{
+  if (jit->code) {
+    munmap(jit->code, jit->size);
+  }
+  memset(jit, 0, sizeof(*jit));
+}
+
+/*
+ * Compiles 'count' instructions, none of them a branch or HALT. The
+ * pages written are only writable while the block is generated.
+ * Returns NULL when the code buffer is full
+ */
+APEX_JitBlock
+APEX_jit_compile(APEX_Jit* jit, const APEX_Instruction* ins, int count)
+{
+  size_t start = (jit->used + 15) & ~(size_t)15;
+  size_t max_size = MAX_FRAME_CODE + (size_t)MAX_INS_CODE * count;
+  if (!jit->code || start + max_size > jit->size) {
+    return NULL;
+  }
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  uint8_t* lo = jit->code + (start & ~(page - 1));
+  uint8_t* hi = jit->code + ((start + max_size + page - 1) & ~(page - 1));
+  if (hi > jit->code + jit->size) {
+    hi = jit->code + jit->size;
+  }
+  if (mprotect(lo, hi - lo, PROT_READ | PROT_WRITE) != 0) {
+    return NULL;
+  }
+
+  int last_flag = -1;
+  for (int i = 0; i < count; ++i) {
+    if (sets_flag(ins[i].op)) {
+      last_flag = i;
+    }
+  }
+
+  uint8_t* entry = jit->code + start;
+  uint8_t* p = EMIT(entry,
+                    0x53,                     // push rbx
+                    0x41, 0x54,               // push r12
+                    0x41, 0x55,               // push r13
+                    0x41, 0x56,               // push r14
+                    0x48, 0x83, 0xec, 0x08,   // sub rsp, 8, calls need rsp % 16 == 0
+                    0x48, 0x89, 0xfb,         // mov rbx, rdi
+                    0x49, 0x89, 0xf4,         // mov r12, rsi
+                    0x49, 0x89, 0xd5,         // mov r13, rdx
+                    0x45, 0x31, 0xf6);        // xor r14d, r14d
+  for (int i = 0; i < count; ++i) {
+    int set_flag = i == last_flag;
+    switch (ins[i].op) {
+      case OP_MOVC:
+        p = emit_movc(p, &ins[i], set_flag);
+        break;
+      case OP_LOAD:
+        p = emit_load(p, &ins[i], set_flag);
+        break;
+      case OP_STORE:
+        p = emit_store(p, &ins[i], set_flag);
+        break;
+      case OP_ADD:
+      case OP_SUB:
+      case OP_AND:
+      case OP_OR:
+      case OP_EXOR:
+      case OP_MUL:
+        p = emit_alu(p, &ins[i], set_flag);
+        break;
+      default:
+        break;  // NOP
+    }
+  }
+  p = EMIT(p, 0x44, 0x89, 0xf0,               // mov eax, r14d
+           0x48, 0x83, 0xc4, 0x08,            // add rsp, 8
+           0x41, 0x5e,                        // pop r14
+           0x41, 0x5d,                        // pop r13
+           0x41, 0x5c,                        // pop r12
+           0x5b,                              // pop rbx
+           0xc3);                             // ret
+
+  jit->used = p - jit->code;
+  __builtin___clear_cache((char*)entry, (char*)p);
+  if (mprotect(lo, hi - lo, PROT_READ | PROT_EXEC) != 0) {
+    fprintf(stderr, "APEX_Error : Unable to make JIT code executable\n");
+    jit->used = jit->size;  // Nothing more is compiled
+    return NULL;
+  }
+  jit->blocks++;
+  return (APEX_JitBlock)(void*)entry;
+}
+
+#else
+
+int
+APEX_jit_init(APEX_Jit* jit)
+{
+  memset(jit, 0, sizeof(*jit));
+  fprintf(stderr, "APEX_Error : The JIT needs an x86-64 Linux host\n");
+  return -1;
+}
+
+void
+APEX_jit_free(APEX_Jit* jit)
+{
+  memset(jit, 0, sizeof(*jit));
+}
+
+APEX_JitBlock
+APEX_jit_compile(APEX_Jit* jit, const APEX_Instruction* ins, int count)
+{
+  return NULL;
+}
+
+#endif
@@ -7,23 +7,855 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "cpu.h"
+#include "func.h"
+#include "lockstep.h"
+#include "object.h"
+#include "simpoint.h"
+#include "dse.h"
+#include "memo.h"
+#include "parallel.h"
+#include "smarts.h"
+#include "sweep.h"
+#include "timing.h"
+#include "tools.h"
+
+/* Matches "--name" and "--name=value" */
+static int
+option_is(const char* arg, const char* name)
+{
+  size_t len = strlen(name);
+  return strncmp(arg, name, len) == 0 && (arg[len] == '\0' || arg[len] == '=');
+}
+
+/*
+ * Applies the optional arguments following the cycle count: data
+ * images to preload and analysis tools to attach. Functional mode
+ * has no pipeline events, so it takes data images and --jit only,
+ * which sets '*jit'. 'jit' is NULL in the other modes
+ */
+static int
+apply_options(APEX_CPU* cpu, int argc, char const* argv[], int* jit)
+{
+  for (int i = 4; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = strchr(arg, '=');
+    value = value ? value + 1 : NULL;
+
+    if (option_is(arg, "--data-image")) {
+      if (!value) {
+        fprintf(stderr, "APEX_Error : --data-image needs FILE[@ADDRESS]\n");
+        return -1;
+      }
+      if (APEX_data_image_load(cpu, value) != 0) {
+        return -1;
+      }
+    }
+    else if (jit && strcmp(arg, "--jit") == 0) {
+      *jit = 1;
+    }
+    else if (jit && strncmp(arg, "--", 2) == 0) {
+      fprintf(stderr, "APEX_Error : Option %s is not available in functional mode\n",
+              arg);
+      return -1;
+    }
+    else if (option_is(arg, "--critpath")) {
+      if (APEX_critpath_attach(cpu, value) != 0) {
+        return -1;
+      }
+    }
+    else if (option_is(arg, "--memtrace")) {
+      if (APEX_memtrace_attach(cpu, value) != 0) {
+        return -1;
+      }
+    }
+    else if (option_is(arg, "--insmix")) {
+      if (APEX_insmix_attach(cpu) != 0) {
+        return -1;
+      }
+    }
+    else if (option_is(arg, "--record")) {
+      if (APEX_trace_record_attach(cpu, value) != 0) {
+        return -1;
+      }
+    }
+    else if (option_is(arg, "--pipetrace")) {
+      if (APEX_pipetrace_attach(cpu, value) != 0) {
+        return -1;
+      }
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Unknown option %s\n", arg);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Timing only mode, replays a trace recorded with --record. The only
+ * option is --timing to override the pipeline parameters
+ */
+static int
+replay_trace(int argc, char const* argv[])
+{
+  const char* spec = NULL;
+  for (int i = 4; i < argc; ++i) {
+    if (option_is(argv[i], "--timing") && strchr(argv[i], '=')) {
+      spec = strchr(argv[i], '=') + 1;
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Option %s is not available in timing mode\n",
+              argv[i]);
+      return -1;
+    }
+  }
+  return APEX_timing_replay(argv[1], atoi(argv[3]), spec);
+}
+
+/*
+ * Functional mode, executes the program without the pipeline.
+ * <instructions> limits the instructions executed, 0 runs to the end
+ */
+static int
+run_functional(APEX_CPU* cpu, long long limit, int jit)
+{
+  APEX_FuncStats stats;
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  int status = APEX_func_run(cpu, limit > 0 ? (uint64_t)limit : 0, jit, NULL, &stats);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+  fprintf(stderr,
+          "APEX_CPU : %llu instructions in %.3f s (%.1f MIPS), %llu blocks translated, "
+          "%llu compiled\n",
+          (unsigned long long)stats.instructions, seconds,
+          seconds > 0 ? stats.instructions / seconds * 1e-6 : 0.0,
+          (unsigned long long)stats.blocks, (unsigned long long)stats.compiled);
+  printf("(apex) >> Functional run complete, %llu instructions\n",
+         (unsigned long long)stats.instructions);
+  printRegValues(cpu);
+  printMemoryData(cpu);
+  return status;
+}
+
+/*
+ * Reads the lines of a list file, the instance list of lockstep mode
+ * or the configurations of a sweep. Blank lines and lines starting
+ * with '#' are skipped. Returns the number of lines and the lines in
+ * '*lines', -1 on error
+ */
+static int
+read_list(const char* filename, char*** lines)
+{
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to open list %s\n", filename);
+    return -1;
+  }
+  char buf[4096];
+  char** list = NULL;
+  int count = 0;
+  while (fgets(buf, sizeof(buf), fp)) {
+    buf[strcspn(buf, "\r\n")] = '\0';
+    if (buf[0] == '\0' || buf[0] == '#') {
+      continue;
+    }
+    char** grown = realloc(list, sizeof(*list) * (count + 1));
+    if (!grown || !(grown[count] = strdup(buf))) {
+      list = grown ? grown : list;
+      fprintf(stderr, "APEX_Error : Out of memory reading %s\n", filename);
+      count = -1;
+      break;
+    }
+    list = grown;
+    count++;
+  }
+  fclose(fp);
+  *lines = list;
+  return count;
+}
+
+/*
+ * Lockstep mode, executes one program for many instances at once. Each
+ * instance starts from the data memory of --data-image, then loads its
+ * own images from the --images list, one line per instance naming its
+ * images as FILE[@ADDRESS] separated by commas, or '-' for none.
+ * --instances runs identical copies
+ */
+static int
+run_lockstep(APEX_CPU* cpu, int argc, char const* argv[])
+{
+  const char* list_name = NULL;
+  int instances = 0;
+  int show = -1;
+  for (int i = 4; i < argc; ++i) {
+    const char* value = strchr(argv[i], '=');
+    value = value ? value + 1 : NULL;
+    if (option_is(argv[i], "--data-image") && value) {
+      if (APEX_data_image_load(cpu, value) != 0) {
+        return -1;
+      }
+    }
+    else if (option_is(argv[i], "--images") && value) {
+      list_name = value;
+    }
+    else if (option_is(argv[i], "--instances") && value) {
+      instances = atoi(value);
+    }
+    else if (option_is(argv[i], "--show") && value) {
+      show = atoi(value);
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Option %s is not available in lockstep mode\n",
+              argv[i]);
+      return -1;
+    }
+  }
+
+  char** lines = NULL;
+  int num_lines = 0;
+  if (list_name && (num_lines = read_list(list_name, &lines)) < 0) {
+    return -1;
+  }
+  if (list_name && !instances) {
+    instances = num_lines;
+  }
+  if (list_name && instances != num_lines) {
+    fprintf(stderr, "APEX_Error : %s lists %d instances, not %d\n", list_name,
+            num_lines, instances);
+    instances = -1;
+  }
+  else if (!list_name && instances <= 0) {
+    fprintf(stderr, "APEX_Error : Lockstep mode needs --images=LIST or --instances=N\n");
+    instances = -1;
+  }
+  else if (show >= instances) {
+    fprintf(stderr, "APEX_Error : There is no instance %d\n", show);
+    instances = -1;
+  }
+
+  APEX_Lockstep ls;
+  int status = instances > 0 ? APEX_lockstep_init(&ls, cpu, instances) : -1;
+  for (int i = 0; status == 0 && i < num_lines; ++i) {
+    for (char* spec = strtok(lines[i], ","); status == 0 && spec;
+         spec = strtok(NULL, ",")) {
+      if (strcmp(spec, "-") != 0) {
+        status = APEX_lockstep_load_image(&ls, i, spec);
+      }
+    }
+  }
+  for (int i = 0; i < num_lines; ++i) {
+    free(lines[i]);
+  }
+  free(lines);
+  if (status != 0) {
+    if (instances > 0) {
+      APEX_lockstep_free(&ls);
+    }
+    return -1;
+  }
+
+  APEX_LockstepStats stats;
+  struct timespec t0, t1;
+  long long limit = atoll(argv[3]);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  status = APEX_lockstep_run(&ls, cpu, limit > 0 ? (uint64_t)limit : 0, &stats);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+  fprintf(stderr,
+          "APEX_CPU : %d instances, %llu instructions in %.3f s (%.1f MIPS, %s kernels), "
+          "%llu steps, %llu masked, %llu groups\n",
+          instances, (unsigned long long)stats.instructions, seconds,
+          seconds > 0 ? stats.instructions / seconds * 1e-6 : 0.0, ls.kernel_name,
+          (unsigned long long)stats.steps, (unsigned long long)stats.masked_steps,
+          (unsigned long long)stats.groups);
+  printf("(apex) >> Lockstep run complete, %d instances, %llu instructions\n",
+         instances, (unsigned long long)stats.instructions);
+  for (int i = 0; i < instances; ++i) {
+    printf("Instance %d : %llu instructions, pc(%d), zero flag %d, memory %016llx\n"
+           "\tregs :",
+           i, (unsigned long long)ls.executed[i], ls.pc[i], ls.flag[i],
+           (unsigned long long)APEX_lockstep_hash(&ls, i));
+    for (int r = 0; r < 16; ++r) {
+      printf(" %d", ls.regs[r * ls.stride + i]);
+    }
+    printf("\n");
+  }
+  if (show >= 0) {
+    if (APEX_lockstep_extract(&ls, show, cpu) != 0) {
+      status = -1;
+    }
+    else {
+      printf("(apex) >> State of instance %d\n", show);
+      printRegValues(cpu);
+      printMemoryData(cpu);
+    }
+  }
+  APEX_lockstep_free(&ls);
+  return status;
+}
+
+/*
+ * Sweep mode, simulates the pipeline once up to the --at snapshot,
+ * "cycle:N" or "pc:P", then continues from there once per --config
+ * (repeatable) or line of --configs, --jobs at a time
+ */
+static int
+run_sweep(APEX_CPU* cpu, int argc, char const* argv[])
+{
+  int at_cycle = -1;
+  int at_pc = 0;
+  int jobs = 0;
+  char** specs = NULL;
+  int count = 0;
+  int status = 0;
+  for (int i = 4; status == 0 && i < argc; ++i) {
+    const char* value = strchr(argv[i], '=');
+    value = value ? value + 1 : NULL;
+    if (option_is(argv[i], "--data-image") && value) {
+      status = APEX_data_image_load(cpu, value);
+    }
+    else if (option_is(argv[i], "--at") && value && strncmp(value, "cycle:", 6) == 0) {
+      at_cycle = atoi(value + 6);
+    }
+    else if (option_is(argv[i], "--at") && value && strncmp(value, "pc:", 3) == 0) {
+      at_pc = (int)strtol(value + 3, NULL, 0);
+    }
+    else if (option_is(argv[i], "--jobs") && value && atoi(value) > 0) {
+      jobs = atoi(value);
+    }
+    else if (option_is(argv[i], "--config") && value) {
+      char** grown = realloc(specs, sizeof(*specs) * (count + 1));
+      if (!grown || !(grown[count] = strdup(value))) {
+        specs = grown ? grown : specs;
+        fprintf(stderr, "APEX_Error : Out of memory reading %s\n", argv[i]);
+        status = -1;
+        break;
+      }
+      specs = grown;
+      count++;
+    }
+    else if (option_is(argv[i], "--configs") && value) {
+      char** lines = NULL;
+      int num_lines = read_list(value, &lines);
+      char** grown = num_lines < 0 ? NULL
+                                   : realloc(specs, sizeof(*specs) * (count + num_lines + 1));
+      for (int l = 0; l < num_lines; ++l) {
+        if (grown) {
+          grown[count++] = lines[l];
+        }
+        else {
+          free(lines[l]);
+        }
+      }
+      free(lines);
+      if (!grown) {
+        status = -1;
+        break;
+      }
+      specs = grown;
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Option %s is not available in sweep mode\n",
+              argv[i]);
+      status = -1;
+    }
+  }
+  if (status == 0 && ((at_cycle < 0) == !at_pc || !count)) {
+    fprintf(stderr,
+            "APEX_Error : Sweep mode needs --at=cycle:N or --at=pc:P and "
+            "--config=SPEC or --configs=FILE\n");
+    status = -1;
+  }
+
+  APEX_SweepConfig* configs = calloc(count ? count : 1, sizeof(*configs));
+  APEX_SweepResult* results = calloc(count ? count : 1, sizeof(*results));
+  if (!configs || !results) {
+    status = -1;
+  }
+  int parsed = 0;
+  while (status == 0 && parsed < count) {
+    status = APEX_sweep_parse(&configs[parsed], specs[parsed]);
+    parsed += status == 0;
+  }
+
+  if (status == 0) {
+    struct timespec t0, t1, t2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    status = APEX_sweep_snapshot(cpu, at_cycle, at_pc);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (status == 0) {
+      printf("(apex) >> Snapshot at cycle %d\n", cpu->clock);
+      status = APEX_sweep_run(cpu, configs, count, atoi(argv[3]), jobs, results);
+      clock_gettime(CLOCK_MONOTONIC, &t2);
+      fprintf(stderr, "APEX_CPU : Snapshot after %.3f s, %d configurations in %.3f s\n",
+              (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9, count,
+              (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) * 1e-9);
+      APEX_sweep_report(configs, results, count);
+    }
+  }
+
+  for (int i = 0; i < parsed; ++i) {
+    APEX_sweep_config_free(&configs[i]);
+  }
+  for (int i = 0; i < count; ++i) {
+    free(specs[i]);
+  }
+  free(specs);
+  free(configs);
+  free(results);
+  return status;
+}
+
+/*
+ * SimPoint mode, splits the program into intervals of the given number
+ * of instructions, clusters them into phases and estimates the CPI from
+ * detailed simulations of a few intervals of each phase
+ */
+static int
+run_simpoint(APEX_CPU* cpu, int argc, char const* argv[])
+{
+  APEX_SimPointConfig config = { 0 };
+  config.interval = strtoull(argv[3], NULL, 0);
+  config.max_k = 10;
+  config.samples = 3;
+  config.warmup = 1000;
+  config.seed = 1;
+  int status = 0;
+  for (int i = 4; status == 0 && i < argc; ++i) {
+    const char* value = strchr(argv[i], '=');
+    value = value ? value + 1 : NULL;
+    if (option_is(argv[i], "--data-image") && value) {
+      status = APEX_data_image_load(cpu, value);
+    }
+    else if (option_is(argv[i], "--max-k") && value && atoi(value) > 0) {
+      config.max_k = atoi(value);
+    }
+    else if (option_is(argv[i], "--samples") && value && atoi(value) > 0) {
+      config.samples = atoi(value);
+    }
+    else if (option_is(argv[i], "--warmup") && value) {
+      config.warmup = strtoull(value, NULL, 0);
+    }
+    else if (option_is(argv[i], "--seed") && value) {
+      config.seed = (unsigned)strtoul(value, NULL, 0);
+    }
+    else if (option_is(argv[i], "--jobs") && value && atoi(value) > 0) {
+      config.jobs = atoi(value);
+    }
+    else if (strcmp(argv[i], "--jit") == 0) {
+      config.use_jit = 1;
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Option %s is not available in simpoint mode\n",
+              argv[i]);
+      status = -1;
+    }
+  }
+  if (status == 0 && config.interval == 0) {
+    fprintf(stderr, "APEX_Error : SimPoint mode needs an interval of 1 or more instructions\n");
+    status = -1;
+  }
+  if (status != 0) {
+    return status;
+  }
+
+  APEX_SimPoint sp;
+  struct timespec t0, t1, t2;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  status = APEX_simpoint_profile(&sp, cpu, &config);
+  if (status == 0) {
+    status = APEX_simpoint_cluster(&sp);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (status == 0) {
+    status = APEX_simpoint_simulate(&sp, cpu);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+  if (status == 0) {
+    fprintf(stderr, "APEX_CPU : Profile and clustering in %.3f s, detailed intervals in %.3f s\n",
+            (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9,
+            (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) * 1e-9);
+    APEX_simpoint_report(&sp);
+  }
+  APEX_simpoint_free(&sp);
+  return status;
+}
+
+/*
+ * SMARTS mode, samples windows of the given number of instructions in
+ * detail until the CPI is known to within --error percent
+ */
+static int
+run_smarts(APEX_CPU* cpu, int argc, char const* argv[])
+{
+  APEX_SmartsConfig config = { 0 };
+  config.window = strtoull(argv[3], NULL, 0);
+  config.warmup = 100;
+  config.samples = 30;
+  config.error = 0.01;
+  config.confidence = 0.95;
+  config.max_rounds = 5;
+  config.seed = 1;
+  int status = 0;
+  for (int i = 4; status == 0 && i < argc; ++i) {
+    const char* value = strchr(argv[i], '=');
+    value = value ? value + 1 : NULL;
+    if (option_is(argv[i], "--data-image") && value) {
+      status = APEX_data_image_load(cpu, value);
+    }
+    else if (option_is(argv[i], "--warmup") && value) {
+      config.warmup = strtoull(value, NULL, 0);
+    }
+    else if (option_is(argv[i], "--samples") && value && atoi(value) > 1) {
+      config.samples = atoi(value);
+    }
+    else if (option_is(argv[i], "--error") && value && atof(value) > 0) {
+      config.error = atof(value) / 100;
+    }
+    else if (option_is(argv[i], "--confidence") && value && atof(value) > 0 &&
+             atof(value) < 100) {
+      config.confidence = atof(value) / 100;
+    }
+    else if (option_is(argv[i], "--rounds") && value && atoi(value) > 0) {
+      config.max_rounds = atoi(value);
+    }
+    else if (option_is(argv[i], "--seed") && value) {
+      config.seed = (unsigned)strtoul(value, NULL, 0);
+    }
+    else if (option_is(argv[i], "--jobs") && value && atoi(value) > 0) {
+      config.jobs = atoi(value);
+    }
+    else if (strcmp(argv[i], "--jit") == 0) {
+      config.use_jit = 1;
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Option %s is not available in smarts mode\n",
+              argv[i]);
+      status = -1;
+    }
+  }
+  if (status == 0 && config.window == 0) {
+    fprintf(stderr, "APEX_Error : SMARTS mode needs a window of 1 or more instructions\n");
+    status = -1;
+  }
+  if (status != 0) {
+    return status;
+  }
+
+  APEX_Smarts sm;
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  status = APEX_smarts_run(&sm, cpu, &config);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (status == 0) {
+    fprintf(stderr, "APEX_CPU : Sampled in %.3f s\n",
+            (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+    APEX_smarts_report(&sm);
+  }
+  APEX_smarts_free(&sm);
+  return status;
+}
+
+/*
+ * Memo mode, simulates like 'simulate' and replays the pipeline spans
+ * between taken branches it met before. Prints the final state only
+ */
+static int
+run_memo(APEX_CPU* cpu, int argc, char const* argv[])
+{
+  int status = 0;
+  for (int i = 4; status == 0 && i < argc; ++i) {
+    const char* value = strchr(argv[i], '=');
+    value = value ? value + 1 : NULL;
+    if (option_is(argv[i], "--data-image") && value) {
+      status = APEX_data_image_load(cpu, value);
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Option %s is not available in memo mode\n", argv[i]);
+      status = -1;
+    }
+  }
+  if (status != 0) {
+    return status;
+  }
+
+  APEX_MemoStats stats;
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  status = APEX_memo_run(cpu, atoi(argv[3]), &stats);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (status != 0) {
+    return status;
+  }
+  fprintf(stderr,
+          "APEX_CPU : %d cycles in %.3f s, %llu of %llu spans replayed (%.1f%% of cycles), "
+          "%llu kept, %llu not replayable\n",
+          cpu->clock, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9,
+          (unsigned long long)stats.replayed,
+          (unsigned long long)(stats.replayed + stats.simulated),
+          cpu->clock ? 100.0 * stats.cycles_replayed / cpu->clock : 0.0,
+          (unsigned long long)stats.entries, (unsigned long long)stats.mismatched);
+  printf("(apex) >> Simulation Complete\n");
+  printRegValues(cpu);
+  printMemoryData(cpu);
+  APEX_hooks_finish(cpu);
+  return 0;
+}
+
+/*
+ * Parallel mode, simulates intervals of the given number of instructions
+ * in detail at the same time and adds up their cycles
+ */
+static int
+run_parallel(APEX_CPU* cpu, int argc, char const* argv[])
+{
+  APEX_ParallelConfig config = { 0 };
+  config.interval = strtoull(argv[3], NULL, 0);
+  config.warmup = 1000;
+  int status = 0;
+  for (int i = 4; status == 0 && i < argc; ++i) {
+    const char* value = strchr(argv[i], '=');
+    value = value ? value + 1 : NULL;
+    if (option_is(argv[i], "--data-image") && value) {
+      status = APEX_data_image_load(cpu, value);
+    }
+    else if (option_is(argv[i], "--warmup") && value) {
+      config.warmup = strtoull(value, NULL, 0);
+    }
+    else if (option_is(argv[i], "--jobs") && value && atoi(value) > 0) {
+      config.jobs = atoi(value);
+    }
+    else if (strcmp(argv[i], "--jit") == 0) {
+      config.use_jit = 1;
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Option %s is not available in parallel mode\n",
+              argv[i]);
+      status = -1;
+    }
+  }
+  if (status == 0 && config.interval == 0) {
+    fprintf(stderr,
+            "APEX_Error : Parallel mode needs an interval of 1 or more instructions\n");
+    status = -1;
+  }
+  if (status != 0) {
+    return status;
+  }
+
+  APEX_Parallel pt;
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  status = APEX_parallel_run(&pt, cpu, &config);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (status == 0) {
+    fprintf(stderr, "APEX_CPU : Simulated in %.3f s\n",
+            (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+    APEX_parallel_report(&pt);
+  }
+  APEX_parallel_free(&pt);
+  return status;
+}
+
+/*
+ * Design space exploration mode, records the program and those of
+ * --programs up to the given cycle (0 for the end) and replays them
+ * through the timing model at every point of --space
+ */
+static int
+run_dse(APEX_CPU* cpu, int argc, char const* argv[])
+{
+  APEX_DseSpace space;
+  APEX_dse_space_defaults(&space);
+  const char* images[APEX_DSE_MAX_PROGRAMS];
+  int num_images = 0;
+  const char* list_name = NULL;
+  int sample = 0;
+  unsigned seed = 1;
+  int jobs = 0;
+  int status = 0;
+  for (int i = 4; status == 0 && i < argc; ++i) {
+    const char* value = strchr(argv[i], '=');
+    value = value ? value + 1 : NULL;
+    if (option_is(argv[i], "--data-image") && value && num_images < APEX_DSE_MAX_PROGRAMS) {
+      images[num_images++] = value;
+    }
+    else if (option_is(argv[i], "--programs") && value) {
+      list_name = value;
+    }
+    else if (option_is(argv[i], "--space") && value) {
+      if (APEX_dse_space_parse(&space, value) != 0) {
+        fprintf(stderr, "APEX_Error : Invalid design space '%s'\n", value);
+        status = -1;
+      }
+    }
+    else if (option_is(argv[i], "--sample") && value && atoi(value) > 0) {
+      sample = atoi(value);
+    }
+    else if (option_is(argv[i], "--seed") && value) {
+      seed = (unsigned)strtoul(value, NULL, 0);
+    }
+    else if (option_is(argv[i], "--jobs") && value && atoi(value) > 0) {
+      jobs = atoi(value);
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Option %s is not available in dse mode\n", argv[i]);
+      status = -1;
+    }
+  }
+  char** lines = NULL;
+  int num_lines = 0;
+  if (status == 0 && list_name && (num_lines = read_list(list_name, &lines)) < 0) {
+    status = -1;
+  }
+
+  APEX_Dse dse;
+  memset(&dse, 0, sizeof(dse));
+  int cycles = atoi(argv[3]);
+  struct timespec t0, t1, t2;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int i = 0; status == 0 && i < num_images; ++i) {
+    status = APEX_data_image_load(cpu, images[i]);
+  }
+  if (status == 0) {
+    status = APEX_dse_add_program(&dse, cpu, argv[1], cycles);
+  }
+  for (int l = 0; status == 0 && l < num_lines; ++l) {
+    APEX_CPU* other = APEX_cpu_init(lines[l]);
+    if (!other) {
+      fprintf(stderr, "APEX_Error : Unable to initialize CPU for %s\n", lines[l]);
+      status = -1;
+      break;
+    }
+    for (int i = 0; status == 0 && i < num_images; ++i) {
+      status = APEX_data_image_load(other, images[i]);
+    }
+    if (status == 0) {
+      status = APEX_dse_add_program(&dse, other, lines[l], cycles);
+    }
+    APEX_cpu_stop(other);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (status == 0) {
+    status = APEX_dse_run(&dse, &space, sample, seed, jobs);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    fprintf(stderr, "APEX_CPU : %d programs recorded in %.3f s, %d points in %.3f s\n",
+            dse.num_programs,
+            (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9, dse.num_points,
+            (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) * 1e-9);
+    APEX_dse_report(&dse);
+  }
+  APEX_dse_free(&dse);
+  for (int l = 0; l < num_lines; ++l) {
+    free(lines[l]);
+  }
+  free(lines);
+  return status;
+}
 
 int
 main(int argc, char const* argv[])
 {
   int stopSim;
-  if (argc != 4) {
-    fprintf(stderr, "APEX_Help : Usage %s <input_file>\n", argv[0]);
+  if (argc < 4) {
+    fprintf(stderr,
+            "APEX_Help : Usage %s <input_file> <display|simulate> <cycles> [options]\n"
+            "            %s <input_file> functional <instructions> [--data-image=...] [--jit]\n"
+            "            %s <input_file> lockstep <instructions> [--data-image=...]\n"
+            "                 --images=LIST | --instances=N [--show=K]\n"
+            "            %s <input_file> sweep <cycles> --at=cycle:N|pc:P [--data-image=...]\n"
+            "                 --config=SPEC ... | --configs=FILE [--jobs=N]\n"
+            "            %s <input_file> simpoint <interval> [--data-image=...] [--jit]\n"
+            "                 [--max-k=N] [--samples=N] [--warmup=N] [--seed=N] [--jobs=N]\n"
+            "            %s <input_file> smarts <window> [--data-image=...] [--jit]\n"
+            "                 [--error=PCT] [--confidence=PCT] [--warmup=N] [--samples=N]\n"
+            "                 [--rounds=N] [--seed=N] [--jobs=N]\n"
+            "            %s <input_file> memo <cycles> [--data-image=...]\n"
+            "            %s <input_file> parallel <interval> [--data-image=...] [--jit]\n"
+            "                 [--warmup=N] [--jobs=N]\n"
+            "            %s <input_file> dse <cycles> [--programs=LIST] [--data-image=...]\n"
+            "                 [--space=SPEC] [--sample=N] [--seed=N] [--jobs=N]\n"
+            "            %s <trace_file> timing <cycles> [--timing=SPEC]\n"
+            "            --data-image=FILE[@ADDRESS]\n"
+            "                                     preload data memory from raw 32 bit words\n"
+            "            --critpath[=OP:LAT,...]  dataflow critical path and ideal IPC\n"
+            "            --memtrace[=block:B,window:N,max:N,out:FILE]\n"
+            "                                     reuse distance, working set and strides\n"
+            "            --insmix                 instruction mix and branch statistics\n"
+            "            --record=FILE            record the committed instruction trace\n"
+            "            --pipetrace=FILE[,keyframe:N]\n"
+            "                                     record an indexed per cycle pipeline trace\n"
+            "            --timing=forward:0|1,store_bypass:0|1,mul:N,branch:EX|MEM\n"
+            "                                     timing parameters of a trace replay\n"
+            "            --jit                    compile hot blocks to native code in\n"
+            "                                     functional mode (x86-64 Linux)\n",
+            argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+            argv[0]);
     exit(1);
   }
 
+  if (strcmp(argv[2], "timing") == 0) {
+    return replay_trace(argc, argv) == 0 ? 0 : 1;
+  }
+
   APEX_CPU* cpu = APEX_cpu_init(argv[1]);
   if (!cpu) {
     fprintf(stderr, "APEX_Error : Unable to initialize CPU\n");
     exit(1);
   }
+  if (strcmp(argv[2], "lockstep") == 0) {
+    int status = run_lockstep(cpu, argc, argv);
+    APEX_cpu_stop(cpu);
+    return status == 0 ? 0 : 1;
+  }
+  if (strcmp(argv[2], "sweep") == 0) {
+    int status = run_sweep(cpu, argc, argv);
+    APEX_cpu_stop(cpu);
+    return status == 0 ? 0 : 1;
+  }
+  if (strcmp(argv[2], "simpoint") == 0) {
+    int status = run_simpoint(cpu, argc, argv);
+    APEX_cpu_stop(cpu);
+    return status == 0 ? 0 : 1;
+  }
+  if (strcmp(argv[2], "smarts") == 0) {
+    int status = run_smarts(cpu, argc, argv);
+    APEX_cpu_stop(cpu);
+    return status == 0 ? 0 : 1;
+  }
+  if (strcmp(argv[2], "dse") == 0) {
+    int status = run_dse(cpu, argc, argv);
+    APEX_cpu_stop(cpu);
+    return status == 0 ? 0 : 1;
+  }
+  if (strcmp(argv[2], "parallel") == 0) {
+    int status = run_parallel(cpu, argc, argv);
+    APEX_cpu_stop(cpu);
+    return status == 0 ? 0 : 1;
+  }
+  if (strcmp(argv[2], "memo") == 0) {
+    int status = run_memo(cpu, argc, argv);
+    APEX_cpu_stop(cpu);
+    return status == 0 ? 0 : 1;
+  }
+  int functional = strcmp(argv[2], "functional") == 0;
+  int jit = 0;
+  if (apply_options(cpu, argc, argv, functional ? &jit : NULL) != 0) {
+    APEX_cpu_stop(cpu);
+    exit(1);
+  }
+  if (functional) {
+    int status = run_functional(cpu, atoll(argv[3]), jit);
+    APEX_cpu_stop(cpu);
+    return status == 0 ? 0 : 1;
+  }
   stopSim = atoi(argv[3]);
   APEX_cpu_run(cpu, (char*)argv[2], stopSim);
   APEX_cpu_stop(cpu);
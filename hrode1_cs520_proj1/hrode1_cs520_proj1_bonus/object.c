@@ -0,0 +1,489 @@
+/*
+ *  object.c
+ *  Reading and writing pre-assembled APEX programs
+ *
+ *  Object files are mapped read only, so loading one costs a header
+ *  check and a pass over the fixed size records instead of tokenizing
+ *  and string matching every line of the text program.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "object.h"
+
+/*
+ * Maps 'filename' if it is an object file.
+ * Returns 0 when mapped, 1 when the file is not an object file
+ * (a text program, standard input or a pipe) and -1 on errors.
+ * Only regular files are probed, so nothing is consumed from a pipe
+ */
+int
+APEX_object_open(APEX_Object* obj, const char* filename)
+{
+  memset(obj, 0, sizeof(*obj));
+  if (strcmp(filename, "-") == 0) {
+    return 1;
+  }
+
+  /* Files that cannot be opened are left to the parser to report */
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return 1;
+  }
+
+  struct stat st;
+  uint32_t magic = 0;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size < (off_t)sizeof(APEX_ObjHeader) ||
+      read(fd, &magic, sizeof(magic)) != sizeof(magic) ||
+      (magic != APEX_OBJ_MAGIC && magic != __builtin_bswap32(APEX_OBJ_MAGIC))) {
+    close(fd);
+    return 1;
+  }
+  if (magic != APEX_OBJ_MAGIC) {
+    fprintf(stderr, "APEX_Error : %s was written on a host of the other byte order\n",
+            filename);
+    close(fd);
+    return -1;
+  }
+
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "APEX_Error : Unable to map %s\n", filename);
+    return -1;
+  }
+  obj->map = map;
+  obj->map_size = st.st_size;
+  obj->header = map;
+
+  const APEX_ObjHeader* h = obj->header;
+  uint64_t expected = sizeof(*h) +
+                      (uint64_t)h->num_instructions * sizeof(*obj->code) +
+                      (uint64_t)h->num_data_words * sizeof(*obj->data);
+  if (h->version != APEX_OBJ_VERSION) {
+    fprintf(stderr, "APEX_Error : %s has object format version %u, expected %d\n",
+            filename, h->version, APEX_OBJ_VERSION);
+    APEX_object_close(obj);
+    return -1;
+  }
+  if (h->byte_order != APEX_OBJ_BYTE_ORDER) {
+    fprintf(stderr, "APEX_Error : %s was written on a host of the other byte order\n",
+            filename);
+    APEX_object_close(obj);
+    return -1;
+  }
+  if (expected != obj->map_size) {
+    fprintf(stderr, "APEX_Error : %s is truncated or corrupt\n", filename);
+    APEX_object_close(obj);
+    return -1;
+  }
+
+  obj->code = (const APEX_ObjInstruction*)(h + 1);
+  obj->data = (const int32_t*)(obj->code + h->num_instructions);
+  return 0;
+}
+
+void
+APEX_object_close(APEX_Object* obj)
+{
+  if (obj->map) {
+    munmap(obj->map, obj->map_size);
+  }
+  memset(obj, 0, sizeof(*obj));
+}
+
+/* Code memory points into the mapping, so the two layouts must agree */
+_Static_assert(sizeof(APEX_Instruction) == sizeof(APEX_ObjInstruction) &&
+               offsetof(APEX_Instruction, rs2) == offsetof(APEX_ObjInstruction, rs2) &&
+               offsetof(APEX_Instruction, imm) == offsetof(APEX_ObjInstruction, imm),
+               "APEX_Instruction must match APEX_ObjInstruction");
+
+/*
+ * Checks the mapped records and returns them as code memory, NULL
+ * when a record holds an invalid opcode or register. The records stay
+ * in the mapping, nothing is copied
+ */
+const APEX_Instruction*
+APEX_object_code_memory(const APEX_Object* obj, int* size)
+{
+  uint32_t n = obj->header->num_instructions;
+  *size = 0;
+  if (!n || n > (INT_MAX - 4000) / 4) {
+    fprintf(stderr, "APEX_Error : Object holds %u instructions\n", n);
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < n; ++i) {
+    const APEX_ObjInstruction* rec = &obj->code[i];
+    if (rec->op >= NUM_OPCODES || rec->rd > 15 || rec->rs1 > 15 ||
+        rec->rs2 > 15) {
+      fprintf(stderr, "APEX_Error : Invalid instruction record %u\n", i);
+      return NULL;
+    }
+  }
+  *size = (int)n;
+  return (const APEX_Instruction*)obj->code;
+}
+
+/*
+ * Makes the code of a mapped object the code memory of 'cpu', which
+ * takes over the mapping. Returns -1 and closes the object when its
+ * code is invalid
+ */
+static int
+attach_code(APEX_CPU* cpu, APEX_Object* obj)
+{
+  cpu->code_memory = APEX_object_code_memory(obj, &cpu->code_memory_size);
+  if (!cpu->code_memory) {
+    APEX_object_close(obj);
+    return -1;
+  }
+  cpu->code_map = obj->map;
+  cpu->code_map_size = obj->map_size;
+  return 0;
+}
+
+/* Releases code memory of 'cpu', allocated or mapped */
+void
+APEX_object_free_code(APEX_CPU* cpu)
+{
+  if (cpu->code_map) {
+    munmap(cpu->code_map, cpu->code_map_size);
+  }
+  else {
+    free((void*)cpu->code_memory);
+  }
+  cpu->code_memory = NULL;
+  cpu->code_memory_size = 0;
+  cpu->code_map = NULL;
+  cpu->code_map_size = 0;
+}
+
+/*
+ * Copies 'num_words' words to data memory starting at byte address
+ * 'base', failing when they run past the end of the address space
+ */
+static int
+store_data(APEX_CPU* cpu, uint32_t base, const int32_t* words, int num_words,
+           const char* filename)
+{
+  if (base % sizeof(int) ||
+      (uint64_t)base + (uint64_t)num_words * sizeof(int) > (1ull << 32)) {
+    fprintf(stderr, "APEX_Error : Data in %s does not fit data memory "
+            "(%d words at address %u)\n", filename, num_words, base);
+    return -1;
+  }
+  if (mem_write_words(&cpu->data_memory, base, words, num_words) != 0) {
+    fprintf(stderr, "APEX_Error : Out of memory loading %s\n", filename);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Loads code and data memory of 'cpu' from an object file.
+ * Returns 1 when 'filename' is a text program, which is left to the
+ * parser, 0 when loaded and -1 on errors
+ */
+int
+APEX_object_load(APEX_CPU* cpu, const char* filename)
+{
+  APEX_Object obj;
+  int status = APEX_object_open(&obj, filename);
+  if (status != 0) {
+    return status;
+  }
+
+  const APEX_ObjHeader* h = obj.header;
+  if (store_data(cpu, h->data_base, obj.data, h->num_data_words, filename) != 0) {
+    APEX_object_close(&obj);
+    return -1;
+  }
+  return attach_code(cpu, &obj);
+}
+
+/*
+ * Maps a raw data image given as "FILE[@ADDRESS]", the address is in
+ * bytes and defaults to 0
+ */
+int
+APEX_data_image_open(APEX_DataImage* img, const char* spec)
+{
+  memset(img, 0, sizeof(*img));
+  if (snprintf(img->filename, sizeof(img->filename), "%s", spec) >=
+      (int)sizeof(img->filename)) {
+    fprintf(stderr, "APEX_Error : Data image name too long\n");
+    return -1;
+  }
+
+  char* at = strrchr(img->filename, '@');
+  if (at && at[1]) {
+    char* end;
+    unsigned long base = strtoul(at + 1, &end, 0);
+    if (*end == '\0') {
+      *at = '\0';
+      img->base = (uint32_t)base;
+    }
+  }
+
+  int fd = open(img->filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "APEX_Error : Unable to open data image %s\n", img->filename);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size % sizeof(int32_t)) {
+    fprintf(stderr, "APEX_Error : %s is not a whole number of 32 bit words\n",
+            img->filename);
+    close(fd);
+    return -1;
+  }
+  if (st.st_size > 0) {
+    img->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (img->map == MAP_FAILED) {
+      img->map = NULL;
+      fprintf(stderr, "APEX_Error : Unable to map %s\n", img->filename);
+      close(fd);
+      return -1;
+    }
+  }
+  close(fd);
+  img->map_size = st.st_size;
+  img->words = img->map;
+  img->num_words = (int)(st.st_size / sizeof(int32_t));
+  return 0;
+}
+
+void
+APEX_data_image_close(APEX_DataImage* img)
+{
+  if (img->map) {
+    munmap(img->map, img->map_size);
+  }
+  img->map = NULL;
+  img->words = NULL;
+}
+
+/*
+ * Preloads data memory of 'cpu' from a data image, see
+ * APEX_data_image_open()
+ */
+int
+APEX_data_image_load(APEX_CPU* cpu, const char* spec)
+{
+  APEX_DataImage img;
+  if (APEX_data_image_open(&img, spec) != 0) {
+    return -1;
+  }
+  int status = store_data(cpu, img.base, img.words, img.num_words, img.filename);
+  APEX_data_image_close(&img);
+  return status;
+}
+
+/*
+ * Writes code memory and an optional data segment as an object file
+ */
+int
+APEX_object_write(const char* filename, const APEX_Instruction* code,
+                  int size, const int32_t* data, int data_words,
+                  uint32_t data_base)
+{
+  FILE* fp = fopen(filename, "wb");
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to create %s\n", filename);
+    return -1;
+  }
+
+  APEX_ObjHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = APEX_OBJ_MAGIC;
+  h.version = APEX_OBJ_VERSION;
+  h.byte_order = APEX_OBJ_BYTE_ORDER;
+  h.num_instructions = size;
+  h.num_data_words = data_words;
+  h.data_base = data_base;
+  int ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+
+  for (int i = 0; ok && i < size; ++i) {
+    const APEX_Instruction* ins = &code[i];
+    if (ins->op >= NUM_OPCODES || ins->rd > 15 || ins->rs1 > 15 ||
+        ins->rs2 > 15) {
+      fprintf(stderr, "APEX_Error : Invalid instruction %d (%s)\n",
+              i, get_opcode_name(ins->op));
+      ok = 0;
+    }
+  }
+  /* Code memory is already in the record format */
+  if (ok && size) {
+    ok = fwrite(code, sizeof(*code), size, fp) == (size_t)size;
+  }
+  if (ok && data_words) {
+    ok = fwrite(data, sizeof(*data), data_words, fp) == (size_t)data_words;
+  }
+
+  if (fclose(fp) != 0 || !ok) {
+    fprintf(stderr, "APEX_Error : Unable to write %s\n", filename);
+    remove(filename);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * FNV-1a, 64 bit, of the contents of 'fd'. Read in fixed size chunks
+ * so hashing a large program does not keep all of it resident
+ */
+static int
+hash_file(int fd, uint64_t* hash)
+{
+  static unsigned char chunk[1 << 16];
+  ssize_t n;
+  *hash = 0xcbf29ce484222325ull;
+  while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+    for (ssize_t i = 0; i < n; ++i) {
+      *hash ^= chunk[i];
+      *hash *= 0x100000001b3ull;
+    }
+  }
+  return n < 0 ? -1 : 0;
+}
+
+/*
+ * Cache directory: $APEX_CACHE_DIR, else $XDG_CACHE_HOME/apex_sim, else
+ * $HOME/.cache/apex_sim. Caching is off when APEX_CACHE_DIR is empty
+ */
+static int
+cache_dir(char* dir, size_t len)
+{
+  const char* env = getenv("APEX_CACHE_DIR");
+  if (env) {
+    return *env && snprintf(dir, len, "%s", env) < (int)len ? 0 : -1;
+  }
+  env = getenv("XDG_CACHE_HOME");
+  if (env && *env) {
+    return snprintf(dir, len, "%s/apex_sim", env) < (int)len ? 0 : -1;
+  }
+  env = getenv("HOME");
+  if (env && *env) {
+    return snprintf(dir, len, "%s/.cache/apex_sim", env) < (int)len ? 0 : -1;
+  }
+  return -1;
+}
+
+/* mkdir -p, existing directories are fine */
+static int
+make_dirs(char* path)
+{
+  for (char* p = path + 1; *p; ++p) {
+    if (*p == '/') {
+      *p = '\0';
+      int status = mkdir(path, 0755);
+      *p = '/';
+      if (status != 0 && errno != EEXIST) {
+        return -1;
+      }
+    }
+  }
+  return mkdir(path, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+/*
+ * Name of the cached object of a program, from the hash and size of
+ * its text. The format and parser versions and the byte order are part
+ * of the name so objects of an older format, parsed by an older parser
+ * or written by another host are never picked up
+ */
+static int
+cache_path(char* path, size_t len, const char* filename)
+{
+  char dir[4096];
+  if (cache_dir(dir, sizeof(dir)) != 0) {
+    return -1;
+  }
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return -1;
+  }
+  uint64_t hash;
+  int status = hash_file(fd, &hash);
+  close(fd);
+  if (status != 0) {
+    return -1;
+  }
+
+  const uint32_t order = APEX_OBJ_BYTE_ORDER;
+  int n = snprintf(path, len, "%s/%016llx-%llx.v%d.p%d.%s.apx", dir,
+                   (unsigned long long)hash, (unsigned long long)st.st_size,
+                   APEX_OBJ_VERSION, APEX_PARSER_VERSION,
+                   *(const uint8_t*)&order == 0x04 ? "le" : "be");
+  return n < (int)len ? 0 : -1;
+}
+
+/*
+ * Loads code memory of 'cpu' from the text program 'filename'.
+ * Assembled programs are cached on disk keyed by a hash of their text,
+ * so running an unchanged program again maps the cached object instead
+ * of parsing. A freshly parsed program is also run from its cached
+ * object, which keeps large programs in the page cache rather than on
+ * the heap. Standard input and pipes are always parsed
+ */
+int
+APEX_object_parse_cached(APEX_CPU* cpu, const char* filename)
+{
+  char path[4200];
+  cpu->code_map = NULL;
+  if (strcmp(filename, "-") == 0 ||
+      cache_path(path, sizeof(path), filename) != 0) {
+    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
+    return cpu->code_memory ? 0 : -1;
+  }
+
+  APEX_Object obj;
+  if (APEX_object_open(&obj, path) == 0 && attach_code(cpu, &obj) == 0) {
+    return 0;
+  }
+
+  int size;
+  APEX_Instruction* code_memory = create_code_memory(filename, &size);
+  if (!code_memory) {
+    return -1;
+  }
+
+  /* Written under a temporary name and renamed, so concurrent runs
+   * never see a partial object. Failing to cache is not an error */
+  char tmp[4300];
+  char* slash = strrchr(path, '/');
+  *slash = '\0';
+  int dir_ok = make_dirs(path) == 0 && access(path, W_OK) == 0;
+  *slash = '/';
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+  if (dir_ok && APEX_object_write(tmp, code_memory, size, NULL, 0, 0) == 0) {
+    if (rename(tmp, path) != 0) {
+      remove(tmp);
+    }
+    else if (APEX_object_open(&obj, path) == 0 && attach_code(cpu, &obj) == 0) {
+      free(code_memory);
+      return 0;
+    }
+  }
+  cpu->code_memory = code_memory;
+  cpu->code_memory_size = size;
+  cpu->code_map = NULL;
+  return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ *  parallel.c
+ *  Parallel-in-time detailed simulation of a whole program
+ *
+ *  The last interval runs until the program ends, so instructions the
+ *  forwarding pipelines retire fewer than functional mode counts do not
+ *  cut the program short.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "func.h"
+#include "parallel.h"
+
+int
+APEX_parallel_run(APEX_Parallel* pt, APEX_CPU* cpu, const APEX_ParallelConfig* config)
+{
+  memset(pt, 0, sizeof(*pt));
+  pt->config = *config;
+  APEX_Checkpoint start;
+  if (APEX_checkpoint_save(&start, cpu) != 0) {
+    return -1;
+  }
+  APEX_FuncStats stats;
+  int status = APEX_func_run(cpu, 0, config->use_jit, NULL, &stats);
+  if (status == 0) {
+    status = APEX_checkpoint_restore(&start, cpu);
+  }
+  APEX_checkpoint_free(&start);
+  if (status != 0) {
+    return -1;
+  }
+  pt->instructions = stats.instructions;
+  if (!pt->instructions) {
+    fprintf(stderr, "APEX_Error : The program executes no instructions\n");
+    return -1;
+  }
+
+  uint64_t count = (pt->instructions + config->interval - 1) / config->interval;
+  if (count > (uint64_t)APEX_PARALLEL_MAX_INTERVALS) {
+    fprintf(stderr, "APEX_Error : %llu intervals, at most %d are supported\n",
+            (unsigned long long)count, APEX_PARALLEL_MAX_INTERVALS);
+    return -1;
+  }
+  pt->num_intervals = (int)count;
+  pt->starts = malloc(sizeof(*pt->starts) * count);
+  pt->results = malloc(sizeof(*pt->results) * count);
+  uint64_t* lengths = malloc(sizeof(*lengths) * count);
+  if (!pt->starts || !pt->results || !lengths) {
+    fprintf(stderr, "APEX_Error : Out of memory for %llu intervals\n",
+            (unsigned long long)count);
+    free(lengths);
+    return -1;
+  }
+  for (uint64_t i = 0; i < count; ++i) {
+    pt->starts[i] = i * config->interval;
+    lengths[i] = i + 1 < count ? config->interval : UINT64_MAX / 2;
+  }
+  status = APEX_region_sample(cpu, pt->starts, lengths, pt->num_intervals, config->warmup,
+                              config->use_jit, config->jobs, pt->results, NULL);
+  free(lengths);
+  for (int i = 0; status == 0 && i < pt->num_intervals; ++i) {
+    pt->cycles += pt->results[i].cycles;
+    pt->retired += pt->results[i].instructions;
+  }
+  return status;
+}
+
+void
+APEX_parallel_report(const APEX_Parallel* pt)
+{
+  printf("--------------------------------\n");
+  printf("------PARALLEL IN TIME------\n");
+  printf("--------------------------------\n");
+  printf("Intervals            : %d of %llu instructions after %llu of warm-up\n",
+         pt->num_intervals, (unsigned long long)pt->config.interval,
+         (unsigned long long)pt->config.warmup);
+  printf("%-9s %-12s %-13s %-12s %s\n", "Interval", "Start", "Instructions", "Cycles",
+         "CPI");
+  for (int i = 0; i < pt->num_intervals; ++i) {
+    const APEX_RegionResult* r = &pt->results[i];
+    printf("%-9d %-12llu %-13llu %-12llu ", i, (unsigned long long)pt->starts[i],
+           (unsigned long long)r->instructions, (unsigned long long)r->cycles);
+    if (r->instructions) {
+      printf("%.4f\n", (double)r->cycles / r->instructions);
+    }
+    else {
+      printf("-\n");
+    }
+  }
+  printf("Instructions         : %llu functional, %llu retired\n",
+         (unsigned long long)pt->instructions, (unsigned long long)pt->retired);
+  printf("Cycles               : %llu\n", (unsigned long long)pt->cycles);
+  printf("CPI                  : %.4f\n",
+         pt->retired ? (double)pt->cycles / pt->retired : 0.0);
+}
+
+void
+APEX_parallel_free(APEX_Parallel* pt)
+{
+  free(pt->starts);
+  free(pt->results);
+  memset(pt, 0, sizeof(*pt));
+}
@@ -0,0 +1,275 @@
+/*
+ *  pipetrace.c
+ *  Reading indexed per cycle pipeline traces, see pipetrace.h
+ *
+ *  A reader maps the file, locates the index from the trailer and
+ *  decodes forward from the keyframe of the chunk holding a cycle.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pipetrace.h"
+
+/* Three bit positions per (stage, pc) pair */
+static void
+bloom_hashes(int stage_id, uint32_t pc, uint32_t* bits)
+{
+  uint64_t x = (((uint64_t)pc << 3) | (uint64_t)stage_id) * 0x9e3779b97f4a7c15ull;
+  bits[0] = (x >> 11) % APEX_PIPE_BLOOM_BITS;
+  bits[1] = (x >> 27) % APEX_PIPE_BLOOM_BITS;
+  bits[2] = (x >> 43) % APEX_PIPE_BLOOM_BITS;
+}
+
+void
+APEX_pipetrace_bloom_add(uint8_t* bloom, int stage_id, uint32_t pc)
+{
+  uint32_t bits[3];
+  bloom_hashes(stage_id, pc, bits);
+  for (int i = 0; i < 3; ++i) {
+    bloom[bits[i] / 8] |= (uint8_t)(1u << (bits[i] % 8));
+  }
+}
+
+int
+APEX_pipetrace_bloom_test(const uint8_t* bloom, int stage_id, uint32_t pc)
+{
+  uint32_t bits[3];
+  bloom_hashes(stage_id, pc, bits);
+  for (int i = 0; i < 3; ++i) {
+    if (!(bloom[bits[i] / 8] & (1u << (bits[i] % 8)))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Maps a pipeline trace and checks its header, trailer and index. A
+ * run that did not finish has no trailer and cannot be queried
+ */
+int
+APEX_pipetrace_open(APEX_PipeTrace* trace, const char* filename)
+{
+  memset(trace, 0, sizeof(*trace));
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "APEX_Error : Unable to open pipeline trace %s\n", filename);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size < (off_t)(sizeof(APEX_PipeHeader) + sizeof(APEX_PipeTrailer))) {
+    fprintf(stderr, "APEX_Error : %s is not a pipeline trace\n", filename);
+    close(fd);
+    return -1;
+  }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "APEX_Error : Unable to map %s\n", filename);
+    return -1;
+  }
+  trace->map = map;
+  trace->map_size = st.st_size;
+
+  APEX_PipeHeader h;
+  APEX_PipeTrailer t;
+  memcpy(&h, map, sizeof(h));
+  memcpy(&t, (const char*)map + st.st_size - sizeof(t), sizeof(t));
+  uint64_t index_end = st.st_size - sizeof(t);
+  if (h.magic != APEX_PIPETRACE_MAGIC || h.version != APEX_PIPETRACE_VERSION ||
+      h.interval == 0 || t.magic != APEX_PIPETRACE_MAGIC ||
+      t.version != APEX_PIPETRACE_VERSION || t.index_offset % 8 ||
+      t.index_offset > index_end ||
+      t.num_chunks != (index_end - t.index_offset) / sizeof(APEX_PipeIndex)) {
+    fprintf(stderr, "APEX_Error : %s is not a complete version %d pipeline trace\n",
+            filename, APEX_PIPETRACE_VERSION);
+    APEX_pipetrace_close(trace);
+    return -1;
+  }
+  trace->interval = h.interval;
+  trace->index = (const APEX_PipeIndex*)((const char*)map + t.index_offset);
+  trace->num_chunks = t.num_chunks;
+  trace->num_cycles = t.num_cycles;
+
+  for (uint64_t i = 0; i < trace->num_chunks; ++i) {
+    uint64_t end = i + 1 < trace->num_chunks ? trace->index[i + 1].offset
+                                             : t.index_offset;
+    if (trace->index[i].offset < sizeof(h) ||
+        trace->index[i].offset + sizeof(APEX_PipeKeyframe) > end) {
+      fprintf(stderr, "APEX_Error : Corrupt index in %s\n", filename);
+      APEX_pipetrace_close(trace);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void
+APEX_pipetrace_close(APEX_PipeTrace* trace)
+{
+  if (trace->map) {
+    munmap(trace->map, trace->map_size);
+  }
+  memset(trace, 0, sizeof(*trace));
+}
+
+/* Positions 'cur' on the keyframe of chunk 'chunk' */
+static void
+load_chunk(APEX_PipeCursor* cur, uint64_t chunk)
+{
+  const APEX_PipeTrace* trace = cur->trace;
+  const uint8_t* base = trace->map;
+  uint64_t offset = trace->index[chunk].offset;
+  uint64_t end = chunk + 1 < trace->num_chunks
+                   ? trace->index[chunk + 1].offset
+                   : (uint64_t)((const uint8_t*)trace->index - base);
+
+  memcpy(&cur->state, base + offset, sizeof(cur->state));
+  cur->chunk = chunk;
+  cur->cycle = trace->index[chunk].cycle - 1;
+  cur->next = base + offset + sizeof(cur->state);
+  cur->end = base + end;
+  cur->num_shown = 0;
+}
+
+/*
+ * Decodes the cycle after the current one, returns 0 at the end of the
+ * trace and -1 on a truncated record
+ */
+int
+APEX_pipetrace_next(APEX_PipeCursor* cur)
+{
+  /* The last chunk may be followed by padding */
+  if (cur->cycle >= cur->trace->num_cycles) {
+    return 0;
+  }
+  if (cur->next == cur->end) {
+    if (cur->chunk + 1 >= cur->trace->num_chunks) {
+      return 0;
+    }
+    load_chunk(cur, cur->chunk + 1);
+  }
+
+  APEX_PipeCycle c;
+  if (cur->end - cur->next < (long)sizeof(c)) {
+    return -1;
+  }
+  memcpy(&c, cur->next, sizeof(c));
+  size_t shown_size = sizeof(APEX_PipeShown) * c.num_shown;
+  size_t writes_size = sizeof(APEX_PipeWrite) * c.num_writes;
+  if (c.num_shown > APEX_PIPE_MAX_SHOWN ||
+      (size_t)(cur->end - cur->next) < sizeof(c) + shown_size + writes_size) {
+    return -1;
+  }
+  cur->next += sizeof(c);
+  memcpy(cur->shown, cur->next, shown_size);
+  cur->num_shown = c.num_shown;
+  cur->next += shown_size;
+
+  for (int i = 0; i < c.num_writes; ++i) {
+    APEX_PipeWrite w;
+    memcpy(&w, cur->next, sizeof(w));
+    cur->next += sizeof(w);
+    if (w.reg == APEX_PIPE_ZERO_FLAG) {
+      cur->state.zero_flag = w.value;
+    }
+    else if (w.reg < 16) {
+      cur->state.regs[w.reg] = w.value;
+      cur->state.regs_valid &= ~(1u << w.reg);
+      cur->state.regs_valid |= (uint32_t)(w.valid != 0) << w.reg;
+    }
+  }
+  cur->cycle++;
+  return 1;
+}
+
+/*
+ * Positions 'cur' so that the next call of APEX_pipetrace_next()
+ * decodes 'cycle'. Starts from the closest keyframe at or before it,
+ * returns -1 when the trace does not hold the cycle
+ */
+int
+APEX_pipetrace_seek(APEX_PipeCursor* cur, const APEX_PipeTrace* trace,
+                    uint64_t cycle)
+{
+  memset(cur, 0, sizeof(*cur));
+  cur->trace = trace;
+  if (cycle == 0 || cycle > trace->num_cycles || trace->num_chunks == 0) {
+    return -1;
+  }
+
+  /* Last chunk starting at or before 'cycle' */
+  uint64_t lo = 0;
+  uint64_t hi = trace->num_chunks;
+  while (hi - lo > 1) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (trace->index[mid].cycle <= cycle) {
+      lo = mid;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  load_chunk(cur, lo);
+  while (cur->cycle + 1 < cycle) {
+    if (APEX_pipetrace_next(cur) != 1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * First cycle, at or after 'from', in which 'pc' enters stage
+ * 'stage_id'. Chunks whose bloom filter rules the pair out are skipped
+ * without being read. Returns 0 if there is none
+ */
+uint64_t
+APEX_pipetrace_find(const APEX_PipeTrace* trace, int stage_id, uint32_t pc,
+                    uint64_t from)
+{
+  APEX_PipeCursor cur;
+  if (from == 0) {
+    from = 1;
+  }
+  if (APEX_pipetrace_seek(&cur, trace, from) != 0) {
+    return 0;
+  }
+
+  uint64_t chunk = cur.chunk;
+  int skip = !APEX_pipetrace_bloom_test(trace->index[chunk].bloom, stage_id, pc);
+  for (;;) {
+    if (skip) {
+      /* Move on to the next chunk that may hold the pair */
+      do {
+        chunk++;
+      } while (chunk < trace->num_chunks &&
+               !APEX_pipetrace_bloom_test(trace->index[chunk].bloom, stage_id, pc));
+      if (chunk >= trace->num_chunks) {
+        return 0;
+      }
+      load_chunk(&cur, chunk);
+      skip = 0;
+    }
+    if (APEX_pipetrace_next(&cur) != 1) {
+      return 0;
+    }
+    for (int i = 0; i < cur.num_shown; ++i) {
+      const APEX_PipeShown* s = &cur.shown[i];
+      if ((s->stage & APEX_PIPE_ENTERED) && APEX_PIPE_STAGE(s) == stage_id &&
+          s->pc == pc) {
+        return cur.cycle;
+      }
+    }
+    if (cur.next == cur.end) {
+      chunk = cur.chunk;
+      skip = 1;
+    }
+  }
+}
@@ -0,0 +1,181 @@
+#ifndef _APEX_PIPETRACE_H_
+#define _APEX_PIPETRACE_H_
+/**
+ *  pipetrace.h
+ *  Indexed per cycle trace of the pipeline
+ *
+ *  Records, for every cycle, the stage contents display mode prints and
+ *  the register file and zero flag changes. Every few cycles a keyframe
+ *  holds the complete register file, zero flag, fetch pc and stage
+ *  latches, so a reader can start decoding at any keyframe. File
+ *  layout, all fields little endian:
+ *
+ *    APEX_PipeHeader                                    16 bytes
+ *    chunk[num_chunks], each one
+ *      APEX_PipeKeyframe                                state before the chunk
+ *      cycle[interval], each one
+ *        APEX_PipeCycle                                 4 bytes
+ *        APEX_PipeShown[num_shown]                      12 bytes each
+ *        APEX_PipeWrite[num_writes]                     8 bytes each
+ *    APEX_PipeIndex[num_chunks]                         first cycle, offset and
+ *                                                       bloom filter of each chunk
+ *    APEX_PipeTrailer                                   32 bytes
+ *
+ *  The bloom filter of a chunk holds every (stage, pc) pair entering a
+ *  stage in one of its cycles, so a search only decodes the chunks
+ *  that may contain it. Data memory is not part of the trace.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define APEX_PIPETRACE_MAGIC 0x50585041u  // "APXP"
+#define APEX_PIPETRACE_VERSION 1
+
+/* Default number of cycles between keyframes */
+#define APEX_PIPETRACE_INTERVAL 1024
+
+#define APEX_PIPE_BLOOM_BITS 8192
+
+/* Most stage contents one cycle can show */
+#define APEX_PIPE_MAX_SHOWN 32
+
+/* Set in APEX_PipeShown.stage when the pc was not in that stage the cycle before */
+#define APEX_PIPE_ENTERED 0x80
+#define APEX_PIPE_STAGE(shown) ((shown)->stage & 0x7)
+
+/* APEX_PipeWrite.reg of a zero flag change */
+#define APEX_PIPE_ZERO_FLAG 16
+
+typedef struct APEX_PipeHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t interval;  // Cycles per chunk
+  uint32_t reserved;
+} APEX_PipeHeader;
+
+typedef struct APEX_PipeLatch
+{
+  int32_t pc;
+  int32_t imm;
+  int32_t rs1_value;
+  int32_t rs2_value;
+  int32_t buffer;
+  int32_t mem_address;
+  uint8_t op;
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+  uint8_t busy;
+  uint8_t stalled;
+  uint8_t reserved[2];
+} APEX_PipeLatch;
+
+typedef struct APEX_PipeKeyframe
+{
+  uint64_t cycle;        // Cycles completed, the chunk starts with the next one
+  int32_t pc;            // Next fetch pc
+  int32_t zero_flag;
+  int32_t regs[16];
+  uint32_t regs_valid;   // Bit i is cpu->regs_valid[i]
+  uint32_t ins_completed;
+  APEX_PipeLatch stage[NUM_STAGES];
+} APEX_PipeKeyframe;
+
+typedef struct APEX_PipeCycle
+{
+  uint8_t num_shown;
+  uint8_t num_writes;
+  uint16_t reserved;
+} APEX_PipeCycle;
+
+/* One line of display output */
+typedef struct APEX_PipeShown
+{
+  uint32_t pc;
+  int32_t imm;
+  uint8_t stage;   // F, DRF, ..., plus APEX_PIPE_ENTERED
+  uint8_t op;
+  uint16_t regs;   // rd << 8 | rs1 << 4 | rs2
+} APEX_PipeShown;
+
+/* Register (or zero flag) value and valid bit at the end of the cycle */
+typedef struct APEX_PipeWrite
+{
+  uint8_t reg;
+  uint8_t valid;
+  uint16_t reserved;
+  int32_t value;
+} APEX_PipeWrite;
+
+typedef struct APEX_PipeIndex
+{
+  uint64_t cycle;   // First cycle of the chunk
+  uint64_t offset;  // File offset of its keyframe
+  uint8_t bloom[APEX_PIPE_BLOOM_BITS / 8];
+} APEX_PipeIndex;
+
+typedef struct APEX_PipeTrailer
+{
+  uint64_t index_offset;
+  uint64_t num_chunks;
+  uint64_t num_cycles;
+  uint32_t magic;
+  uint32_t version;
+} APEX_PipeTrailer;
+
+/* Read only mapping of a pipeline trace */
+typedef struct APEX_PipeTrace
+{
+  void* map;
+  size_t map_size;
+  uint32_t interval;
+  const APEX_PipeIndex* index;
+  uint64_t num_chunks;
+  uint64_t num_cycles;
+} APEX_PipeTrace;
+
+/*
+ * Decoding position in a trace. After APEX_pipetrace_next() returns 1,
+ * 'cycle' is the decoded cycle, 'shown' what it displayed and 'state'
+ * the register file and zero flag at its end. The fetch pc and stage
+ * latches of 'state' are those of the last keyframe
+ */
+typedef struct APEX_PipeCursor
+{
+  const APEX_PipeTrace* trace;
+  uint64_t chunk;
+  uint64_t cycle;
+  const uint8_t* next;
+  const uint8_t* end;
+  APEX_PipeKeyframe state;
+  int num_shown;
+  APEX_PipeShown shown[APEX_PIPE_MAX_SHOWN];
+} APEX_PipeCursor;
+
+int
+APEX_pipetrace_open(APEX_PipeTrace* trace, const char* filename);
+
+void
+APEX_pipetrace_close(APEX_PipeTrace* trace);
+
+int
+APEX_pipetrace_seek(APEX_PipeCursor* cur, const APEX_PipeTrace* trace,
+                    uint64_t cycle);
+
+int
+APEX_pipetrace_next(APEX_PipeCursor* cur);
+
+void
+APEX_pipetrace_bloom_add(uint8_t* bloom, int stage_id, uint32_t pc);
+
+int
+APEX_pipetrace_bloom_test(const uint8_t* bloom, int stage_id, uint32_t pc);
+
+uint64_t
+APEX_pipetrace_find(const APEX_PipeTrace* trace, int stage_id, uint32_t pc,
+                    uint64_t from);
+
+#endif
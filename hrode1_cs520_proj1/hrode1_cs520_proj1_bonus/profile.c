@@ -0,0 +1,132 @@
+/*
+ *  profile.c
+ *  Cycle counter based timing of simulator sections
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "profile.h"
+
+/* Deepest nesting of sections we keep track of */
+#define PROF_MAX_DEPTH 8
+
+static const char* section_names[PROF_NUM_SECTIONS] = {
+  "Writeback", "Memory", "Execute", "Decode/RF", "Fetch", "Parser", "Output"
+};
+
+static uint64_t ticks[PROF_NUM_SECTIONS];
+static uint64_t calls[PROF_NUM_SECTIONS];
+static int stack[PROF_MAX_DEPTH];
+static int depth = 0;
+static uint64_t last_tick;
+
+/* Wall clock reference used to convert ticks into nanoseconds */
+static uint64_t start_tick;
+static struct timespec start_time;
+static int started = 0;
+
+static uint64_t
+now_ns(struct timespec* ts)
+{
+  return (uint64_t)ts->tv_sec * 1000000000ull + (uint64_t)ts->tv_nsec;
+}
+
+/* Reads the host cycle counter, wall clock nanoseconds when there is none */
+static inline uint64_t
+read_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return now_ns(&ts);
+#endif
+}
+
+/*
+ * Charges the time since the last switch to the running section. Past
+ * PROF_MAX_DEPTH levels it goes to the deepest section kept
+ */
+static void
+account(uint64_t t)
+{
+  if (depth > 0) {
+    ticks[stack[(depth < PROF_MAX_DEPTH ? depth : PROF_MAX_DEPTH) - 1]] += t - last_tick;
+  }
+  last_tick = t;
+}
+
+void
+APEX_profile_begin(int section)
+{
+  uint64_t t = read_ticks();
+  if (!started) {
+    started = 1;
+    start_tick = t;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+  }
+  account(t);
+  if (depth < PROF_MAX_DEPTH) {
+    stack[depth] = section;
+  }
+  depth++;
+  calls[section]++;
+}
+
+void
+APEX_profile_end(int section)
+{
+  account(read_ticks());
+  if (depth > 0) {
+    depth--;
+  }
+  (void)section;
+}
+
+/*
+ * Prints host time per section, both in total and per simulated cycle
+ */
+void
+APEX_profile_report(int cycles)
+{
+  struct timespec end_time;
+  uint64_t end_tick = read_ticks();
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+  double elapsed_ns = (double)(now_ns(&end_time) - now_ns(&start_time));
+  double ns_per_tick = 1.0;
+  if (started && end_tick > start_tick) {
+    ns_per_tick = elapsed_ns / (double)(end_tick - start_tick);
+  }
+  if (cycles <= 0) {
+    cycles = 1;
+  }
+
+  uint64_t total = 0;
+  for (int i = 0; i < PROF_NUM_SECTIONS; ++i) {
+    total += ticks[i];
+  }
+
+  printf("--------------------------------\n");
+  printf("------HOST PROFILE (%d cycles)------\n", cycles);
+  printf("--------------------------------\n");
+  printf("%-10s %12s %14s %12s %7s\n",
+         "section", "calls", "total ns", "ns/cycle", "share");
+  for (int i = 0; i < PROF_NUM_SECTIONS; ++i) {
+    double ns = (double)ticks[i] * ns_per_tick;
+    printf("%-10s %12llu %14.0f %12.1f %6.1f%%\n",
+           section_names[i],
+           (unsigned long long)calls[i],
+           ns,
+           ns / cycles,
+           total ? 100.0 * (double)ticks[i] / (double)total : 0.0);
+  }
+  printf("%-10s %12s %14.0f %12.1f\n",
+         "wall", "", elapsed_ns, elapsed_ns / cycles);
+}
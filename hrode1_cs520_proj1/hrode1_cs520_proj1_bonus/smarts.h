@@ -0,0 +1,57 @@
+#ifndef _APEX_SMARTS_H_
+#define _APEX_SMARTS_H_
+/**
+ *  smarts.h
+ *  Systematic sampling of a program until its CPI reaches a confidence target
+ *
+ *  A functional run counts the instructions of the program. Each round
+ *  then runs it again in functional mode, forking a detailed simulation
+ *  (region.h) every 'period' instructions from a random offset: a short
+ *  unmeasured warm-up followed by a measured window. Windows of all
+ *  rounds are pooled. While the half-width of the confidence interval of
+ *  the mean window CPI is above the target, the next round takes as many
+ *  new windows as the spread so far says are still missing.
+ */
+#include <stdint.h>
+
+#include "cpu.h"
+#include "region.h"
+
+typedef struct APEX_SmartsConfig
+{
+  uint64_t window;    // Measured instructions per sample
+  uint64_t warmup;    // Detailed instructions before each window, not measured
+  int samples;        // Windows of the first round
+  double error;       // Target half-width of the interval, relative to the CPI
+  double confidence;  // Of the interval, 0.95 for 95%
+  int max_rounds;
+  unsigned seed;
+  int jobs;           // Children at a time, 0 for one per CPU
+  int use_jit;        // Functional runs compile hot blocks
+} APEX_SmartsConfig;
+
+typedef struct APEX_Smarts
+{
+  APEX_SmartsConfig config;
+  APEX_Checkpoint start;  // State the program started from
+  uint64_t instructions;  // In the whole program
+  int rounds;
+  int samples;            // Windows measured in all rounds
+  uint64_t detailed;      // Instructions simulated in detail, warm-up included
+  double sum;             // Of window CPIs
+  double sum2;            // Of their squares
+  double cpi;
+  double z;               // Normal quantile of the confidence
+  double error;           // Half-width of the interval reached, relative to the CPI
+} APEX_Smarts;
+
+int
+APEX_smarts_run(APEX_Smarts* sm, APEX_CPU* cpu, const APEX_SmartsConfig* config);
+
+void
+APEX_smarts_report(const APEX_Smarts* sm);
+
+void
+APEX_smarts_free(APEX_Smarts* sm);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _APEX_SWEEP_H_
+#define _APEX_SWEEP_H_
+/**
+ *  sweep.h
+ *  Parameter sweeps continuing from one shared pipeline snapshot
+ *
+ *  The pipeline is simulated once up to the snapshot, a chosen cycle or
+ *  the first retirement of a chosen pc, recording the committed
+ *  instruction stream (trace.h). Configurations that give the pipeline
+ *  the same inputs, data images and cycle limit, share one continuation
+ *  of the pipeline from there and each replay the stream through the
+ *  timing model (timing.h) with its parameters, which with the defaults
+ *  of the variant takes the cycles of the pipeline. Each distinct set
+ *  of inputs gets a child process when there is more than one. A child
+ *  inherits the register file, stage latches and data memory copy on
+ *  write, so it only copies the pages it stores to.
+ */
+#include <stdint.h>
+
+#include "cpu.h"
+#include "timing.h"
+
+/* Most data images one configuration loads at the snapshot */
+#define APEX_SWEEP_MAX_IMAGES 8
+
+/*
+ * One configuration, parsed from comma separated items: the timing
+ * model items of --timing, "cycles:N" and "image:FILE[@ADDRESS]"
+ */
+typedef struct APEX_SweepConfig
+{
+  char* spec;        // As given
+  char* items;       // Copy of spec that 'images' point into
+  APEX_TimingConfig timing;
+  int cycles;        // Cycle limit, 0 for the limit of the sweep
+  int num_images;
+  const char* images[APEX_SWEEP_MAX_IMAGES];
+} APEX_SweepConfig;
+
+/* Of one configuration, the pipeline fields are those of its run */
+typedef struct APEX_SweepResult
+{
+  int status;             // 0, or -1 if its run failed
+  int stopped;            // Program ended before the cycle limit
+  uint64_t cycles;        // Pipeline cycles after the snapshot
+  uint64_t instructions;  // Instructions retired after the snapshot, no bubbles
+  uint64_t state_hash;    // Registers, zero flag and data memory at the end
+  uint64_t model_cycles;  // Timing model cycles after the snapshot
+  APEX_Timing timing;     // Timing model, over the whole stream
+} APEX_SweepResult;
+
+int
+APEX_sweep_parse(APEX_SweepConfig* config, const char* spec);
+
+void
+APEX_sweep_config_free(APEX_SweepConfig* config);
+
+int
+APEX_sweep_snapshot(APEX_CPU* cpu, int at_cycle, int at_pc);
+
+int
+APEX_sweep_run(APEX_CPU* cpu, const APEX_SweepConfig* configs, int count,
+               int cycles, int jobs, APEX_SweepResult* results);
+
+void
+APEX_sweep_report(const APEX_SweepConfig* configs,
+                  const APEX_SweepResult* results, int count);
+
+#endif
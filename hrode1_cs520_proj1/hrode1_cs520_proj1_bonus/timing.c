@@ -0,0 +1,287 @@
+/*
+ *  timing.c
+ *  Trace driven timing model of the 5 stage APEX pipeline
+ *
+ *  Instructions move through the pipeline in order, one per stage. For
+ *  each record the model finds the earliest cycle it can be fetched
+ *  (after its predecessor left Decode/RF and after any taken branch
+ *  redirected fetch) and the earliest cycle it can leave Decode/RF
+ *  (all source values readable and Execute free). Execute, Memory and
+ *  Writeback follow without further stalls. The defaults of each
+ *  variant are given by APEX_timing_defaults() in its cpu.c, and with
+ *  them the model takes the cycles that variant's pipeline takes,
+ *  including the interlock quirks of the pipeline without forwarding:
+ *  the valid bit any writer clears, BZ/BNZ held three cycles in
+ *  Decode/RF and the instruction that follows a MUL unchecked.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "timing.h"
+
+static uint64_t
+max_u64(uint64_t a, uint64_t b)
+{
+  return a > b ? a : b;
+}
+
+/*
+ * Applies "forward:0|1,store_bypass:0|1,mul:N,branch:EX|MEM,
+ * branch_decode:N,mul_pair:0|1" on top of 'config', returns -1 on a
+ * malformed entry
+ */
+int
+APEX_timing_parse(APEX_TimingConfig* config, const char* spec)
+{
+  char buf[256];
+  if (!spec) {
+    return 0;
+  }
+  if (snprintf(buf, sizeof(buf), "%s", spec) >= (int)sizeof(buf)) {
+    return -1;
+  }
+  for (char* item = strtok(buf, ","); item; item = strtok(NULL, ",")) {
+    char* value = strchr(item, ':');
+    if (!value) {
+      return -1;
+    }
+    *value++ = '\0';
+    if (strcmp(item, "forward") == 0) {
+      config->forwarding = atoi(value) != 0;
+    }
+    else if (strcmp(item, "store_bypass") == 0) {
+      config->store_bypass = atoi(value) != 0;
+    }
+    else if (strcmp(item, "mul") == 0 && atoi(value) > 0) {
+      config->mul_latency = atoi(value);
+    }
+    else if (strcmp(item, "branch") == 0 && strcmp(value, "EX") == 0) {
+      config->branch_stage = EX;
+    }
+    else if (strcmp(item, "branch") == 0 && strcmp(value, "MEM") == 0) {
+      config->branch_stage = MEM;
+    }
+    else if (strcmp(item, "branch_decode") == 0 && atoi(value) >= 0) {
+      config->branch_decode = atoi(value);
+    }
+    else if (strcmp(item, "mul_pair") == 0) {
+      config->mul_pair = atoi(value) != 0;
+    }
+    else {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void
+APEX_timing_init(APEX_Timing* t, const APEX_TimingConfig* config)
+{
+  memset(t, 0, sizeof(*t));
+  t->config = *config;
+}
+
+/* Whether the valid bit of register 'r' is set when Decode/RF runs in 'cycle' */
+static int
+reg_busy(const APEX_Timing* t, int r, uint64_t cycle)
+{
+  uint64_t set = 0;
+  uint64_t clear = 0;
+  int written = 0;
+  for (int i = 0; i < APEX_TIMING_WRITERS; ++i) {
+    const APEX_TimingWriter* w = &t->writers[r][i];
+    if (w->ex_first && w->ex_first <= cycle) {
+      written = 1;
+      set = max_u64(set, w->ex_last < cycle ? w->ex_last : cycle);
+    }
+    if (w->wb && w->wb <= cycle) {
+      clear = max_u64(clear, w->wb);
+    }
+  }
+  /* Writeback runs before Execute in a cycle */
+  return written && set >= clear;
+}
+
+/*
+ * Advances the model by one committed instruction and returns the
+ * cycle in which it is in Writeback
+ */
+uint64_t
+APEX_timing_step(APEX_Timing* t, const APEX_TraceRecord* rec)
+{
+  const APEX_TimingConfig* c = &t->config;
+  int op = APEX_TRACE_OP(rec);
+  int operands = get_opcode_operands(op);
+  int taken = (rec->op & APEX_TRACE_TAKEN) != 0;
+  int branch = op == OP_BZ || op == OP_BNZ;
+
+  /* Fetch, cycles lost to a taken branch count as flushed */
+  uint64_t fetch = max_u64(t->fetch + 1, t->decode);
+  if (t->redirect > fetch) {
+    t->flush += t->redirect - fetch;
+    fetch = t->redirect;
+  }
+
+  /* Decode/RF, waits for source values and a free Execute stage */
+  uint64_t earliest = fetch + 1;
+  uint64_t ex_free = t->ex_free ? t->ex_free - 1 : 0;
+  uint64_t decode = max_u64(earliest, ex_free);
+  if (c->mul_pair && t->last_op == OP_MUL) {
+    t->stall_ex += decode - earliest;
+  }
+  else if (branch && c->branch_decode) {
+    decode += c->branch_decode - 1;
+    t->stall_flag += decode - earliest;
+  }
+  else if (!c->forwarding) {
+    if (decode > earliest) {
+      t->stall_ex += decode - earliest;
+    }
+    uint64_t start = decode;
+    while (((operands & READS_RS1) && reg_busy(t, rec->rs1, decode)) ||
+           ((operands & READS_RS2) && reg_busy(t, rec->rs2, decode)) ||
+           ((operands & READS_FLAG) && decode < t->flag_ready)) {
+      decode++;
+    }
+    if ((operands & READS_FLAG) && decode == t->flag_ready && decode > start) {
+      t->stall_flag += decode - start;
+    }
+    else {
+      t->stall_data += decode - start;
+    }
+  }
+  else if (c->store_bypass && op == OP_STORE && t->last_op == OP_LOAD &&
+           t->last_addr == rec->addr && decode == t->decode + 1) {
+    t->stall_ex += decode - earliest;
+  }
+  else {
+    uint64_t data = 0;
+    if (operands & READS_RS1) {
+      data = t->reg_ready[rec->rs1];
+    }
+    if (operands & READS_RS2) {
+      data = max_u64(data, t->reg_ready[rec->rs2]);
+    }
+    uint64_t flag = (operands & READS_FLAG) ? t->flag_ready : 0;
+    decode = max_u64(max_u64(earliest, data), max_u64(flag, ex_free));
+    if (decode > earliest) {
+      if (decode == data) {
+        t->stall_data += decode - earliest;
+      }
+      else if (decode == flag) {
+        t->stall_flag += decode - earliest;
+      }
+      else {
+        t->stall_ex += decode - earliest;
+      }
+    }
+  }
+
+  /* Execute, Memory and Writeback */
+  uint64_t ex_end = decode + (op == OP_MUL ? c->mul_latency : 1);
+  uint64_t mem = ex_end + 1;
+  uint64_t wb = mem + 1;
+
+  /* When results can be read by later instructions */
+  uint64_t value_ready = ex_end;
+  if (op == OP_LOAD) {
+    value_ready = mem;
+  }
+  if (!c->forwarding) {
+    value_ready = wb;
+  }
+  if (operands & WRITES_RD) {
+    APEX_TimingWriter* w = t->writers[rec->rd];
+    memmove(w + 1, w, sizeof(*w) * (APEX_TIMING_WRITERS - 1));
+    w->ex_first = decode + 1;
+    w->ex_last = ex_end;
+    w->wb = wb;
+    t->reg_ready[rec->rd] = value_ready;
+  }
+  if ((operands & WRITES_FLAG) || taken) {
+    t->flag_ready = c->forwarding ? ex_end : wb;
+  }
+  /* Stages run from Writeback back to Fetch each cycle, so the target
+   * is fetched in the cycle the branch resolves */
+  if (taken) {
+    t->redirect = c->branch_stage == EX ? ex_end : mem;
+  }
+
+  t->fetch = fetch;
+  t->decode = decode;
+  t->ex_free = mem;
+  t->retire = wb;
+  t->last_op = op;
+  t->last_addr = rec->addr;
+  t->instructions++;
+  return wb;
+}
+
+void
+APEX_timing_report(const APEX_Timing* t)
+{
+  const APEX_TimingConfig* c = &t->config;
+  uint64_t cycles = t->retire ? t->retire : 1;
+
+  printf("--------------------------------\n");
+  printf("------TIMING MODEL------\n");
+  printf("--------------------------------\n");
+  printf("Configuration        : forward:%d,store_bypass:%d,mul:%d,branch:%s,"
+         "branch_decode:%d,mul_pair:%d\n",
+         c->forwarding, c->store_bypass, c->mul_latency,
+         c->branch_stage == EX ? "EX" : "MEM", c->branch_decode, c->mul_pair);
+  printf("Instructions         : %llu\n", (unsigned long long)t->instructions);
+  printf("Cycles               : %llu\n", (unsigned long long)t->retire);
+  printf("IPC                  : %.3f\n", (double)t->instructions / cycles);
+  printf("Decode/RF stalls     : data %llu, zero flag %llu, execute busy %llu\n",
+         (unsigned long long)t->stall_data, (unsigned long long)t->stall_flag,
+         (unsigned long long)t->stall_ex);
+  printf("Flushed fetch cycles : %llu\n", (unsigned long long)t->flush);
+}
+
+/*
+ * Replays a recorded trace through the timing model, stopping after
+ * 'cycles' cycles when it is positive. 'spec' overrides the defaults.
+ * A whole trace replayed with the defaults is compared with the cycles
+ * the pipeline took to record it
+ */
+int
+APEX_timing_replay(const char* filename, int cycles, const char* spec)
+{
+  APEX_TimingConfig defaults;
+  APEX_timing_defaults(&defaults);
+  APEX_TimingConfig config = defaults;
+  if (APEX_timing_parse(&config, spec) != 0) {
+    fprintf(stderr, "APEX_Error : Invalid timing configuration '%s'\n", spec);
+    return -1;
+  }
+
+  APEX_Trace trace;
+  if (APEX_trace_open(&trace, filename) != 0) {
+    return -1;
+  }
+
+  APEX_Timing t;
+  APEX_timing_init(&t, &config);
+  uint64_t i;
+  for (i = 0; i < trace.num_records; ++i) {
+    APEX_Timing next = t;
+    uint64_t wb = APEX_timing_step(&next, &trace.records[i]);
+    if (cycles > 0 && wb > (uint64_t)cycles) {
+      break;
+    }
+    t = next;
+  }
+  APEX_timing_report(&t);
+  if (trace.cycles && i == trace.num_records &&
+      memcmp(&config, &defaults, sizeof(config)) == 0) {
+    int64_t deviation = (int64_t)(t.retire - trace.cycles);
+    printf("Pipeline cycles      : %llu, deviation %+lld (%+.2f%%)\n",
+           (unsigned long long)trace.cycles, (long long)deviation,
+           100.0 * deviation / trace.cycles);
+  }
+  APEX_trace_close(&trace);
+  return 0;
+}
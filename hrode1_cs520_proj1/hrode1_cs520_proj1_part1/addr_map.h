@@ -0,0 +1,38 @@
+#ifndef _APEX_ADDR_MAP_H_
+#define _APEX_ADDR_MAP_H_
+/**
+ *  addr_map.h
+ *  Open addressing hash map from 32 bit addresses to 64 bit values,
+ *  used by the analysis tools to track per address state
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct AddrMap
+{
+  uint32_t* keys;
+  uint64_t* values;
+  uint8_t* used;
+  size_t capacity;  // Always a power of two
+  size_t count;
+} AddrMap;
+
+int
+addr_map_init(AddrMap* map, size_t capacity);
+
+void
+addr_map_free(AddrMap* map);
+
+uint64_t*
+addr_map_get(AddrMap* map, uint32_t key);
+
+uint64_t*
+addr_map_put(AddrMap* map, uint32_t key);
+
+int
+addr_map_remove(AddrMap* map, uint32_t key);
+
+void
+addr_map_clear(AddrMap* map);
+
+#endif
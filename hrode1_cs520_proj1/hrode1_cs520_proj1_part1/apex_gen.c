@@ -0,0 +1,571 @@
+/*
+ *  apex_gen.c
+ *  Synthetic workload generator, writes a valid APEX program
+ *
+ *  The program is a sequence of counted loops. Each loop body is drawn
+ *  from the instruction mix; register sources follow the dependence
+ *  distance distribution, LOAD results are consumed by the next
+ *  instruction at the LOAD-use rate, and LOAD/STORE addresses move
+ *  through the memory footprint by a fixed stride per iteration.
+ *  Forward BNZ sites skip one or two instructions, the instruction
+ *  before each site sets the zero flag so the site is taken with the
+ *  requested probability (decided per site, the outcome is the same on
+ *  every iteration). BZ is not generated: the pipelines take it
+ *  whatever the flag, so its sites would not follow the taken rate.
+ *
+ *  Registers R0-R10 hold data, R11-R15 are reserved:
+ *    R11 footprint mask, R12 stride, R13 base address,
+ *    R14 trip counter, R15 the constant 1
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_DATA_REGS 11
+#define MAX_DEP_BINS 32
+#define MAX_DEP_DIST 64
+
+/* Distance value of the 'inf' bin: read a register nobody wrote lately */
+#define DEP_INDEPENDENT 0
+
+enum
+{
+  MIX_ALU,
+  MIX_MUL,
+  MIX_LOAD,
+  MIX_STORE,
+  MIX_BRANCH,
+  NUM_MIX
+};
+
+static const char* mix_names[NUM_MIX] = { "alu", "mul", "load", "store", "branch" };
+
+typedef struct GenSpec
+{
+  uint64_t seed;
+  int loops;         // Number of loops, one after the other
+  int body;          // Instructions drawn per loop body
+  int trips_min;     // Trip count of each loop, uniform in [min, max]
+  int trips_max;
+  double mix[NUM_MIX];
+  int dep_dist[MAX_DEP_BINS];
+  double dep_weight[MAX_DEP_BINS];
+  int num_dep;
+  double load_use;   // Probability the instruction after a LOAD reads it
+  double taken;      // Probability a forward branch site is taken
+  uint32_t footprint;  // Bytes the base address cycles through, power of 2
+  uint32_t stride;     // Bytes the base address advances per iteration
+  uint32_t window;     // Bytes addressed from the base in one iteration
+  const char* out;
+} GenSpec;
+
+/* xorshift64*, the same seed gives the same program on every host */
+static uint64_t rng_state;
+
+static uint64_t
+rng_next(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static double
+rng_unit(void)
+{
+  return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int
+rng_range(int lo, int hi)
+{
+  return lo + (int)(rng_next() % (uint64_t)(hi - lo + 1));
+}
+
+/* Index drawn from 'n' weights */
+static int
+rng_pick(const double* weights, int n)
+{
+  double total = 0;
+  for (int i = 0; i < n; ++i) {
+    total += weights[i];
+  }
+  double x = rng_unit() * total;
+  for (int i = 0; i < n; ++i) {
+    if (x < weights[i]) {
+      return i;
+    }
+    x -= weights[i];
+  }
+  return n - 1;
+}
+
+static void
+set_defaults(GenSpec* spec)
+{
+  memset(spec, 0, sizeof(*spec));
+  spec->seed = 1;
+  spec->loops = 1;
+  spec->body = 100;
+  spec->trips_min = spec->trips_max = 10;
+  spec->mix[MIX_ALU] = 50;
+  spec->mix[MIX_MUL] = 5;
+  spec->mix[MIX_LOAD] = 20;
+  spec->mix[MIX_STORE] = 10;
+  spec->mix[MIX_BRANCH] = 15;
+  static const int dist[] = { 1, 2, 3, 4, 8, DEP_INDEPENDENT };
+  static const double weight[] = { 20, 20, 15, 10, 10, 25 };
+  spec->num_dep = 6;
+  memcpy(spec->dep_dist, dist, sizeof(dist));
+  memcpy(spec->dep_weight, weight, sizeof(weight));
+  spec->load_use = 0.3;
+  spec->taken = 0.5;
+  spec->footprint = 4096;
+  spec->stride = 64;
+  spec->window = 256;
+}
+
+/* "name:weight,..." into 'mix' */
+static int
+parse_mix(GenSpec* spec, char* value)
+{
+  double mix[NUM_MIX] = { 0 };
+  for (char* item = strtok(value, ","); item; item = strtok(NULL, ",")) {
+    char* weight = strchr(item, ':');
+    if (!weight) {
+      return -1;
+    }
+    *weight++ = '\0';
+    int k = 0;
+    while (k < NUM_MIX && strcmp(item, mix_names[k]) != 0) {
+      k++;
+    }
+    if (k == NUM_MIX || atof(weight) < 0) {
+      return -1;
+    }
+    mix[k] = atof(weight);
+  }
+  double total = 0;
+  for (int k = 0; k < NUM_MIX; ++k) {
+    total += mix[k];
+  }
+  if (total - mix[MIX_BRANCH] <= 0) {
+    return -1;  // Branches need something to skip
+  }
+  memcpy(spec->mix, mix, sizeof(mix));
+  return 0;
+}
+
+/* "distance:weight,...", 'inf' for independent sources */
+static int
+parse_dep(GenSpec* spec, char* value)
+{
+  int n = 0;
+  for (char* item = strtok(value, ","); item; item = strtok(NULL, ",")) {
+    char* weight = strchr(item, ':');
+    if (!weight || n == MAX_DEP_BINS) {
+      return -1;
+    }
+    *weight++ = '\0';
+    int dist = strcmp(item, "inf") == 0 ? DEP_INDEPENDENT : atoi(item);
+    if (strcmp(item, "inf") != 0 && (dist < 1 || dist > MAX_DEP_DIST)) {
+      return -1;
+    }
+    spec->dep_dist[n] = dist;
+    spec->dep_weight[n] = atof(weight);
+    n++;
+  }
+  if (!n) {
+    return -1;
+  }
+  spec->num_dep = n;
+  return 0;
+}
+
+static int
+is_power_of_two(uint32_t x)
+{
+  return x && !(x & (x - 1));
+}
+
+/* Applies one "key=value" setting, -1 when it is not understood */
+static int
+apply_setting(GenSpec* spec, char* setting)
+{
+  char* value = strchr(setting, '=');
+  if (!value) {
+    return -1;
+  }
+  *value++ = '\0';
+
+  if (strcmp(setting, "seed") == 0) {
+    spec->seed = strtoull(value, NULL, 0);
+  }
+  else if (strcmp(setting, "loops") == 0 && atoi(value) > 0) {
+    spec->loops = atoi(value);
+  }
+  else if (strcmp(setting, "body") == 0 && atoi(value) > 0) {
+    spec->body = atoi(value);
+  }
+  else if (strcmp(setting, "trips") == 0) {
+    char* dash = strchr(value, '-');
+    spec->trips_min = atoi(value);
+    spec->trips_max = dash ? atoi(dash + 1) : spec->trips_min;
+    if (spec->trips_min < 1 || spec->trips_max < spec->trips_min) {
+      return -1;
+    }
+  }
+  else if (strcmp(setting, "mix") == 0) {
+    return parse_mix(spec, value);
+  }
+  else if (strcmp(setting, "dep") == 0) {
+    return parse_dep(spec, value);
+  }
+  else if (strcmp(setting, "load_use") == 0) {
+    spec->load_use = atof(value);
+  }
+  else if (strcmp(setting, "taken") == 0) {
+    spec->taken = atof(value);
+  }
+  else if (strcmp(setting, "footprint") == 0 &&
+           is_power_of_two(strtoul(value, NULL, 0)) &&
+           strtoul(value, NULL, 0) >= 4) {
+    spec->footprint = strtoul(value, NULL, 0);
+  }
+  else if (strcmp(setting, "stride") == 0 && strtoul(value, NULL, 0) % 4 == 0) {
+    spec->stride = strtoul(value, NULL, 0);
+  }
+  else if (strcmp(setting, "window") == 0 && strtoul(value, NULL, 0) >= 4) {
+    spec->window = strtoul(value, NULL, 0);
+  }
+  else if (strcmp(setting, "out") == 0) {
+    spec->out = strdup(value);
+  }
+  else {
+    return -1;
+  }
+  return 0;
+}
+
+/* Spec file: one "key=value" per line, '#' starts a comment */
+static int
+read_spec_file(GenSpec* spec, const char* filename)
+{
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to open spec %s\n", filename);
+    return -1;
+  }
+  char line[1024];
+  int lineno = 0;
+  int status = 0;
+  while (status == 0 && fgets(line, sizeof(line), fp)) {
+    lineno++;
+    char* hash = strchr(line, '#');
+    if (hash) {
+      *hash = '\0';
+    }
+    char* text = strtok(line, " \t\r\n");
+    if (!text) {
+      continue;
+    }
+    if (apply_setting(spec, text) != 0) {
+      fprintf(stderr, "APEX_Error : %s:%d: invalid setting\n", filename, lineno);
+      status = -1;
+    }
+  }
+  fclose(fp);
+  return status;
+}
+
+/* Generator state of the body being written */
+typedef struct Gen
+{
+  const GenSpec* spec;
+  FILE* out;
+  long emitted;
+  int history[MAX_DEP_DIST];   // Destination of the last instructions, -1 if none
+  int num_history;
+  int last_write[NUM_DATA_REGS];  // Instruction count of the last write of each
+  int load_rd;                 // Destination of the previous LOAD, -1 otherwise
+} Gen;
+
+static void
+emit(Gen* g, const char* fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(g->out, fmt, ap);
+  va_end(ap);
+  fputc('\n', g->out);
+  g->emitted++;
+}
+
+/* Records the destination of the instruction just drawn */
+static void
+produced(Gen* g, int rd)
+{
+  memmove(g->history + 1, g->history, sizeof(int) * (MAX_DEP_DIST - 1));
+  g->history[0] = rd;
+  if (g->num_history < MAX_DEP_DIST) {
+    g->num_history++;
+  }
+  if (rd >= 0) {
+    g->last_write[rd] = (int)g->emitted;
+  }
+}
+
+/* Data register written longest ago */
+static int
+pick_dest(Gen* g)
+{
+  int best = 0;
+  for (int r = 1; r < NUM_DATA_REGS; ++r) {
+    if (g->last_write[r] < g->last_write[best]) {
+      best = r;
+    }
+  }
+  return best;
+}
+
+/*
+ * Register for an independent source: one of the older half of the
+ * data registers, other than 'avoid1' and 'avoid2'
+ */
+static int
+pick_old(Gen* g, int avoid1, int avoid2)
+{
+  int order[NUM_DATA_REGS];
+  int n = 0;
+  for (int r = 0; r < NUM_DATA_REGS; ++r) {
+    if (r == avoid1 || r == avoid2) {
+      continue;
+    }
+    int i = n++;
+    while (i > 0 && g->last_write[order[i - 1]] > g->last_write[r]) {
+      order[i] = order[i - 1];
+      i--;
+    }
+    order[i] = r;
+  }
+  return order[rng_range(0, (n + 1) / 2 - 1)];
+}
+
+/*
+ * Source register by the dependence distance distribution. A distance
+ * whose producer wrote no register, or was overwritten since, falls
+ * back to an independent source
+ */
+static int
+pick_source(Gen* g, int rd, int avoid)
+{
+  const GenSpec* s = g->spec;
+  int dist = s->dep_dist[rng_pick(s->dep_weight, s->num_dep)];
+  if (dist != DEP_INDEPENDENT && dist <= g->num_history) {
+    int r = g->history[dist - 1];
+    int overwritten = 0;
+    for (int i = 0; i < dist - 1; ++i) {
+      overwritten |= g->history[i] == r;
+    }
+    if (r >= 0 && r != avoid && !overwritten) {
+      return r;
+    }
+  }
+  return pick_old(g, rd, avoid);
+}
+
+/*
+ * Sources of the next instruction, writing 'rd' (-1 for none). Right
+ * after a LOAD the first source reads its result at the LOAD-use rate
+ * and otherwise neither source does
+ */
+static void
+pick_sources(Gen* g, int rd, int* rs1, int* rs2)
+{
+  int avoid = -1;
+  if (g->load_rd >= 0) {
+    if (rng_unit() < g->spec->load_use) {
+      *rs1 = g->load_rd;
+      *rs2 = pick_source(g, rd, g->load_rd);
+      return;
+    }
+    avoid = g->load_rd;
+  }
+  *rs1 = pick_source(g, rd, avoid);
+  *rs2 = pick_source(g, rd, avoid);
+}
+
+static uint32_t
+pick_offset(const Gen* g)
+{
+  return (uint32_t)rng_range(0, (int)(g->spec->window / 4) - 1) * 4;
+}
+
+static const char* alu_ops[] = { "ADD", "SUB", "AND", "OR", "EX-OR" };
+
+/* Draws one body instruction of kind 'k', returns instructions written */
+static int
+emit_instruction(Gen* g, int k, int room)
+{
+  int rs1, rs2, rd;
+  switch (k) {
+    case MIX_ALU:
+    case MIX_MUL:
+      rd = pick_dest(g);
+      pick_sources(g, rd, &rs1, &rs2);
+      emit(g, "%s,R%d,R%d,R%d", k == MIX_MUL ? "MUL" : alu_ops[rng_range(0, 4)],
+           rd, rs1, rs2);
+      g->load_rd = -1;
+      produced(g, rd);
+      return 1;
+    case MIX_LOAD:
+      rd = pick_dest(g);
+      emit(g, "LOAD,R%d,R13,#%u", rd, pick_offset(g));
+      produced(g, rd);
+      g->load_rd = rd;
+      return 1;
+    case MIX_STORE:
+      pick_sources(g, -1, &rs1, &rs2);
+      emit(g, "STORE,R%d,R13,#%u", rs1, pick_offset(g));
+      g->load_rd = -1;
+      produced(g, -1);
+      return 1;
+    default: {
+      /* Flag setter, branch and the instructions it may skip */
+      int taken = rng_unit() < g->spec->taken;
+      int skip = room >= 4 ? rng_range(1, 2) : 1;
+      rd = pick_dest(g);
+      /* R15 + R15 is not zero, R15 - R15 is */
+      emit(g, "%s,R%d,R15,R15", taken ? "ADD" : "SUB", rd);
+      produced(g, rd);
+      emit(g, "BNZ,#%d", 4 * (skip + 1));
+      produced(g, -1);
+      g->load_rd = -1;
+      int n = 2;
+      for (int i = 0; i < skip; ++i) {
+        int kind;
+        double weights[NUM_MIX];
+        memcpy(weights, g->spec->mix, sizeof(weights));
+        weights[MIX_BRANCH] = 0;
+        kind = rng_pick(weights, NUM_MIX);
+        n += emit_instruction(g, kind, 0);
+      }
+      return n;
+    }
+  }
+}
+
+static void
+emit_loop(Gen* g, int index, int trips)
+{
+  emit(g, "MOVC,R14,#%d", trips);
+  fprintf(g->out, "loop%d:\n", index);
+  int room = g->spec->body;
+  while (room > 0) {
+    int k = rng_pick(g->spec->mix, room >= 3 ? NUM_MIX : MIX_BRANCH);
+    room -= emit_instruction(g, k, room);
+  }
+  /* Next window of the footprint, then count down */
+  emit(g, "ADD,R13,R13,R12");
+  emit(g, "AND,R13,R13,R11");
+  emit(g, "SUB,R14,R14,R15");
+  emit(g, "BNZ,loop%d", index);
+  g->load_rd = -1;
+}
+
+static int
+generate(const GenSpec* spec)
+{
+  Gen g;
+  memset(&g, 0, sizeof(g));
+  g.spec = spec;
+  g.load_rd = -1;
+  for (int i = 0; i < MAX_DEP_DIST; ++i) {
+    g.history[i] = -1;
+  }
+  g.out = stdout;
+  if (spec->out && !(g.out = fopen(spec->out, "w"))) {
+    fprintf(stderr, "APEX_Error : Unable to create %s\n", spec->out);
+    return -1;
+  }
+  rng_state = spec->seed * 0x9e3779b97f4a7c15ull + 1;
+
+  emit(&g, "MOVC,R11,#%u", (spec->footprint - 1) & ~3u);
+  emit(&g, "MOVC,R12,#%u", spec->stride);
+  emit(&g, "MOVC,R13,#0");
+  emit(&g, "MOVC,R15,#1");
+  for (int r = 0; r < NUM_DATA_REGS; ++r) {
+    emit(&g, "MOVC,R%d,#%d", r, rng_range(1, 100));
+    g.last_write[r] = -NUM_DATA_REGS + r;
+  }
+  for (int i = 0; i < spec->loops; ++i) {
+    emit_loop(&g, i, rng_range(spec->trips_min, spec->trips_max));
+  }
+  emit(&g, "HALT");
+
+  int status = ferror(g.out) ? -1 : 0;
+  if ((g.out != stdout ? fclose(g.out) : fflush(stdout)) != 0) {
+    status = -1;
+  }
+  if (status != 0) {
+    fprintf(stderr, "APEX_Error : Unable to write program\n");
+    return -1;
+  }
+  fprintf(stderr, "apex_gen : %ld instructions, seed %llu\n", g.emitted,
+          (unsigned long long)spec->seed);
+  return 0;
+}
+
+int
+main(int argc, char const* argv[])
+{
+  GenSpec spec;
+  set_defaults(&spec);
+
+  for (int i = 1; i < argc; ++i) {
+    char setting[1024];
+    const char* arg = argv[i];
+    if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+      fprintf(stderr,
+              "APEX_Help : Usage %s [--spec=FILE] [key=value ...]\n"
+              "            seed=N           random seed (1)\n"
+              "            loops=N          loops one after the other (1)\n"
+              "            body=N           instructions per loop body (100)\n"
+              "            trips=N[-M]      trip count of each loop (10)\n"
+              "            mix=alu:W,mul:W,load:W,store:W,branch:W\n"
+              "                             instruction mix weights (50,5,20,10,15)\n"
+              "            dep=D:W,...,inf:W  source dependence distances\n"
+              "                             (1:20,2:20,3:15,4:10,8:10,inf:25)\n"
+              "            load_use=P       next instruction reads a LOAD (0.3)\n"
+              "            taken=P          forward branch sites taken (0.5)\n"
+              "            footprint=BYTES  data bytes cycled through, power of 2 (4096)\n"
+              "            stride=BYTES     base address step per iteration (64)\n"
+              "            window=BYTES     LOAD/STORE offsets from the base (256)\n"
+              "            out=FILE         write the program to FILE, not stdout\n",
+              argv[0]);
+      return 1;
+    }
+    if (strncmp(arg, "--spec=", 7) == 0) {
+      if (read_spec_file(&spec, arg + 7) != 0) {
+        exit(1);
+      }
+      continue;
+    }
+    if (strncmp(arg, "--", 2) == 0) {
+      arg += 2;
+    }
+    if (snprintf(setting, sizeof(setting), "%s", arg) >= (int)sizeof(setting) ||
+        apply_setting(&spec, setting) != 0) {
+      fprintf(stderr, "APEX_Error : Invalid setting %s\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  if (generate(&spec) != 0) {
+    exit(1);
+  }
+  return 0;
+}
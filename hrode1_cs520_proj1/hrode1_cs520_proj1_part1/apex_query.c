@@ -0,0 +1,167 @@
+/*
+ *  apex_query.c
+ *  Random access queries on pipeline traces recorded with --pipetrace
+ *
+ *  Cycles are printed the way display mode prints them, followed by the
+ *  register file and zero flag at the end of the last one. Only the
+ *  chunk holding the requested cycle is read.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+#include "pipetrace.h"
+
+static int
+parse_u64(const char* text, uint64_t* value)
+{
+  char* end;
+  unsigned long long v = strtoull(text, &end, 0);
+  if (*text == '\0' || *text == '-' || *end != '\0') {
+    return -1;
+  }
+  *value = v;
+  return 0;
+}
+
+/* Accepts F, DRF, EX, MEM, WB or the names display mode prints */
+static int
+parse_stage(const char* text)
+{
+  static const char* short_names[NUM_STAGES] = { "F", "DRF", "EX", "MEM", "WB" };
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    if (strcmp(text, short_names[i]) == 0) {
+      return i;
+    }
+  }
+  return APEX_output_stage_id(text);
+}
+
+static void
+print_cycle(const APEX_PipeCursor* cur)
+{
+  APEX_output_cycle((int)cur->cycle);
+  for (int i = 0; i < cur->num_shown; ++i) {
+    const APEX_PipeShown* s = &cur->shown[i];
+    CPU_Stage stage;
+    memset(&stage, 0, sizeof(stage));
+    stage.pc = (int)s->pc;
+    stage.imm = s->imm;
+    stage.op = s->op;
+    stage.rd = s->regs >> 8 & 15;
+    stage.rs1 = s->regs >> 4 & 15;
+    stage.rs2 = s->regs & 15;
+    APEX_output_stage(APEX_output_stage_name(APEX_PIPE_STAGE(s)), &stage);
+  }
+}
+
+/* Same layout as printRegValues(), valid bit 1 is printed as "Invalid" */
+static void
+print_state(const APEX_PipeCursor* cur)
+{
+  const APEX_PipeKeyframe* st = &cur->state;
+  printf("-------------------------------------------------\n");
+  printf("------STATE OF ARCHITECTURAL REGISTER FILE-------\n");
+  printf("-------------------------------------------------\n");
+  for (int i = 0; i < 16; ++i) {
+    int valid = (st->regs_valid >> i) & 1;
+    printf("cpu->regs[%d] : %d\tcpu->regs_valid[%d] : %s\n", i, st->regs[i], i,
+           valid ? "Invalid" : "Valid");
+  }
+  printf("zero flag : %d\n", st->zero_flag);
+}
+
+static int
+query_cycles(const APEX_PipeTrace* trace, uint64_t first, uint64_t count)
+{
+  APEX_PipeCursor cur;
+  if (APEX_pipetrace_seek(&cur, trace, first) != 0) {
+    fprintf(stderr, "APEX_Error : Cycle %llu is not in the trace (1 to %llu)\n",
+            (unsigned long long)first, (unsigned long long)trace->num_cycles);
+    return -1;
+  }
+  for (uint64_t i = 0; i < count; ++i) {
+    int status = APEX_pipetrace_next(&cur);
+    if (status < 0) {
+      fprintf(stderr, "APEX_Error : Truncated record after cycle %llu\n",
+              (unsigned long long)cur.cycle);
+      return -1;
+    }
+    if (status == 0) {
+      break;
+    }
+    print_cycle(&cur);
+  }
+  print_state(&cur);
+  return 0;
+}
+
+int
+main(int argc, char const* argv[])
+{
+  if (argc < 3) {
+    fprintf(stderr,
+            "APEX_Help : Usage %s <pipeline_trace> info\n"
+            "            %s <pipeline_trace> cycle <N> [count]\n"
+            "                 display output of cycles N to N+count-1 (default 1)\n"
+            "                 and the register file after the last one\n"
+            "            %s <pipeline_trace> find <F|DRF|EX|MEM|WB> <pc> [from]\n"
+            "                 first cycle, at or after 'from', in which pc enters the stage\n",
+            argv[0], argv[0], argv[0]);
+    exit(1);
+  }
+
+  APEX_PipeTrace trace;
+  if (APEX_pipetrace_open(&trace, argv[1]) != 0) {
+    exit(1);
+  }
+
+  int status = 0;
+  if (strcmp(argv[2], "info") == 0 && argc == 3) {
+    printf("Cycles         : %llu\n", (unsigned long long)trace.num_cycles);
+    printf("Keyframes      : %llu, every %u cycles\n",
+           (unsigned long long)trace.num_chunks, trace.interval);
+    printf("File size      : %zu bytes\n", trace.map_size);
+  }
+  else if (strcmp(argv[2], "cycle") == 0 && (argc == 4 || argc == 5)) {
+    uint64_t first, count = 1;
+    if (parse_u64(argv[3], &first) != 0 ||
+        (argc == 5 && parse_u64(argv[4], &count) != 0)) {
+      fprintf(stderr, "APEX_Error : Invalid cycle\n");
+      status = -1;
+    }
+    else {
+      status = query_cycles(&trace, first, count);
+    }
+  }
+  else if (strcmp(argv[2], "find") == 0 && (argc == 5 || argc == 6)) {
+    int stage_id = parse_stage(argv[3]);
+    uint64_t pc, from = 1;
+    if (stage_id < 0 || parse_u64(argv[4], &pc) != 0 ||
+        (argc == 6 && parse_u64(argv[5], &from) != 0)) {
+      fprintf(stderr, "APEX_Error : Invalid stage, pc or cycle\n");
+      status = -1;
+    }
+    else {
+      uint64_t cycle = APEX_pipetrace_find(&trace, stage_id, (uint32_t)pc, from);
+      if (cycle) {
+        printf("pc(%llu) enters %s in cycle %llu\n", (unsigned long long)pc,
+               APEX_output_stage_name(stage_id), (unsigned long long)cycle);
+      }
+      else {
+        printf("pc(%llu) does not enter %s at or after cycle %llu\n",
+               (unsigned long long)pc, APEX_output_stage_name(stage_id),
+               (unsigned long long)from);
+        status = 1;
+      }
+    }
+  }
+  else {
+    fprintf(stderr, "APEX_Error : Unknown query %s\n", argv[2]);
+    status = -1;
+  }
+
+  APEX_pipetrace_close(&trace);
+  return status == 0 ? 0 : 1;
+}
@@ -11,6 +11,10 @@
 #include <string.h>
 
 #include "cpu.h"
+#include "object.h"
+#include "output.h"
+#include "profile.h"
+#include "timing.h"
 
 /* Set this flag to 1 to enable debug messages */
 #define ENABLE_DEBUG_MESSAGES 1
@@ -45,13 +49,22 @@ APEX_cpu_init(const char* filename)
 
   /* Initialize PC, Registers and all pipeline stages */
   cpu->pc = 4000;
+  cpu->clock = 0;
+  cpu->ins_completed = 0;
   memset(cpu->regs, 0, sizeof(int) * 32);
   memset(cpu->regs_valid, 1, sizeof(int) * 32);
   memset(cpu->stage, 0, sizeof(CPU_Stage) * NUM_STAGES);
-  memset(cpu->data_memory, 0, sizeof(int) * 4000);
-
-  /* Parse input file and create code memory */
-  cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
+  mem_init(&cpu->data_memory);
+  memset(&cpu->hooks, 0, sizeof(cpu->hooks));
+
+  /* Map a pre-assembled program, or parse input file and create code memory */
+  PROF_BEGIN(PROF_PARSER);
+  cpu->code_memory = NULL;
+  cpu->code_map = NULL;
+  if (APEX_object_load(cpu, filename) > 0) {
+    APEX_object_parse_cached(cpu, filename);
+  }
+  PROF_END(PROF_PARSER);
 
   if (!cpu->code_memory) {
     free(cpu);
@@ -59,6 +72,7 @@ APEX_cpu_init(const char* filename)
   }
 
   if (ENABLE_DEBUG_MESSAGES) {
+    PROF_BEGIN(PROF_OUTPUT);
     fprintf(stderr,
             "APEX_CPU : Initialized APEX CPU, loaded %d instructions\n",
             cpu->code_memory_size);
@@ -67,12 +81,13 @@ APEX_cpu_init(const char* filename)
 
     for (int i = 0; i < cpu->code_memory_size; ++i) {
       printf("%-9s %-9d %-9d %-9d %-9d\n",
-             cpu->code_memory[i].opcode,
+             get_opcode_name(cpu->code_memory[i].op),
              cpu->code_memory[i].rd,
              cpu->code_memory[i].rs1,
              cpu->code_memory[i].rs2,
              cpu->code_memory[i].imm);
     }
+    PROF_END(PROF_OUTPUT);
   }
 
   /* Make all stages busy except Fetch stage, initally to start the pipeline */
@@ -83,6 +98,53 @@ APEX_cpu_init(const char* filename)
   return cpu;
 }
 
+/*
+ * Timing model parameters of this pipeline. There is no forwarding,
+ * operands are read once a writer clears their valid bit in Writeback.
+ * MUL spends two cycles in Execute and the instruction after it follows
+ * it to Execute without that check. BZ/BNZ stay three cycles in
+ * Decode/RF and taken branches redirect fetch from Memory
+ */
+void
+APEX_timing_defaults(APEX_TimingConfig* config)
+{
+  config->forwarding = 0;
+  config->store_bypass = 0;
+  config->mul_latency = 2;
+  config->branch_stage = MEM;
+  config->branch_decode = 3;
+  config->mul_pair = 1;
+}
+
+/*
+ * Pipeline state kept in the globals of this file, for memoization
+ * (memo.h). Fills 'values' and returns how many there are
+ */
+int
+APEX_cpu_save_globals(int* values)
+{
+  values[0] = mulCycleCounter;
+  values[1] = mulEXtoMEM;
+  values[2] = stopSimulation;
+  values[3] = zeroFlag;
+  values[4] = justFetchinDRF;
+  values[5] = alreadyFetched;
+  values[6] = branchToEX;
+  return 7;
+}
+
+void
+APEX_cpu_restore_globals(const int* values)
+{
+  mulCycleCounter = values[0];
+  mulEXtoMEM = values[1];
+  stopSimulation = values[2];
+  zeroFlag = values[3];
+  justFetchinDRF = values[4];
+  alreadyFetched = values[5];
+  branchToEX = values[6];
+}
+
 /*
  * This function de-allocates APEX cpu.
  *
@@ -92,7 +154,9 @@ APEX_cpu_init(const char* filename)
 void
 APEX_cpu_stop(APEX_CPU* cpu)
 {
-  free(cpu->code_memory);
+  APEX_hooks_release(cpu);
+  mem_free(&cpu->data_memory);
+  APEX_object_free_code(cpu);
   free(cpu);
 }
 
@@ -108,84 +172,72 @@ get_code_index(int pc)
   return (pc - 4000) / 4;
 }
 
-static void
-print_instruction(CPU_Stage* stage)
-{
-  if (strcmp(stage->opcode, "STORE") == 0) {
-    printf( "%s,R%d,R%d,#%d ", stage->opcode, stage->rs1, stage->rs2, stage->imm);
-  }
-  
-  if (strcmp(stage->opcode, "LOAD") == 0) {
-    printf( "%s,R%d,R%d,#%d ", stage->opcode, stage->rd, stage->rs1, stage->imm);
-  }
-
-  if (strcmp(stage->opcode, "MOVC") == 0) {
-    printf("%s,R%d,#%d ", stage->opcode, stage->rd, stage->imm);
-  }
-
-  if (strcmp(stage->opcode, "ADD") == 0) {
-    printf(
-      "%s,R%d,R%d,R%d ", stage->opcode, stage->rd, stage->rs1, stage->rs2);
-  }
+static const APEX_Instruction empty_instruction;
 
-  if (strcmp(stage->opcode, "SUB") == 0) {
-    printf(
-      "%s,R%d,R%d,R%d ", stage->opcode, stage->rd, stage->rs1, stage->rs2);
-  }
+/* Whether an instruction of code memory lives at 'pc' */
+static int
+in_code_memory(APEX_CPU* cpu, int pc)
+{
+  return pc >= 4000 && (pc - 4000) % 4 == 0 &&
+         get_code_index(pc) < cpu->code_memory_size;
+}
 
-  if (strcmp(stage->opcode, "AND") == 0) {
-    printf(
-      "%s,R%d,R%d,R%d ", stage->opcode, stage->rd, stage->rs1, stage->rs2);
+/*
+ * Instruction at 'pc', fetching outside of code memory (past the last
+ * instruction, below 4000 or between instructions) yields an empty
+ * instruction
+ */
+static const APEX_Instruction*
+get_code_instruction(APEX_CPU* cpu, int pc)
+{
+  if (!in_code_memory(cpu, pc)) {
+    return &empty_instruction;
   }
+  return &cpu->code_memory[get_code_index(pc)];
+}
 
-  if (strcmp(stage->opcode, "OR") == 0) {
-    printf(
-      "%s,R%d,R%d,R%d ", stage->opcode, stage->rd, stage->rs1, stage->rs2);
-  }
+/* Opcode string latched by Fetch, empty for the empty instruction */
+static const char*
+get_code_opcode(const APEX_Instruction* ins)
+{
+  return ins == &empty_instruction ? "" : get_opcode_name(ins->op);
+}
 
-  if (strcmp(stage->opcode, "EX-OR") == 0) {
-    printf(
-      "%s,R%d,R%d,R%d ", stage->opcode, stage->rd, stage->rs1, stage->rs2);
-  }
-  
-  if (strcmp(stage->opcode, "MUL") == 0) {
-    printf(
-      "%s,R%d,R%d,R%d ", stage->opcode, stage->rd, stage->rs1, stage->rs2);
-  }
-  
-  if (strcmp(stage->opcode, "HALT") == 0) {
-    printf("%s ", stage->opcode);
+/*
+ * Whether control left code memory: Decode/RF holds an instruction
+ * fetched outside of it and no older instruction, which could still
+ * redirect fetch or has yet to retire, is in a later latch. Bubbles
+ * carry pc 0
+ */
+static int
+left_code_memory(APEX_CPU* cpu)
+{
+  int pc = cpu->stage[DRF].pc;
+  if (pc == 0 || in_code_memory(cpu, pc)) {
+    return 0;
   }
-  
-  if (strcmp(stage->opcode, "BZ") == 0) {
-    printf(
-      "%s,#%d ", stage->opcode, stage->imm);
-  } 
-  
-  if (strcmp(stage->opcode, "BNZ") == 0) {
-    printf(
-      "%s,#%d ", stage->opcode, stage->imm);
+  for (int i = EX; i <= WB; ++i) {
+    if (cpu->stage[i].pc != 0 && in_code_memory(cpu, cpu->stage[i].pc)) {
+      return 0;
+    }
   }
-  
-  if (strcmp(stage->opcode, "JUMP") == 0) {
-    printf(
-      "%s,R%d,#%d ", stage->opcode, stage->rs1, stage->imm);
-  }  
+  return 1;
 }
 
 /* Debug function which dumps the cpu stage
- * content
+ * content, attached tools see it in every mode
  *
  * Note : You are not supposed to edit this function
  *
  */
 static void
-print_stage_content(char* name, CPU_Stage* stage)
+print_stage_content(APEX_CPU* cpu, char* name, CPU_Stage* stage)
 {
+	APEX_HOOK_SHOW(cpu, APEX_output_stage_id(name), stage);
 	if (display == 1) {
-		printf("%-15s: pc(%d) ", name, stage->pc);
-		print_instruction(stage);
-		printf("\n");
+		PROF_BEGIN(PROF_OUTPUT);
+		APEX_output_stage(name, stage);
+		PROF_END(PROF_OUTPUT);
 	}
 }
 
@@ -205,7 +257,7 @@ fetch(APEX_CPU* cpu)
 	{
 	  alreadyFetched=0;
 	  cpu->stage[DRF] = cpu->stage[F];
-	  print_stage_content("Fetch", stage);
+	  print_stage_content(cpu, "Fetch", stage);
 	  return 0;
 	}
     /* Store current PC in fetch latch */
@@ -214,28 +266,30 @@ fetch(APEX_CPU* cpu)
     /* Index into code memory using this pc and copy all instruction fields into
      * fetch latch
      */
-    APEX_Instruction* current_ins = &cpu->code_memory[get_code_index(cpu->pc)];
-    strcpy(stage->opcode, current_ins->opcode);
+    const APEX_Instruction* current_ins = get_code_instruction(cpu, cpu->pc);
+    strcpy(stage->opcode, get_code_opcode(current_ins));
     stage->rd = current_ins->rd;
     stage->rs1 = current_ins->rs1;
     stage->rs2 = current_ins->rs2;
     stage->imm = current_ins->imm;
+    stage->op = current_ins->op;
     stage->rd = current_ins->rd;
 
     /* Update PC for next instruction */
     cpu->pc += 4;
+    APEX_HOOK_FETCH(cpu, &cpu->stage[F]);
 
     /* Copy data from fetch latch to decode latch*/
     cpu->stage[DRF] = cpu->stage[F];
 
     if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Fetch", stage);
+      print_stage_content(cpu, "Fetch", stage);
     }
   }
   else
   {
 	  if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Fetch", stage);
+      print_stage_content(cpu, "Fetch", stage);
     }
   }
   return 0;
@@ -271,19 +325,22 @@ decode(APEX_CPU* cpu)
 					 (strcmp(cpu->stage[EX].opcode,"SUB") == 0) || 
 					 (strcmp(cpu->stage[EX].opcode,"MUL") == 0) )
 				{
-					print_stage_content("Decode/RF", stage);
+					print_stage_content(cpu, "Decode/RF", stage);
 					cpu->stage[EX]=nop;
+					APEX_HOOK_STALL(cpu, DRF);
 					
 					/* Only fetching the instruction and not incrementing stage pointer */
 					cpu->stage[F].pc = cpu->pc;
-					APEX_Instruction* current_ins = &cpu->code_memory[get_code_index(cpu->pc)];
-					strcpy(cpu->stage[F].opcode, current_ins->opcode);
+					const APEX_Instruction* current_ins = get_code_instruction(cpu, cpu->pc);
+					strcpy(cpu->stage[F].opcode, get_code_opcode(current_ins));
 					cpu->stage[F].rd = current_ins->rd;
 					cpu->stage[F].rs1 = current_ins->rs1;
 					cpu->stage[F].rs2 = current_ins->rs2;
 					cpu->stage[F].imm = current_ins->imm;
+					cpu->stage[F].op = current_ins->op;
 					cpu->stage[F].rd = current_ins->rd;
 					cpu->pc += 4;
+					APEX_HOOK_FETCH(cpu, &cpu->stage[F]);
 					
 					cpu->stage[F].stalled=1;
 					
@@ -291,13 +348,15 @@ decode(APEX_CPU* cpu)
 				}
 				if(branchToEX==3) {
 					branchToEX=0;
+					APEX_HOOK_DECODE(cpu, &cpu->stage[DRF]);
 					cpu->stage[EX] = cpu->stage[DRF];
 					cpu->stage[F].stalled=0;
 					alreadyFetched=1;
-					print_stage_content("Decode/RF", stage);
+					print_stage_content(cpu, "Decode/RF", stage);
 					return 0;
 				}
-				print_stage_content("Decode/RF", stage);
+				APEX_HOOK_STALL(cpu, DRF);
+				print_stage_content(cpu, "Decode/RF", stage);
 				return 0;
 			}
 			
@@ -315,8 +374,9 @@ decode(APEX_CPU* cpu)
 			}
 
 			if (ENABLE_DEBUG_MESSAGES) {
-			  print_stage_content("Decode/RF", stage);
+			  print_stage_content(cpu, "Decode/RF", stage);
 			}
+			APEX_HOOK_DECODE(cpu, &cpu->stage[DRF]);
 			/* Copy data from decode latch to execute latch*/
 			cpu->stage[EX] = cpu->stage[DRF];
 			justFetchinDRF=0;
@@ -325,7 +385,8 @@ decode(APEX_CPU* cpu)
 		else
 		{
 			cpu->stage[EX] = nop;
-			print_stage_content("Decode/RF", stage);
+			APEX_HOOK_STALL(cpu, DRF);
+			print_stage_content(cpu, "Decode/RF", stage);
 			justFetchinDRF++;
 			if(justFetchinDRF==1) {
 				/* Only fetching the instruction and not incrementing stage pointer */
@@ -335,16 +396,18 @@ decode(APEX_CPU* cpu)
 				/* Index into code memory using this pc and copy all instruction fields into
 				 * fetch latch
 				 */
-				APEX_Instruction* current_ins = &cpu->code_memory[get_code_index(cpu->pc)];
-				strcpy(cpu->stage[F].opcode, current_ins->opcode);
+				const APEX_Instruction* current_ins = get_code_instruction(cpu, cpu->pc);
+				strcpy(cpu->stage[F].opcode, get_code_opcode(current_ins));
 				cpu->stage[F].rd = current_ins->rd;
 				cpu->stage[F].rs1 = current_ins->rs1;
 				cpu->stage[F].rs2 = current_ins->rs2;
 				cpu->stage[F].imm = current_ins->imm;
+				cpu->stage[F].op = current_ins->op;
 				cpu->stage[F].rd = current_ins->rd;
 
 				/* Update PC for next instruction */
 				cpu->pc += 4;
+				APEX_HOOK_FETCH(cpu, &cpu->stage[F]);
 				alreadyFetched=1;
 			}			
 			cpu->stage[F].stalled =1;
@@ -353,7 +416,7 @@ decode(APEX_CPU* cpu)
   else
   {
 	if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Decode/RF", stage);
+      print_stage_content(cpu, "Decode/RF", stage);
     }
   }
   return 0;
@@ -379,6 +442,7 @@ execute(APEX_CPU* cpu)
 	if (mulEXtoMEM == 1) {
 		cpu->stage[DRF].stalled=0;
 		cpu->stage[F].stalled=0;
+		APEX_HOOK_DECODE(cpu, &cpu->stage[DRF]);
 		/* Only incrementing stage pointer for Decode/RF stage*/
 		cpu->stage[EX] = cpu->stage[DRF];
 		/* Only incrementing stage pointer for Fetch stage*/
@@ -414,6 +478,7 @@ execute(APEX_CPU* cpu)
     if (strcmp(stage->opcode, "STORE") == 0) {
 		/* computing memory address */
 		stage->buffer = integerALU(stage->rs2_value,stage->imm);
+		stage->mem_address = stage->buffer;
     }
 
     /* MOVC */
@@ -425,6 +490,7 @@ execute(APEX_CPU* cpu)
     if (strcmp(stage->opcode, "LOAD") == 0) {
 		/* computing memory address */
 		stage->buffer = integerALU(stage->rs1_value,stage->imm);
+		stage->mem_address = stage->buffer;
     }
 	
 	/* ADD */
@@ -447,8 +513,10 @@ execute(APEX_CPU* cpu)
 		if(mulCycleCounter == 1)
 		{
 			stage->buffer = mulALU(stage->rs1_value, stage->rs2_value);
+			APEX_HOOK_ISSUE(cpu, stage);
 			cpu->stage[MEM] = nop;
-			print_stage_content("Execute", &cpu->stage[EX]);
+			APEX_HOOK_STALL(cpu, EX);
+			print_stage_content(cpu, "Execute", &cpu->stage[EX]);
 			cpu->stage[DRF].stalled=1;
 			
 			/* Only fetching the instruction and not incrementing stage pointer */
@@ -458,16 +526,18 @@ execute(APEX_CPU* cpu)
 			/* Index into code memory using this pc and copy all instruction fields into
 			 * fetch latch
 			 */
-			APEX_Instruction* current_ins = &cpu->code_memory[get_code_index(cpu->pc)];
-			strcpy(cpu->stage[F].opcode, current_ins->opcode);
+			const APEX_Instruction* current_ins = get_code_instruction(cpu, cpu->pc);
+			strcpy(cpu->stage[F].opcode, get_code_opcode(current_ins));
 			cpu->stage[F].rd = current_ins->rd;
 			cpu->stage[F].rs1 = current_ins->rs1;
 			cpu->stage[F].rs2 = current_ins->rs2;
 			cpu->stage[F].imm = current_ins->imm;
+			cpu->stage[F].op = current_ins->op;
 			cpu->stage[F].rd = current_ins->rd;
 
 			/* Update PC for next instruction */
 			cpu->pc += 4;
+			APEX_HOOK_FETCH(cpu, &cpu->stage[F]);
 			cpu->stage[F].stalled=1;
 		
 			if ( ((strcmp(cpu->stage[DRF].opcode, "STORE") == 0 || strcmp(cpu->stage[DRF].opcode, "ADD") == 0 || strcmp(cpu->stage[DRF].opcode, "SUB") == 0 ||
@@ -497,7 +567,7 @@ execute(APEX_CPU* cpu)
 			mulEXtoMEM=1;
 			cpu->stage[DRF].stalled=1;
 			cpu->stage[F].stalled=1;
-			print_stage_content("Execute", stage);
+			print_stage_content(cpu, "Execute", stage);
 			cpu->stage[MEM] = cpu->stage[EX];
 			cpu->stage[EX] = nop;
 			
@@ -539,11 +609,13 @@ execute(APEX_CPU* cpu)
 		stage->buffer = xorALU(stage->rs1_value, stage->rs2_value);
     }
 
+    APEX_HOOK_ISSUE(cpu, stage);
+
     /* Copy data from Execute latch to Memory latch*/
     cpu->stage[MEM] = cpu->stage[EX];
 
     if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Execute", stage);
+      print_stage_content(cpu, "Execute", stage);
     }
 		
     /* HALT */
@@ -575,7 +647,11 @@ memory(APEX_CPU* cpu)
   if (!stage->busy && !stage->stalled) {
     /* Store */
     if (strcmp(stage->opcode, "STORE") == 0) {
-		cpu->data_memory[stage->buffer/4]=stage->rs1_value;
+		if (mem_write(&cpu->data_memory, stage->buffer, stage->rs1_value) != 0) {
+			fprintf(stderr, "APEX_Error : Out of memory storing to address %d\n",
+			        stage->buffer);
+		}
+		APEX_HOOK_MEMORY(cpu, stage, stage->buffer, stage->rs1_value, 1);
     }
 	
 	/* BZ */
@@ -583,6 +659,7 @@ memory(APEX_CPU* cpu)
 		if (zeroFlag != 1) {
 			stage->buffer = integerALU(stage->pc,stage->imm);
 			cpu->pc = stage->buffer;	
+			APEX_HOOK_FLUSH(cpu, stage->pc, stage->buffer);
 			cpu->stage[EX]=nop;
 			cpu->stage[DRF]=nop;
 			cpu->stage[F].stalled=0;
@@ -594,6 +671,7 @@ memory(APEX_CPU* cpu)
 		if (zeroFlag != 1) {
 			stage->buffer = integerALU(stage->pc,stage->imm);
 			cpu->pc = stage->buffer;	
+			APEX_HOOK_FLUSH(cpu, stage->pc, stage->buffer);
 			cpu->stage[EX]=nop;
 			cpu->stage[DRF]=nop;
 			cpu->stage[F].stalled=0;
@@ -605,6 +683,7 @@ memory(APEX_CPU* cpu)
 		if (zeroFlag != 1) {
 			stage->buffer = integerALU(stage->rs1_value,stage->imm);
 			cpu->pc = stage->buffer;	
+			APEX_HOOK_FLUSH(cpu, stage->pc, stage->buffer);
 			cpu->stage[EX]=nop;
 			cpu->stage[DRF]=nop;
 			cpu->stage[F].stalled=0;
@@ -613,20 +692,22 @@ memory(APEX_CPU* cpu)
 
     /* LOAD */
     if (strcmp(stage->opcode, "LOAD") == 0) {
-		stage->buffer=cpu->data_memory[stage->buffer/4];
+		int address = stage->buffer;
+		stage->buffer = mem_read(&cpu->data_memory, address);
+		APEX_HOOK_MEMORY(cpu, stage, address, stage->buffer, 0);
     }
 
     /* Copy data from decode latch to execute latch*/
     cpu->stage[WB] = cpu->stage[MEM];
 
     if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Memory", stage);
+      print_stage_content(cpu, "Memory", stage);
     }
 	
 	/* HALT */
     if (strcmp(stage->opcode, "HALT") == 0) {
 		cpu->stage[EX] =nop;
-		print_stage_content("Execute", &cpu->stage[EX]);
+		print_stage_content(cpu, "Execute", &cpu->stage[EX]);
 		cpu->stage[DRF] =nop;
 		cpu->stage[F] =nop;
 		cpu->stage[DRF].stalled =1;
@@ -664,17 +745,18 @@ writeback(APEX_CPU* cpu)
 	}
 
     cpu->ins_completed++;
+    APEX_HOOK_RETIRE(cpu, stage);
 
     if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Writeback", stage);
+      print_stage_content(cpu, "Writeback", stage);
     }
 	
 	/* HALT */
     if (strcmp(stage->opcode, "HALT") == 0) {
 		cpu->stage[MEM] =nop;
-		print_stage_content("Memory", &cpu->stage[MEM]);
+		print_stage_content(cpu, "Memory", &cpu->stage[MEM]);
 		cpu->stage[EX] =nop;
-		print_stage_content("Execute", &cpu->stage[EX]);
+		print_stage_content(cpu, "Execute", &cpu->stage[EX]);
 		cpu->stage[DRF] =nop;
 		cpu->stage[F] =nop;
 		cpu->stage[DRF].stalled =1;
@@ -770,8 +852,43 @@ void printMemoryData(APEX_CPU* cpu)
     printf("--------------------------------\n");
 	for (int i=0;i<100;i++)
 	{
-		printf("|\tMEM[%d] \t|Address : %d\t|\tData Value : %d\n",i,i*4,cpu->data_memory[i]);
+		printf("|\tMEM[%d] \t|Address : %d\t|\tData Value : %d\n",i,i*4,mem_read(&cpu->data_memory, i*4));
+	}
+}
+
+/*
+ * Runs the pipeline for one cycle, without printing the cycle header.
+ * Returns 1 once the simulation has stopped
+ */
+int
+APEX_cpu_cycle(APEX_CPU* cpu)
+{
+	if (stopSimulation == 1) {
+		return 1;
 	}
+	PROF_BEGIN(PROF_WRITEBACK);
+	writeback(cpu);
+	PROF_END(PROF_WRITEBACK);
+	PROF_BEGIN(PROF_MEMORY);
+	memory(cpu);
+	PROF_END(PROF_MEMORY);
+	PROF_BEGIN(PROF_EXECUTE);
+	execute(cpu);
+	PROF_END(PROF_EXECUTE);
+	PROF_BEGIN(PROF_DECODE);
+	decode(cpu);
+	PROF_END(PROF_DECODE);
+	PROF_BEGIN(PROF_FETCH);
+    fetch(cpu);
+	PROF_END(PROF_FETCH);
+	if (!stopSimulation && left_code_memory(cpu)) {
+		fprintf(stderr, "APEX_CPU : pc(%d) is outside code memory, stopping\n",
+		        cpu->stage[DRF].pc);
+		stopSimulation = 1;
+	}
+    cpu->clock++;
+	APEX_HOOK_CYCLE(cpu);
+	return stopSimulation;
 }
 
 /*
@@ -786,29 +903,27 @@ APEX_cpu_run(APEX_CPU* cpu, char* operation, int cycles)
 	if (strcmp(operation,"display") == 0) {
 		display=1;
 	}
+	APEX_output_start();
   while (1) {
 	  
 	if (stopSimulation == 1 || cpu->clock == cycles) {
-      printf("(apex) >> Simulation Complete\n");
+      APEX_output_text("(apex) >> Simulation Complete\n");
       break;
     }
 	
     if (ENABLE_DEBUG_MESSAGES) {
-      printf("--------------------------------\n");
-      printf("Clock Cycle #: %d\n", cpu->clock+1);
-      printf("--------------------------------\n");
+      PROF_BEGIN(PROF_OUTPUT);
+      APEX_output_cycle(cpu->clock+1);
+      PROF_END(PROF_OUTPUT);
     }
-	
-	writeback(cpu);
-	memory(cpu);
-	execute(cpu);
-	decode(cpu);
-    fetch(cpu);
-	//printRegValues(cpu);
-    cpu->clock++;
-
+	APEX_cpu_cycle(cpu);
   }
+	APEX_output_stop();
+	PROF_BEGIN(PROF_OUTPUT);
   	printRegValues(cpu);
 	printMemoryData(cpu);
+	PROF_END(PROF_OUTPUT);
+	APEX_hooks_finish(cpu);
+	PROF_REPORT(cpu->clock);
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef _APEX_FORKPOOL_H_
+#define _APEX_FORKPOOL_H_
+/**
+ *  forkpool.h
+ *  Child processes forked from the simulator, reporting over pipes
+ *
+ *  A child sees the whole simulator as it was when forked, copy on
+ *  write, runs a body function on it and writes a fixed size result
+ *  back over its own pipe. At most 'jobs' children run at once; forking
+ *  another first waits for one of them to finish.
+ */
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Runs in the child, fills 'result' (result_size bytes, zeroed) */
+typedef void (*APEX_ForkBody)(void* arg, void* result);
+
+typedef struct APEX_ForkPool
+{
+  int count;           // Children the pool holds, by index
+  int jobs;            // Most running at once
+  int running;
+  size_t result_size;  // At most PIPE_BUF
+  pid_t* pids;         // 0 once collected
+  int* fds;
+  int* ok;             // Result of the child arrived
+  char* results;
+} APEX_ForkPool;
+
+int
+APEX_forkpool_init(APEX_ForkPool* pool, int count, size_t result_size, int jobs);
+
+void
+APEX_forkpool_free(APEX_ForkPool* pool);
+
+int
+APEX_forkpool_spawn(APEX_ForkPool* pool, int index, APEX_ForkBody body, void* arg);
+
+int
+APEX_forkpool_wait(APEX_ForkPool* pool);
+
+const void*
+APEX_forkpool_result(const APEX_ForkPool* pool, int index);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _APEX_FUNC_H_
+#define _APEX_FUNC_H_
+/**
+ *  func.h
+ *  Functional execution of APEX programs, without pipeline timing
+ *
+ *  Instructions are executed in program order with the architectural
+ *  results of the pipelines: the same register file, data memory and
+ *  zero flag, including the way branches update the zero flag while
+ *  they resolve. Straight-line runs of code ending at BZ, BNZ, JUMP or
+ *  HALT are translated once into blocks of micro-ops, kept in a cache
+ *  keyed by start pc and chained to their successors.
+ */
+#include <stdint.h>
+
+#include "cpu.h"
+
+/*
+ * Set this flag to 0 to dispatch micro-ops from a switch. Threaded
+ * dispatch needs the computed goto of GCC and clang
+ */
+#ifndef ENABLE_THREADED_DISPATCH
+#if defined(__GNUC__)
+#define ENABLE_THREADED_DISPATCH 1
+#else
+#define ENABLE_THREADED_DISPATCH 0
+#endif
+#endif
+
+/* Most instructions translated into one block */
+#define APEX_FUNC_MAX_BLOCK 256
+
+typedef struct APEX_FuncStats
+{
+  uint64_t instructions;  // Instructions executed
+  uint64_t blocks;        // Blocks translated
+  uint64_t lookups;       // Successors found in the cache, not by chaining
+  uint64_t compiled;      // Blocks compiled to native code
+  int stopped;            // Program ended, rather than the instruction limit
+} APEX_FuncStats;
+
+/*
+ * Instructions executed in each block, by code memory index of its
+ * first instruction. 'counts' and 'touched' have code_memory_size
+ * entries; 'touched' lists the indices whose count went from 0 up
+ */
+typedef struct APEX_FuncProfile
+{
+  uint64_t* counts;
+  int* touched;
+  int num_touched;
+} APEX_FuncProfile;
+
+int
+APEX_func_run(APEX_CPU* cpu, uint64_t max_instructions, int use_jit,
+              APEX_FuncProfile* profile, APEX_FuncStats* stats);
+
+#endif
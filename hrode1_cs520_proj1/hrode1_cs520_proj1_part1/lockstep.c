@@ -0,0 +1,688 @@
+/*
+ *  lockstep.c
+ *  Lockstep functional execution of many instances, see lockstep.h
+ *
+ *  Instructions, branches and the zero flag follow functional mode
+ *  (func.c). The lanes at the lowest pc form a group and run until a
+ *  branch that sends them different ways or past the lanes still
+ *  waiting, HALT, the end of code memory or the instruction limit of
+ *  one of them; lanes waiting at a higher pc join the group when it
+ *  gets there. A group keeps its pc and instruction count to itself and
+ *  writes them back to its lanes when it breaks up, so a straight run
+ *  of code costs one kernel call per instruction, whatever the number
+ *  of lanes.
+ *
+ *  A kernel applies one ALU operation to the masked lanes and sets
+ *  their zero flag. The AVX2 kernel handles 8 lanes per operation and
+ *  is chosen at run time; the scalar one is left to the compiler.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lockstep.h"
+#include "object.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LOCKSTEP_AVX2 1
+#else
+#define LOCKSTEP_AVX2 0
+#endif
+
+/* Kernel operation copying 'b' (or 'imm') into the masked lanes */
+#define LANE_COPY OP_MOVC
+
+/* Word of a lane page holding byte 'address' of every lane */
+#define LANE_WORD(address) (((address) >> 2) & (MEM_PAGE_WORDS - 1))
+
+static inline int32_t
+wrap_add(int32_t a, int32_t b)
+{
+  return (int32_t)((uint32_t)a + (uint32_t)b);
+}
+
+static inline int32_t
+lane_alu(int op, int32_t x, int32_t y)
+{
+  switch (op) {
+    case OP_ADD:
+      return wrap_add(x, y);
+    case OP_SUB:
+      return (int32_t)((uint32_t)x - (uint32_t)y);
+    case OP_AND:
+      return x & y;
+    case OP_OR:
+      return x | y;
+    case OP_EXOR:
+      return x ^ y;
+    case OP_MUL:
+      return (int32_t)((uint32_t)x * (uint32_t)y);
+    default:
+      return y;  // LANE_COPY
+  }
+}
+
+/*
+ * dst = a <op> b, or a <op> imm when 'b' is NULL, in the lanes of
+ * 'mask', and their flag = (dst == 0) unless 'flag' is NULL
+ */
+static void
+kernel_scalar(int op, int32_t* dst, const int32_t* a, const int32_t* b,
+              int32_t imm, const int32_t* mask, int32_t* flag, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    if (!mask[i]) {
+      continue;
+    }
+    int32_t r = lane_alu(op, a ? a[i] : 0, b ? b[i] : imm);
+    dst[i] = r;
+    if (flag) {
+      flag[i] = r == 0;
+    }
+  }
+}
+
+/* 1 if every masked lane of 'v' holds 'value' */
+static int
+uniform_scalar(const int32_t* v, int32_t value, const int32_t* mask, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    if (mask[i] && v[i] != value) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+#if LOCKSTEP_AVX2
+__attribute__((target("avx2"))) static int
+uniform_avx2(const int32_t* v, int32_t value, const int32_t* mask, int n)
+{
+  const __m256i vvalue = _mm256_set1_epi32(value);
+  for (int i = 0; i < n; i += 8) {
+    __m256i m = _mm256_load_si256((const __m256i*)(mask + i));
+    __m256i x = _mm256_load_si256((const __m256i*)(v + i));
+    __m256i differ = _mm256_andnot_si256(_mm256_cmpeq_epi32(x, vvalue), m);
+    if (!_mm256_testz_si256(differ, differ)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Same as kernel_scalar(), 8 lanes at a time */
+__attribute__((target("avx2"))) static void
+kernel_avx2(int op, int32_t* dst, const int32_t* a, const int32_t* b,
+            int32_t imm, const int32_t* mask, int32_t* flag, int n)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i vimm = _mm256_set1_epi32(imm);
+  for (int i = 0; i < n; i += 8) {
+    __m256i m = _mm256_load_si256((const __m256i*)(mask + i));
+    if (_mm256_testz_si256(m, m)) {
+      continue;
+    }
+    __m256i x = a ? _mm256_load_si256((const __m256i*)(a + i)) : zero;
+    __m256i y = b ? _mm256_load_si256((const __m256i*)(b + i)) : vimm;
+    __m256i r;
+    switch (op) {
+      case OP_ADD:
+        r = _mm256_add_epi32(x, y);
+        break;
+      case OP_SUB:
+        r = _mm256_sub_epi32(x, y);
+        break;
+      case OP_AND:
+        r = _mm256_and_si256(x, y);
+        break;
+      case OP_OR:
+        r = _mm256_or_si256(x, y);
+        break;
+      case OP_EXOR:
+        r = _mm256_xor_si256(x, y);
+        break;
+      case OP_MUL:
+        r = _mm256_mullo_epi32(x, y);
+        break;
+      default:
+        r = y;
+        break;
+    }
+    __m256i* d = (__m256i*)(dst + i);
+    _mm256_store_si256(d, _mm256_blendv_epi8(_mm256_load_si256(d), r, m));
+    if (flag) {
+      __m256i* f = (__m256i*)(flag + i);
+      __m256i z = _mm256_and_si256(_mm256_cmpeq_epi32(r, zero), one);
+      _mm256_store_si256(f, _mm256_blendv_epi8(_mm256_load_si256(f), z, m));
+    }
+  }
+}
+#endif
+
+/* Zero filled, aligned for AVX2 loads and stores */
+static void*
+lane_alloc(size_t bytes)
+{
+  void* p;
+  if (posix_memalign(&p, 32, bytes ? bytes : 32) != 0) {
+    return NULL;
+  }
+  memset(p, 0, bytes);
+  return p;
+}
+
+static int32_t*
+lane_page(const APEX_Lockstep* ls, uint32_t address)
+{
+  const APEX_LaneTable* table = ls->tables[address >> (32 - MEM_DIR_BITS)];
+  if (!table) {
+    return NULL;
+  }
+  return table->pages[(address >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+}
+
+/* Page holding 'address' for all lanes, allocated if needed. NULL when out of memory */
+static int32_t*
+lane_page_alloc(APEX_Lockstep* ls, uint32_t address)
+{
+  APEX_LaneTable** table = &ls->tables[address >> (32 - MEM_DIR_BITS)];
+  if (!*table) {
+    *table = calloc(1, sizeof(**table));
+    if (!*table) {
+      return NULL;
+    }
+  }
+  int32_t** page = &(*table)->pages[(address >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+  if (!*page) {
+    *page = lane_alloc(sizeof(int32_t) * MEM_PAGE_WORDS * (size_t)ls->stride);
+    if (!*page) {
+      return NULL;
+    }
+    ls->num_pages++;
+  }
+  return *page;
+}
+
+static int
+in_code(const APEX_CPU* cpu, int pc)
+{
+  return pc >= 4000 && (pc - 4000) % 4 == 0 &&
+         (pc - 4000) / 4 < cpu->code_memory_size;
+}
+
+/*
+ * Starts 'num_lanes' instances from the state of 'cpu': its registers,
+ * zero flag, pc and data memory
+ */
+int
+APEX_lockstep_init(APEX_Lockstep* ls, const APEX_CPU* cpu, int num_lanes)
+{
+  memset(ls, 0, sizeof(*ls));
+  if (num_lanes < 1 || num_lanes > APEX_LOCKSTEP_MAX_LANES) {
+    fprintf(stderr, "APEX_Error : Instances must be 1 to %d\n",
+            APEX_LOCKSTEP_MAX_LANES);
+    return -1;
+  }
+  int stride = (num_lanes + APEX_LOCKSTEP_ALIGN - 1) & ~(APEX_LOCKSTEP_ALIGN - 1);
+  ls->num_lanes = num_lanes;
+  ls->stride = stride;
+  ls->regs = lane_alloc(sizeof(int32_t) * 16 * stride);
+  ls->flag = lane_alloc(sizeof(int32_t) * stride);
+  ls->pc = lane_alloc(sizeof(int32_t) * stride);
+  ls->mask = lane_alloc(sizeof(int32_t) * stride);
+  ls->address = lane_alloc(sizeof(int32_t) * stride);
+  ls->executed = calloc(stride, sizeof(*ls->executed));
+  ls->done = calloc(stride, 1);
+  if (!ls->regs || !ls->flag || !ls->pc || !ls->mask || !ls->address ||
+      !ls->executed || !ls->done) {
+    fprintf(stderr, "APEX_Error : Out of memory for %d instances\n", num_lanes);
+    APEX_lockstep_free(ls);
+    return -1;
+  }
+
+  for (int lane = 0; lane < stride; ++lane) {
+    for (int r = 0; r < 16; ++r) {
+      ls->regs[r * stride + lane] = cpu->regs[r];
+    }
+    ls->flag[lane] = zeroFlag;
+    ls->pc[lane] = cpu->pc;
+    ls->done[lane] = lane >= num_lanes;  // Padding
+  }
+
+  /* Every lane starts with the data memory of 'cpu' */
+  for (int d = 0; d < MEM_DIR_SIZE; ++d) {
+    const APEX_MemTable* table = cpu->data_memory.tables[d];
+    for (int t = 0; table && t < MEM_TABLE_SIZE; ++t) {
+      const APEX_MemPage* src = table->pages[t];
+      if (!src) {
+        continue;
+      }
+      uint32_t address = ((uint32_t)d << (32 - MEM_DIR_BITS)) |
+                         ((uint32_t)t << MEM_PAGE_BITS);
+      int32_t* page = lane_page_alloc(ls, address);
+      if (!page) {
+        fprintf(stderr, "APEX_Error : Out of memory for %d instances\n", num_lanes);
+        APEX_lockstep_free(ls);
+        return -1;
+      }
+      for (int w = 0; w < MEM_PAGE_WORDS; ++w) {
+        for (int lane = 0; src->words[w] && lane < stride; ++lane) {
+          page[w * stride + lane] = src->words[w];
+        }
+      }
+    }
+  }
+
+  ls->kernel = kernel_scalar;
+  ls->uniform = uniform_scalar;
+  ls->kernel_name = "scalar";
+#if LOCKSTEP_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    ls->kernel = kernel_avx2;
+    ls->uniform = uniform_avx2;
+    ls->kernel_name = "AVX2";
+  }
+#endif
+  return 0;
+}
+
+void
+APEX_lockstep_free(APEX_Lockstep* ls)
+{
+  for (int d = 0; d < MEM_DIR_SIZE; ++d) {
+    APEX_LaneTable* table = ls->tables[d];
+    for (int t = 0; table && t < MEM_TABLE_SIZE; ++t) {
+      free(table->pages[t]);
+    }
+    free(table);
+  }
+  free(ls->regs);
+  free(ls->flag);
+  free(ls->pc);
+  free(ls->mask);
+  free(ls->address);
+  free(ls->executed);
+  free(ls->done);
+  memset(ls, 0, sizeof(*ls));
+}
+
+/*
+ * Preloads the data memory of one lane from a raw data image given as
+ * "FILE[@ADDRESS]", see APEX_data_image_open()
+ */
+int
+APEX_lockstep_load_image(APEX_Lockstep* ls, int lane, const char* spec)
+{
+  APEX_DataImage img;
+  if (APEX_data_image_open(&img, spec) != 0) {
+    return -1;
+  }
+  int status = 0;
+  for (int i = 0; i < img.num_words; ++i) {
+    uint32_t address = img.base + 4u * (uint32_t)i;
+    int32_t* page = lane_page_alloc(ls, address);
+    if (!page) {
+      fprintf(stderr, "APEX_Error : Out of memory loading %s\n", img.filename);
+      status = -1;
+      break;
+    }
+    page[LANE_WORD(address) * ls->stride + lane] = img.words[i];
+  }
+  APEX_data_image_close(&img);
+  return status;
+}
+
+/* LOAD into 'dst' from ls->address of the masked lanes */
+static void
+lane_load(APEX_Lockstep* ls, int32_t* dst)
+{
+  const int32_t* mask = ls->mask;
+  const int32_t* addr = ls->address;
+  int stride = ls->stride;
+  int first = 0;
+  while (!mask[first]) {
+    first++;
+  }
+  int uniform = ls->uniform(addr, addr[first], mask, stride);
+
+  if (uniform) {
+    /* One row of the page, loaded like a register */
+    uint32_t a = (uint32_t)addr[first];
+    const int32_t* page = lane_page(ls, a);
+    ls->kernel(LANE_COPY, dst, NULL, page ? page + LANE_WORD(a) * stride : NULL,
+               0, mask, NULL, stride);
+    return;
+  }
+  for (int i = first; i < stride; ++i) {
+    if (mask[i]) {
+      const int32_t* page = lane_page(ls, (uint32_t)addr[i]);
+      dst[i] = page ? page[LANE_WORD((uint32_t)addr[i]) * stride + i] : 0;
+    }
+  }
+}
+
+/* STORE 'src' to ls->address of the masked lanes, -1 when out of memory */
+static int
+lane_store(APEX_Lockstep* ls, const int32_t* src)
+{
+  const int32_t* mask = ls->mask;
+  const int32_t* addr = ls->address;
+  int stride = ls->stride;
+  int first = 0;
+  while (!mask[first]) {
+    first++;
+  }
+  int uniform = ls->uniform(addr, addr[first], mask, stride);
+
+  for (int i = first; i < stride; ++i) {
+    if (!mask[i]) {
+      continue;
+    }
+    uint32_t a = (uint32_t)addr[i];
+    int32_t* page = lane_page_alloc(ls, a);
+    if (!page) {
+      fprintf(stderr, "APEX_Error : Out of memory storing to address %d\n", (int)a);
+      return -1;
+    }
+    if (uniform) {
+      ls->kernel(LANE_COPY, page + LANE_WORD(a) * stride, NULL, src, 0, mask,
+                 NULL, stride);
+      break;
+    }
+    page[LANE_WORD(a) * stride + i] = src[i];
+  }
+  return 0;
+}
+
+/*
+ * Resolves BZ, BNZ or JUMP at 'pc' for zero flag 'z' and JUMP base
+ * 'base', returns the next pc and sets '*z' to the new zero flag
+ */
+static inline int32_t
+branch_target(const APEX_Instruction* ins, int pc, int32_t base, int32_t* z)
+{
+  int32_t t = wrap_add(ins->op == OP_JUMP ? base : pc, ins->imm);
+  if (ins->op == OP_BZ ? *z == 1 : *z != 1) {
+    *z = t == 0;
+  }
+  /* Memory redirects fetch unless the zero flag is set */
+  if (*z == 1) {
+    return pc + 4;
+  }
+  *z = t == 0;
+  return t;
+}
+
+/* Resolves BZ, BNZ or JUMP at 'pc' in the masked lanes, setting their pc */
+static void
+lane_branch(APEX_Lockstep* ls, const APEX_Instruction* ins, int pc)
+{
+  const int32_t* base = ls->regs + (ins->rs1 & 15) * ls->stride;
+  for (int i = 0; i < ls->stride; ++i) {
+    if (ls->mask[i]) {
+      ls->pc[i] = branch_target(ins, pc, base[i], &ls->flag[i]);
+    }
+  }
+}
+
+/*
+ * Writes the instruction count of the group back to its lanes, and its
+ * pc unless 'pc' is -1. Lanes that reached 'limit' stop
+ */
+static void
+end_group(APEX_Lockstep* ls, uint64_t count, int pc, uint64_t limit)
+{
+  for (int i = 0; i < ls->stride; ++i) {
+    if (!ls->mask[i]) {
+      continue;
+    }
+    ls->executed[i] += count;
+    if (pc != -1) {
+      ls->pc[i] = pc;
+    }
+    if (ls->executed[i] >= limit) {
+      ls->done[i] = 1;
+    }
+  }
+}
+
+/*
+ * Runs every lane until HALT, the last instruction of code memory, a
+ * transfer outside of code memory or 'max_instructions' (0 for no
+ * limit) instructions of its own
+ */
+int
+APEX_lockstep_run(APEX_Lockstep* ls, const APEX_CPU* cpu,
+                  uint64_t max_instructions, APEX_LockstepStats* stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  const uint64_t limit = max_instructions ? max_instructions : UINT64_MAX;
+  const int stride = ls->stride;
+  int32_t* mask = ls->mask;
+  int status = 0;
+
+  for (int i = 0; i < ls->num_lanes; ++i) {
+    if (!ls->done[i] && !in_code(cpu, ls->pc[i])) {
+      fprintf(stderr, "APEX_CPU : Instance %d, pc(%d) is outside code memory, stopping\n",
+              i, ls->pc[i]);
+      ls->done[i] = 1;
+    }
+  }
+
+  int grouped = 0;     // The lanes of 'mask' form a group at 'pc'
+  int pc = 0;
+  uint64_t count = 0;  // Instructions the group executed so far
+  uint64_t budget = 0; // Instructions before one of its lanes reaches the limit
+  int active = 0;      // Lanes in the group
+  int waiting = 0;     // Running lanes outside it
+  int join_pc = 0;     // Lowest pc of those, where they join the group
+  int first = 0;       // First lane of the group
+  for (;;) {
+    if (!grouped) {
+      /* The lanes at the lowest pc run next */
+      int running = 0;
+      pc = INT32_MAX;
+      for (int i = 0; i < stride; ++i) {
+        if (!ls->done[i]) {
+          running++;
+          if (ls->pc[i] < pc) {
+            pc = ls->pc[i];
+          }
+        }
+      }
+      if (!running) {
+        break;
+      }
+      active = 0;
+      budget = UINT64_MAX;
+      join_pc = INT32_MAX;
+      for (int i = 0; i < stride; ++i) {
+        mask[i] = !ls->done[i] && ls->pc[i] == pc ? -1 : 0;
+        if (mask[i]) {
+          active++;
+          if (limit - ls->executed[i] < budget) {
+            budget = limit - ls->executed[i];
+          }
+        }
+        else if (!ls->done[i] && ls->pc[i] < join_pc) {
+          join_pc = ls->pc[i];
+        }
+      }
+      waiting = running - active;
+      first = 0;
+      while (!mask[first]) {
+        first++;
+      }
+      count = 0;
+      grouped = 1;
+      stats->groups++;
+    }
+    if (count == budget) {
+      end_group(ls, count, pc, limit);
+      grouped = 0;
+      continue;
+    }
+
+    int index = (pc - 4000) / 4;
+    const APEX_Instruction* ins = &cpu->code_memory[index];
+    int last = index == cpu->code_memory_size - 1;
+    int32_t* rd = ls->regs + (ins->rd & 15) * stride;
+    int32_t* rs1 = ls->regs + (ins->rs1 & 15) * stride;
+    int32_t* rs2 = ls->regs + (ins->rs2 & 15) * stride;
+    stats->steps++;
+    stats->instructions += active;
+    if (waiting) {
+      stats->masked_steps++;
+    }
+
+    switch (ins->op) {
+      case OP_MOVC:
+        ls->kernel(LANE_COPY, rd, NULL, NULL, ins->imm, mask, ls->flag, stride);
+        break;
+      case OP_ADD:
+      case OP_SUB:
+      case OP_AND:
+      case OP_OR:
+      case OP_EXOR:
+      case OP_MUL:
+        ls->kernel(ins->op, rd, rs1, rs2, 0, mask, ls->flag, stride);
+        break;
+      case OP_LOAD:
+        /* The address computation sets the zero flag */
+        ls->kernel(OP_ADD, ls->address, rs1, NULL, ins->imm, mask, ls->flag, stride);
+        lane_load(ls, rd);
+        break;
+      case OP_STORE:
+        ls->kernel(OP_ADD, ls->address, rs2, NULL, ins->imm, mask, ls->flag, stride);
+        if (lane_store(ls, rs1) != 0) {
+          status = -1;
+        }
+        break;
+      case OP_HALT:
+        end_group(ls, count + 1, pc + 4, limit);
+        for (int i = 0; i < stride; ++i) {
+          ls->done[i] |= mask[i] != 0;
+        }
+        grouped = 0;
+        continue;
+      case OP_BZ:
+      case OP_BNZ:
+      case OP_JUMP:
+        if (ls->uniform(ls->flag, ls->flag[first], mask, stride)
+            && (ins->op != OP_JUMP
+                || ls->uniform(rs1, rs1[first], mask, stride))) {
+          /* Same outcome in every lane */
+          int32_t z = ls->flag[first];
+          int next = branch_target(ins, pc, rs1[first], &z);
+          ls->kernel(LANE_COPY, ls->flag, NULL, NULL, z, mask, NULL, stride);
+          if (!last && next < join_pc && in_code(cpu, next)) {
+            count++;  // Still the lowest pc, the group stays together
+            pc = next;
+            continue;
+          }
+          end_group(ls, count + 1, next, limit);
+        }
+        else {
+          end_group(ls, count + 1, -1, limit);
+          lane_branch(ls, ins, pc);
+        }
+        for (int i = 0; i < stride; ++i) {
+          if (!mask[i] || ls->done[i]) {
+            continue;
+          }
+          if (last) {
+            ls->done[i] = 1;
+          }
+          else if (!in_code(cpu, ls->pc[i])) {
+            fprintf(stderr,
+                    "APEX_CPU : Instance %d, pc(%d) is outside code memory, stopping\n",
+                    i, ls->pc[i]);
+            ls->done[i] = 1;
+          }
+        }
+        grouped = 0;
+        continue;
+      default:
+        break;  // NOP
+    }
+    count++;
+    pc += 4;
+    if (last) {
+      end_group(ls, count, pc, limit);
+      for (int i = 0; i < stride; ++i) {
+        ls->done[i] |= mask[i] != 0;
+      }
+      grouped = 0;
+    }
+    else if (pc == join_pc) {
+      end_group(ls, count, pc, limit);  // Regroup with the lanes waiting here
+      grouped = 0;
+    }
+  }
+  return status;
+}
+
+/* FNV-1a, 64 bit, of the address and value of every non zero word of a lane */
+uint64_t
+APEX_lockstep_hash(const APEX_Lockstep* ls, int lane)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (int d = 0; d < MEM_DIR_SIZE; ++d) {
+    const APEX_LaneTable* table = ls->tables[d];
+    for (int t = 0; table && t < MEM_TABLE_SIZE; ++t) {
+      const int32_t* page = table->pages[t];
+      for (int w = 0; page && w < MEM_PAGE_WORDS; ++w) {
+        int32_t v = page[w * ls->stride + lane];
+        if (!v) {
+          continue;
+        }
+        uint32_t words[2] = {
+          ((uint32_t)d << (32 - MEM_DIR_BITS)) | ((uint32_t)t << MEM_PAGE_BITS) |
+            ((uint32_t)w << 2),
+          (uint32_t)v
+        };
+        const uint8_t* bytes = (const uint8_t*)words;
+        for (size_t i = 0; i < sizeof(words); ++i) {
+          h = (h ^ bytes[i]) * 0x100000001b3ull;
+        }
+      }
+    }
+  }
+  return h;
+}
+
+/*
+ * Copies the registers, zero flag, pc, instruction count and data
+ * memory of one lane into 'cpu', to print it the way functional mode
+ * does
+ */
+int
+APEX_lockstep_extract(const APEX_Lockstep* ls, int lane, APEX_CPU* cpu)
+{
+  for (int r = 0; r < 16; ++r) {
+    cpu->regs[r] = ls->regs[r * ls->stride + lane];
+  }
+  zeroFlag = ls->flag[lane];
+  cpu->pc = ls->pc[lane];
+  cpu->ins_completed = (int)ls->executed[lane];
+
+  mem_free(&cpu->data_memory);
+  for (int d = 0; d < MEM_DIR_SIZE; ++d) {
+    const APEX_LaneTable* table = ls->tables[d];
+    for (int t = 0; table && t < MEM_TABLE_SIZE; ++t) {
+      const int32_t* page = table->pages[t];
+      for (int w = 0; page && w < MEM_PAGE_WORDS; ++w) {
+        int32_t v = page[w * ls->stride + lane];
+        uint32_t address = ((uint32_t)d << (32 - MEM_DIR_BITS)) |
+                           ((uint32_t)t << MEM_PAGE_BITS) | ((uint32_t)w << 2);
+        if (v && mem_write(&cpu->data_memory, address, v) != 0) {
+          fprintf(stderr, "APEX_Error : Out of memory copying instance %d\n", lane);
+          return -1;
+        }
+      }
+    }
+  }
+  return 0;
+}
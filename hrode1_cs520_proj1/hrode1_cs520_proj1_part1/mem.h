@@ -0,0 +1,85 @@
+#ifndef _APEX_MEM_H_
+#define _APEX_MEM_H_
+/**
+ *  mem.h
+ *  Sparse data memory covering the whole 32 bit address space
+ *
+ *  A byte address splits into a 10 bit directory index, a 10 bit table
+ *  index and a 12 bit offset into a 4 KiB page. Tables and pages are
+ *  allocated on the first store that touches them; reading an
+ *  untouched page returns 0 without allocating anything.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEM_PAGE_BITS 12
+#define MEM_TABLE_BITS 10
+#define MEM_DIR_BITS 10
+
+#define MEM_PAGE_WORDS (1 << (MEM_PAGE_BITS - 2))
+#define MEM_TABLE_SIZE (1 << MEM_TABLE_BITS)
+#define MEM_DIR_SIZE (1 << MEM_DIR_BITS)
+
+typedef struct APEX_MemPage
+{
+  int words[MEM_PAGE_WORDS];
+} APEX_MemPage;
+
+typedef struct APEX_MemTable
+{
+  APEX_MemPage* pages[MEM_TABLE_SIZE];
+} APEX_MemTable;
+
+typedef struct APEX_Memory
+{
+  APEX_MemTable* tables[MEM_DIR_SIZE];
+  size_t num_pages;  // Pages allocated so far
+} APEX_Memory;
+
+void
+mem_init(APEX_Memory* mem);
+
+void
+mem_free(APEX_Memory* mem);
+
+APEX_MemPage*
+mem_page_alloc(APEX_Memory* mem, uint32_t address);
+
+int
+mem_write_words(APEX_Memory* mem, uint32_t address, const int* words,
+                size_t count);
+
+int
+mem_copy(APEX_Memory* dst, const APEX_Memory* src);
+
+static inline const APEX_MemPage*
+mem_page(const APEX_Memory* mem, uint32_t address)
+{
+  const APEX_MemTable* table = mem->tables[address >> (32 - MEM_DIR_BITS)];
+  if (!table) {
+    return NULL;
+  }
+  return table->pages[(address >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+}
+
+/* Word at byte 'address', the low two address bits are ignored */
+static inline int
+mem_read(const APEX_Memory* mem, uint32_t address)
+{
+  const APEX_MemPage* page = mem_page(mem, address);
+  return page ? page->words[(address >> 2) & (MEM_PAGE_WORDS - 1)] : 0;
+}
+
+/* Stores a word, returns -1 if its page cannot be allocated */
+static inline int
+mem_write(APEX_Memory* mem, uint32_t address, int value)
+{
+  APEX_MemPage* page = (APEX_MemPage*)mem_page(mem, address);
+  if (!page && !(page = mem_page_alloc(mem, address))) {
+    return -1;
+  }
+  page->words[(address >> 2) & (MEM_PAGE_WORDS - 1)] = value;
+  return 0;
+}
+
+#endif
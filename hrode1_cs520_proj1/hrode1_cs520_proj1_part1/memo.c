@@ -0,0 +1,472 @@
+/*
+ *  memo.c
+ *  Pipeline simulation memoized between taken branches
+ *
+ *  Spans are found by the control state at their start together with
+ *  the branch and target that end them, in a chained hash table. The
+ *  look-ahead works on a copy of the registers and logs the data memory
+ *  words it overwrites, so it can be undone when the span has to be
+ *  simulated. Its semantics are those of functional mode (func.c).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memo.h"
+
+#define MEMO_BUCKETS (1 << 14)
+
+/* What a stage latch holds, without the values it carries */
+typedef struct MemoLatch
+{
+  int pc;
+  int op;
+  int rd;
+  int rs1;
+  int rs2;
+  int imm;
+  int busy;
+  int stalled;
+  char opcode[8];
+} MemoLatch;
+
+/* Control state of the pipeline at the end of a cycle */
+typedef struct MemoControl
+{
+  int pc;
+  int num_globals;
+  int globals[APEX_CPU_MAX_GLOBALS];
+  int regs_valid[16];
+  MemoLatch stage[NUM_STAGES];
+} MemoControl;
+
+typedef struct MemoEntry
+{
+  struct MemoEntry* next;
+  uint64_t hash;
+  MemoControl start;
+  int branch_pc;  // Taken branch ending the span
+  int target;
+  int matched;    // No operand hazard, results equal those of the look-ahead
+
+  /* Cycles and retired count of the span, control state at its end */
+  int cycles;
+  int completed;
+  int end_pc;
+  int end_globals[APEX_CPU_MAX_GLOBALS];
+  int end_regs_valid[16];
+  CPU_Stage end_stage[NUM_STAGES];
+} MemoEntry;
+
+typedef struct MemoStore
+{
+  uint32_t address;
+  int old;
+  int value;
+} MemoStore;
+
+typedef struct Lookahead
+{
+  int regs[16];
+  int flag;
+  int pc;
+  int branch_pc;
+  int target;
+  MemoStore stores[APEX_MEMO_MAX_SPAN];
+  int num_stores;
+} Lookahead;
+
+/* Taken branches, stores and operand hazards of the pipeline while it
+ * simulates a span */
+typedef struct MemoTool
+{
+  APEX_Tool tool;
+  int flushed;  // In the current cycle
+  int flushes;
+  int branch_pc;
+  int target;
+  MemoStore stores[APEX_MEMO_MAX_SPAN];
+  int num_stores;
+  int overflow;
+  int hazard;   // An instruction decoded while a writer of a source was in flight
+} MemoTool;
+
+static MemoTool memo_tool;
+static Lookahead lookahead;
+
+static void
+on_flush(void* ctx, const APEX_CPU* cpu, int pc, int target)
+{
+  MemoTool* mt = ctx;
+  (void)cpu;
+  mt->flushed = 1;
+  mt->flushes++;
+  mt->branch_pc = pc;
+  mt->target = target;
+}
+
+static int
+writes_register(const CPU_Stage* st, int reg)
+{
+  if (st->pc == 0) {
+    return 0;
+  }
+  switch (st->op) {
+    case OP_MOVC:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_AND:
+    case OP_OR:
+    case OP_EXOR:
+    case OP_MUL:
+    case OP_LOAD:
+      return st->rd == reg;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * The pipelines read stale operands in places (part1's shared valid bit,
+ * the instruction following a MUL), and a stale value may equal the right
+ * one by chance. Whether a span is replayable is therefore decided from
+ * its instructions: none may leave Decode/RF while an older writer of one
+ * of its sources is still in Execute, Memory or Writeback. The control
+ * state and path of a span fix its schedule, so this holds on every
+ * replay as it did when the span was simulated
+ */
+static void
+on_decode(void* ctx, const APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  MemoTool* mt = ctx;
+  int sources[2];
+  int num_sources = 0;
+  switch (stage->op) {
+    case OP_ADD:
+    case OP_SUB:
+    case OP_AND:
+    case OP_OR:
+    case OP_EXOR:
+    case OP_MUL:
+    case OP_STORE:
+      sources[num_sources++] = stage->rs2;
+      /* fall through */
+    case OP_LOAD:
+    case OP_JUMP:
+      sources[num_sources++] = stage->rs1;
+      break;
+    default:
+      break;
+  }
+  for (int i = 0; i < num_sources; ++i) {
+    if (writes_register(&cpu->stage[EX], sources[i]) ||
+        writes_register(&cpu->stage[MEM], sources[i]) ||
+        writes_register(&cpu->stage[WB], sources[i])) {
+      mt->hazard = 1;
+    }
+  }
+}
+
+static void
+on_memory(void* ctx, const APEX_CPU* cpu, const CPU_Stage* stage, int address,
+          int value, int is_store)
+{
+  MemoTool* mt = ctx;
+  (void)cpu;
+  (void)stage;
+  if (!is_store) {
+    return;
+  }
+  if (mt->num_stores == APEX_MEMO_MAX_SPAN) {
+    mt->overflow = 1;
+    return;
+  }
+  mt->stores[mt->num_stores].address = (uint32_t)address;
+  mt->stores[mt->num_stores].value = value;
+  mt->num_stores++;
+}
+
+/* Returns -1 while the pipeline state carries data outside the register file */
+static int
+capture(const APEX_CPU* cpu, MemoControl* c)
+{
+  memset(c, 0, sizeof(*c));
+  c->num_globals = APEX_cpu_save_globals(c->globals);
+  if (c->num_globals < 0) {
+    return -1;
+  }
+  c->pc = cpu->pc;
+  memcpy(c->regs_valid, cpu->regs_valid, sizeof(c->regs_valid));
+  for (int s = 0; s < NUM_STAGES; ++s) {
+    const CPU_Stage* st = &cpu->stage[s];
+    MemoLatch* l = &c->stage[s];
+    l->pc = st->pc;
+    l->op = st->op;
+    l->rd = st->rd;
+    l->rs1 = st->rs1;
+    l->rs2 = st->rs2;
+    l->imm = st->imm;
+    l->busy = st->busy;
+    l->stalled = st->stalled;
+    strncpy(l->opcode, st->opcode, sizeof(l->opcode) - 1);
+  }
+  return 0;
+}
+
+static uint64_t
+hash_span(const MemoControl* c, int branch_pc, int target)
+{
+  const unsigned char* p = (const unsigned char*)c;
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < sizeof(*c); ++i) {
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  }
+  h = (h ^ (uint32_t)branch_pc) * 0x100000001b3ull;
+  return (h ^ (uint32_t)target) * 0x100000001b3ull;
+}
+
+static inline int
+wrap_add(int a, int b)
+{
+  return (int)((uint32_t)a + (uint32_t)b);
+}
+
+/*
+ * Executes from 'pc' through the first taken branch on a copy of the
+ * registers. Returns 1 once it reached one, 0 on HALT, a pc outside of
+ * code memory or APEX_MEMO_MAX_SPAN instructions. Its stores are left
+ * in data memory either way
+ */
+static int
+look_ahead(APEX_CPU* cpu, int pc, Lookahead* la)
+{
+  int* r = la->regs;
+  int z = zeroFlag;
+  memcpy(r, cpu->regs, sizeof(la->regs));
+  la->num_stores = 0;
+  for (int n = 0; n < APEX_MEMO_MAX_SPAN; ++n) {
+    if (pc < 4000 || (pc - 4000) % 4 || (pc - 4000) / 4 >= cpu->code_memory_size) {
+      return 0;
+    }
+    const APEX_Instruction* ins = &cpu->code_memory[(pc - 4000) / 4];
+    int rd = ins->rd & 15;
+    int a = r[ins->rs1 & 15];
+    int b = r[ins->rs2 & 15];
+    int v;
+    int target;
+    switch (ins->op) {
+      case OP_MOVC:
+        v = r[rd] = ins->imm;
+        z = v == 0;
+        break;
+      case OP_ADD:
+        v = r[rd] = wrap_add(a, b);
+        z = v == 0;
+        break;
+      case OP_SUB:
+        v = r[rd] = (int)((uint32_t)a - (uint32_t)b);
+        z = v == 0;
+        break;
+      case OP_AND:
+        v = r[rd] = a & b;
+        z = v == 0;
+        break;
+      case OP_OR:
+        v = r[rd] = a | b;
+        z = v == 0;
+        break;
+      case OP_EXOR:
+        v = r[rd] = a ^ b;
+        z = v == 0;
+        break;
+      case OP_MUL:
+        v = r[rd] = (int)((uint32_t)a * (uint32_t)b);
+        z = v == 0;
+        break;
+      case OP_LOAD:
+        v = wrap_add(a, ins->imm);
+        r[rd] = mem_read(&cpu->data_memory, (uint32_t)v);
+        z = v == 0;
+        break;
+      case OP_STORE: {
+        MemoStore* s = &la->stores[la->num_stores++];
+        v = wrap_add(b, ins->imm);
+        s->address = (uint32_t)v;
+        s->old = mem_read(&cpu->data_memory, s->address);
+        s->value = a;
+        if (mem_write(&cpu->data_memory, s->address, a) != 0) {
+          fprintf(stderr, "APEX_Error : Out of memory storing to address %d\n", v);
+        }
+        z = v == 0;
+        break;
+      }
+      case OP_BZ:
+      case OP_BNZ:
+      case OP_JUMP:
+        /* Execute, then Memory, as resolve() in func.c */
+        target = ins->op == OP_JUMP ? wrap_add(a, ins->imm) : wrap_add(pc, ins->imm);
+        if (ins->op == OP_BZ ? z == 1 : z != 1) {
+          z = target == 0;
+        }
+        if (z != 1) {
+          la->flag = target == 0;
+          la->branch_pc = pc;
+          la->target = target;
+          la->pc = target;
+          return 1;
+        }
+        break;
+      case OP_HALT:
+        return 0;
+      default:
+        break;
+    }
+    pc += 4;
+  }
+  return 0;
+}
+
+static void
+undo_stores(APEX_CPU* cpu, const Lookahead* la)
+{
+  for (int i = la->num_stores - 1; i >= 0; --i) {
+    mem_write(&cpu->data_memory, la->stores[i].address, la->stores[i].old);
+  }
+}
+
+/* Whether the span just simulated left what the look-ahead computed */
+static int
+pipeline_matches(const APEX_CPU* cpu, const Lookahead* la)
+{
+  const MemoTool* mt = &memo_tool;
+  if (mt->flushes != 1 || mt->overflow || mt->branch_pc != la->branch_pc ||
+      mt->target != la->target || zeroFlag != la->flag ||
+      memcmp(cpu->regs, la->regs, sizeof(la->regs)) != 0 ||
+      mt->num_stores != la->num_stores) {
+    return 0;
+  }
+  for (int i = 0; i < la->num_stores; ++i) {
+    if (mt->stores[i].address != la->stores[i].address ||
+        mt->stores[i].value != la->stores[i].value) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Simulates the pipeline for 'cycles' cycles or until it stops, as
+ * 'simulate' does, replaying spans met before
+ */
+int
+APEX_memo_run(APEX_CPU* cpu, int cycles, APEX_MemoStats* stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  MemoEntry** buckets = calloc(MEMO_BUCKETS, sizeof(*buckets));
+  if (!buckets) {
+    fprintf(stderr, "APEX_Error : Out of memory for the memo table\n");
+    return -1;
+  }
+  memset(&memo_tool, 0, sizeof(memo_tool));
+  memo_tool.tool.name = "memo";
+  memo_tool.tool.ctx = &memo_tool;
+  memo_tool.tool.on_decode = on_decode;
+  memo_tool.tool.on_flush = on_flush;
+  memo_tool.tool.on_memory = on_memory;
+  if (APEX_hooks_register(cpu, &memo_tool.tool) != 0) {
+    free(buckets);
+    return -1;
+  }
+
+  /* At a boundary the branch is in Writeback and Fetch may hold its
+   * target already, the next instruction to execute is the target */
+  Lookahead* la = &lookahead;
+  int at_boundary = 0;
+  int next_pc = 0;
+  int stopped = 0;
+  while (!stopped && cpu->clock != cycles) {
+    MemoControl start;
+    int looked = at_boundary && capture(cpu, &start) == 0;
+    int keyed = looked && look_ahead(cpu, next_pc, la);
+    uint64_t hash = keyed ? hash_span(&start, la->branch_pc, la->target) : 0;
+    MemoEntry* e = NULL;
+    for (e = keyed ? buckets[hash & (MEMO_BUCKETS - 1)] : NULL; e; e = e->next) {
+      if (e->hash == hash && e->branch_pc == la->branch_pc && e->target == la->target &&
+          memcmp(&e->start, &start, sizeof(start)) == 0) {
+        break;
+      }
+    }
+
+    if (e && e->matched && (cycles <= 0 || cpu->clock + e->cycles <= cycles)) {
+      /* The look-ahead's stores are already in data memory */
+      memcpy(cpu->regs, la->regs, sizeof(la->regs));
+      memcpy(cpu->regs_valid, e->end_regs_valid, sizeof(e->end_regs_valid));
+      memcpy(cpu->stage, e->end_stage, sizeof(e->end_stage));
+      APEX_cpu_restore_globals(e->end_globals);
+      cpu->pc = e->end_pc;
+      cpu->clock += e->cycles;
+      cpu->ins_completed += e->completed;
+      next_pc = e->target;
+      stats->replayed++;
+      stats->cycles_replayed += e->cycles;
+      continue;
+    }
+    if (looked) {
+      undo_stores(cpu, la);
+    }
+
+    /* Simulate up to the end of the next cycle with a taken branch */
+    int clock = cpu->clock;
+    int completed = cpu->ins_completed;
+    memo_tool.flushes = 0;
+    memo_tool.num_stores = 0;
+    memo_tool.overflow = 0;
+    memo_tool.hazard = 0;
+    at_boundary = 0;
+    while (!at_boundary) {
+      memo_tool.flushed = 0;
+      stopped = APEX_cpu_cycle(cpu);
+      if (stopped || cpu->clock == cycles) {
+        break;
+      }
+      if (memo_tool.flushed) {
+        int globals[APEX_CPU_MAX_GLOBALS];
+        at_boundary = APEX_cpu_save_globals(globals) >= 0;
+        next_pc = memo_tool.target;
+      }
+    }
+    stats->simulated++;
+
+    if (keyed && at_boundary && !e && stats->entries < APEX_MEMO_MAX_ENTRIES) {
+      e = malloc(sizeof(*e));
+      if (!e) {
+        continue;
+      }
+      e->hash = hash;
+      e->start = start;
+      e->branch_pc = la->branch_pc;
+      e->target = la->target;
+      e->matched = !memo_tool.hazard && pipeline_matches(cpu, la);
+      e->cycles = cpu->clock - clock;
+      e->completed = cpu->ins_completed - completed;
+      e->end_pc = cpu->pc;
+      APEX_cpu_save_globals(e->end_globals);
+      memcpy(e->end_regs_valid, cpu->regs_valid, sizeof(e->end_regs_valid));
+      memcpy(e->end_stage, cpu->stage, sizeof(e->end_stage));
+      e->next = buckets[hash & (MEMO_BUCKETS - 1)];
+      buckets[hash & (MEMO_BUCKETS - 1)] = e;
+      stats->entries++;
+      stats->mismatched += !e->matched;
+    }
+  }
+
+  for (int i = 0; i < MEMO_BUCKETS; ++i) {
+    while (buckets[i]) {
+      MemoEntry* next = buckets[i]->next;
+      free(buckets[i]);
+      buckets[i] = next;
+    }
+  }
+  free(buckets);
+  return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef _APEX_MEMO_H_
+#define _APEX_MEMO_H_
+/**
+ *  memo.h
+ *  Pipeline simulation memoized between taken branches
+ *
+ *  At the end of a cycle in which a taken branch redirected fetch, every
+ *  older instruction has retired and Execute and Decode/RF hold bubbles,
+ *  so the pipeline state is control only: the pc, what each stage latch
+ *  holds and whether it is busy or stalled, the register valid bits and
+ *  the globals of cpu.c (APEX_cpu_save_globals). From such a state the
+ *  cycles up to the next taken branch depend on nothing else than the
+ *  path taken, which a functional look-ahead finds.
+ *
+ *  The first time a state and path meet, the pipeline simulates the span
+ *  and the cycles, retired count and control state at its end are kept.
+ *  Later, the look-ahead's registers and stores stand for the span and
+ *  the kept control state is restored. A span in which an instruction
+ *  decodes while an older writer of one of its sources is in flight, or
+ *  whose pipeline results differ from the look-ahead, is never replayed,
+ *  since the pipelines read stale operands in places; its state is
+ *  simulated every time.
+ */
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* Longest look-ahead, in instructions, before a span is simulated anyway */
+#define APEX_MEMO_MAX_SPAN 4096
+
+/* Most spans kept */
+#define APEX_MEMO_MAX_ENTRIES (1 << 16)
+
+typedef struct APEX_MemoStats
+{
+  uint64_t replayed;       // Spans taken from the table
+  uint64_t simulated;      // Spans the pipeline ran
+  uint64_t cycles_replayed;
+  uint64_t entries;        // Spans kept
+  uint64_t mismatched;     // Of them, with an operand hazard or other results
+} APEX_MemoStats;
+
+int
+APEX_memo_run(APEX_CPU* cpu, int cycles, APEX_MemoStats* stats);
+
+#endif
@@ -0,0 +1,387 @@
+/*
+ *  output.c
+ *  Asynchronous per cycle output, see output.h
+ *
+ *  The ring holds OUT_RING_SIZE records. The producer publishes each
+ *  record with a release store of 'head', the writer frees slots with
+ *  a release store of 'tail'; neither side takes a lock or makes a
+ *  system call. Only when the writer falls a whole ring behind does
+ *  the simulation thread yield until a slot is free, which bounds the
+ *  memory used by a long display run.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+
+#if ENABLE_ASYNC_OUTPUT
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+enum
+{
+  OUT_CYCLE,
+  OUT_STAGE,
+  OUT_TEXT
+};
+
+/* One queued line, 'text' is the stage name or a string literal */
+typedef struct OutRecord
+{
+  const char* text;
+  int32_t pc;   // Clock cycle for OUT_CYCLE
+  int32_t imm;
+  uint8_t kind;
+  uint8_t op;
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+} OutRecord;
+
+/* Longest formatted record */
+#define OUT_MAX_RECORD 256
+
+static char*
+put_str(char* out, const char* s)
+{
+  size_t len = strlen(s);
+  memcpy(out, s, len);
+  return out + len;
+}
+
+/* Copies a string literal */
+#define PUT_LIT(out, lit) (memcpy((out), (lit), sizeof(lit) - 1), (out) + sizeof(lit) - 1)
+
+static char*
+put_int(char* out, int32_t value)
+{
+  char digits[12];
+  int n = 0;
+  uint32_t v = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+  if (value < 0) {
+    *out++ = '-';
+  }
+  do {
+    digits[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v);
+  while (n) {
+    *out++ = digits[--n];
+  }
+  return out;
+}
+
+static char*
+put_reg(char* out, int reg)
+{
+  *out++ = ',';
+  *out++ = 'R';
+  return put_int(out, reg);
+}
+
+static char*
+put_imm(char* out, int32_t imm)
+{
+  *out++ = ',';
+  *out++ = '#';
+  return put_int(out, imm);
+}
+
+/* Instruction text as printed by display mode, keyed by opcode */
+static char*
+put_instruction(char* out, const OutRecord* r)
+{
+  switch (r->op) {
+    case OP_STORE:
+      out = put_reg(put_reg(PUT_LIT(out, "STORE"), r->rs1), r->rs2);
+      out = put_imm(out, r->imm);
+      return PUT_LIT(out, " ");
+    case OP_LOAD:
+      out = put_reg(put_reg(PUT_LIT(out, "LOAD"), r->rd), r->rs1);
+      out = put_imm(out, r->imm);
+      return PUT_LIT(out, " ");
+    case OP_MOVC:
+      out = put_reg(PUT_LIT(out, "MOVC"), r->rd);
+      out = put_imm(out, r->imm);
+      return PUT_LIT(out, " ");
+    case OP_ADD:
+    case OP_SUB:
+    case OP_AND:
+    case OP_OR:
+    case OP_EXOR:
+    case OP_MUL:
+      out = put_reg(put_str(out, get_opcode_name(r->op)), r->rd);
+      out = put_reg(put_reg(out, r->rs1), r->rs2);
+      return PUT_LIT(out, " ");
+    case OP_HALT:
+      return PUT_LIT(out, "HALT ");
+    case OP_BZ:
+    case OP_BNZ:
+      out = put_imm(put_str(out, get_opcode_name(r->op)), r->imm);
+      return PUT_LIT(out, " ");
+    case OP_JUMP:
+      out = put_reg(PUT_LIT(out, "JUMP"), r->rs1);
+      out = put_imm(out, r->imm);
+      return PUT_LIT(out, " ");
+    default:
+      return out;
+  }
+}
+
+/* Formats a record into 'out', returns the length */
+static size_t
+format_record(char* out, const OutRecord* r)
+{
+  char* p = out;
+  switch (r->kind) {
+    case OUT_CYCLE:
+      p = PUT_LIT(p, "--------------------------------\nClock Cycle #: ");
+      p = put_int(p, r->pc);
+      p = PUT_LIT(p, "\n--------------------------------\n");
+      break;
+    case OUT_STAGE: {
+      size_t len = strnlen(r->text, 64);
+      memcpy(p, r->text, len);
+      p += len;
+      if (len < 15) {
+        memset(p, ' ', 15 - len);
+        p += 15 - len;
+      }
+      p = PUT_LIT(p, ": pc(");
+      p = put_int(p, r->pc);
+      p = PUT_LIT(p, ") ");
+      p = put_instruction(p, r);
+      *p++ = '\n';
+      break;
+    }
+    default:
+      p = put_str(p, r->text);
+      break;
+  }
+  return p - out;
+}
+
+#if ENABLE_ASYNC_OUTPUT
+
+#define OUT_RING_SIZE (1 << 16)
+#define OUT_BUFFER_SIZE (1 << 20)
+
+static struct
+{
+  OutRecord* ring;
+  pthread_t writer;
+  int running;
+  _Atomic int done;
+
+  /* Producer and consumer indices on separate cache lines */
+  _Alignas(64) _Atomic size_t head;
+  size_t cached_tail;  // Producer's last view of 'tail'
+  _Alignas(64) _Atomic size_t tail;
+} queue;
+
+static void
+write_all(const char* buf, size_t len)
+{
+  while (len) {
+    ssize_t n = write(STDOUT_FILENO, buf, len);
+    if (n <= 0) {
+      return;  // Reader went away, drop the output
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+static void*
+writer_main(void* arg)
+{
+  char* buf = malloc(OUT_BUFFER_SIZE);
+  size_t len = 0;
+  size_t tail = atomic_load_explicit(&queue.tail, memory_order_relaxed);
+  long idle_ns = 1000;
+  (void)arg;
+
+  for (;;) {
+    size_t head = atomic_load_explicit(&queue.head, memory_order_acquire);
+    if (tail == head) {
+      /* Nothing queued, a good time to hand over what was formatted */
+      if (len) {
+        write_all(buf, len);
+        len = 0;
+      }
+      if (atomic_load_explicit(&queue.done, memory_order_acquire) &&
+          tail == atomic_load_explicit(&queue.head, memory_order_acquire)) {
+        break;
+      }
+      struct timespec ts = { 0, idle_ns };
+      nanosleep(&ts, NULL);
+      if (idle_ns < 1000000) {
+        idle_ns *= 2;
+      }
+      continue;
+    }
+
+    idle_ns = 1000;
+    while (tail != head) {
+      len += format_record(buf + len, &queue.ring[tail & (OUT_RING_SIZE - 1)]);
+      tail++;
+      if (len > OUT_BUFFER_SIZE - OUT_MAX_RECORD) {
+        write_all(buf, len);
+        len = 0;
+      }
+      if ((tail & 1023) == 0) {
+        atomic_store_explicit(&queue.tail, tail, memory_order_release);
+      }
+    }
+    atomic_store_explicit(&queue.tail, tail, memory_order_release);
+  }
+
+  free(buf);
+  return NULL;
+}
+
+static void
+push(const OutRecord* rec)
+{
+  size_t head = atomic_load_explicit(&queue.head, memory_order_relaxed);
+  while (head - queue.cached_tail == OUT_RING_SIZE) {
+    queue.cached_tail = atomic_load_explicit(&queue.tail, memory_order_acquire);
+    if (head - queue.cached_tail == OUT_RING_SIZE) {
+      sched_yield();
+    }
+  }
+  queue.ring[head & (OUT_RING_SIZE - 1)] = *rec;
+  atomic_store_explicit(&queue.head, head + 1, memory_order_release);
+}
+
+/*
+ * Starts the writer thread. Anything printed with stdio before is
+ * flushed first; if the thread cannot be started output stays
+ * synchronous
+ */
+void
+APEX_output_start(void)
+{
+  if (queue.running) {
+    return;
+  }
+  fflush(stdout);
+  queue.ring = malloc(sizeof(*queue.ring) * OUT_RING_SIZE);
+  if (!queue.ring) {
+    return;
+  }
+  atomic_store(&queue.head, 0);
+  atomic_store(&queue.tail, 0);
+  atomic_store(&queue.done, 0);
+  queue.cached_tail = 0;
+  if (pthread_create(&queue.writer, NULL, writer_main, NULL) != 0) {
+    free(queue.ring);
+    queue.ring = NULL;
+    return;
+  }
+  queue.running = 1;
+}
+
+/* Waits until everything queued is written, stdio may be used again */
+void
+APEX_output_stop(void)
+{
+  if (!queue.running) {
+    return;
+  }
+  atomic_store_explicit(&queue.done, 1, memory_order_release);
+  pthread_join(queue.writer, NULL);
+  free(queue.ring);
+  queue.ring = NULL;
+  queue.running = 0;
+}
+
+static void
+emit(const OutRecord* rec)
+{
+  if (queue.running) {
+    push(rec);
+    return;
+  }
+  char line[OUT_MAX_RECORD];
+  fwrite(line, 1, format_record(line, rec), stdout);
+}
+
+#else
+
+void
+APEX_output_start(void)
+{
+}
+
+void
+APEX_output_stop(void)
+{
+}
+
+static void
+emit(const OutRecord* rec)
+{
+  char line[OUT_MAX_RECORD];
+  fwrite(line, 1, format_record(line, rec), stdout);
+}
+
+#endif
+
+void
+APEX_output_cycle(int clock)
+{
+  OutRecord rec = { NULL, clock, 0, OUT_CYCLE, 0, 0, 0, 0 };
+  emit(&rec);
+}
+
+void
+APEX_output_stage(const char* name, const CPU_Stage* stage)
+{
+  OutRecord rec = { name,
+                    stage->pc,
+                    stage->imm,
+                    OUT_STAGE,
+                    (uint8_t)stage->op,
+                    (uint8_t)stage->rd,
+                    (uint8_t)stage->rs1,
+                    (uint8_t)stage->rs2 };
+  emit(&rec);
+}
+
+/* 'text' must stay valid until written, e.g. a string literal */
+void
+APEX_output_text(const char* text)
+{
+  OutRecord rec = { text, 0, 0, OUT_TEXT, 0, 0, 0, 0 };
+  emit(&rec);
+}
+
+static const char* stage_names[NUM_STAGES] = { "Fetch", "Decode/RF", "Execute",
+                                               "Memory", "Writeback" };
+
+const char*
+APEX_output_stage_name(int stage_id)
+{
+  if (stage_id < 0 || stage_id >= NUM_STAGES) {
+    return "";
+  }
+  return stage_names[stage_id];
+}
+
+int
+APEX_output_stage_id(const char* name)
+{
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    if (strcmp(name, stage_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
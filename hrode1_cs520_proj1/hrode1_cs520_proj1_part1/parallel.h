@@ -0,0 +1,55 @@
+#ifndef _APEX_PARALLEL_H_
+#define _APEX_PARALLEL_H_
+/**
+ *  parallel.h
+ *  Parallel-in-time detailed simulation of a whole program
+ *
+ *  A functional run counts the instructions of the program, a second
+ *  one forks a child every 'interval' instructions (region.h), so each
+ *  child starts from the architectural checkpoint of its interval. The
+ *  children simulate their intervals in the detailed pipeline at the
+ *  same time, each after up to 'warmup' unmeasured instructions of the
+ *  interval before it that refill the pipeline. The cycles of all
+ *  intervals add up to those of the program; the error is what the
+ *  warm-up leaves of the pipeline and MUL unit state at each seam.
+ *
+ *  Children are processes rather than threads, as the pipeline keeps
+ *  its state in globals of cpu.c.
+ */
+#include <stdint.h>
+
+#include "cpu.h"
+#include "region.h"
+
+/* Most intervals, each is one child process */
+#define APEX_PARALLEL_MAX_INTERVALS (1 << 16)
+
+typedef struct APEX_ParallelConfig
+{
+  uint64_t interval;  // Instructions per interval
+  uint64_t warmup;    // Detailed instructions before each interval, not measured
+  int jobs;           // Children at a time, 0 for one per CPU
+  int use_jit;        // Functional runs compile hot blocks
+} APEX_ParallelConfig;
+
+typedef struct APEX_Parallel
+{
+  APEX_ParallelConfig config;
+  uint64_t instructions;       // In the whole program
+  int num_intervals;
+  uint64_t* starts;            // First instruction of each interval
+  APEX_RegionResult* results;  // Of each interval
+  uint64_t cycles;             // Of all intervals
+  uint64_t retired;            // Measured in all intervals
+} APEX_Parallel;
+
+int
+APEX_parallel_run(APEX_Parallel* pt, APEX_CPU* cpu, const APEX_ParallelConfig* config);
+
+void
+APEX_parallel_report(const APEX_Parallel* pt);
+
+void
+APEX_parallel_free(APEX_Parallel* pt);
+
+#endif
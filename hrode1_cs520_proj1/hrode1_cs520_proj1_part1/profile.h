@@ -0,0 +1,55 @@
+#ifndef _APEX_PROFILE_H_
+#define _APEX_PROFILE_H_
+/**
+ *  profile.h
+ *  Host side self-profiling of the simulator
+ *
+ *  Build with 'make PROFILE=1' to time every pipeline stage, the parser
+ *  and the output code with the cycle counter. Sections nest, time spent
+ *  in an inner section (e.g. printing from inside a stage) is charged to
+ *  the inner section only. With profiling off the macros expand to
+ *  nothing.
+ */
+
+#ifndef ENABLE_PROFILING
+#define ENABLE_PROFILING 0
+#endif
+
+enum
+{
+  PROF_WRITEBACK,
+  PROF_MEMORY,
+  PROF_EXECUTE,
+  PROF_DECODE,
+  PROF_FETCH,
+  PROF_PARSER,
+  PROF_OUTPUT,
+  PROF_NUM_SECTIONS
+};
+
+void
+APEX_profile_begin(int section);
+
+void
+APEX_profile_end(int section);
+
+void
+APEX_profile_report(int cycles);
+
+#if ENABLE_PROFILING
+#define PROF_BEGIN(section) APEX_profile_begin(section)
+#define PROF_END(section) APEX_profile_end(section)
+#define PROF_REPORT(cycles) APEX_profile_report(cycles)
+#else
+#define PROF_BEGIN(section)                                                    \
+  do {                                                                         \
+  } while (0)
+#define PROF_END(section)                                                      \
+  do {                                                                         \
+  } while (0)
+#define PROF_REPORT(cycles)                                                    \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#endif
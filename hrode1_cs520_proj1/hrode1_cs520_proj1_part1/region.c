@@ -0,0 +1,205 @@
+/*
+ *  region.c
+ *  Detailed simulation of one region of a program
+ *
+ *  Retired instructions are counted through the Writeback hook, which
+ *  skips bubbles. At most one instruction retires per cycle, so the
+ *  region ends exactly on the cycle its last instruction retires.
+ *
+ *  Decode resolves BZ and BNZ behind the instruction in Execute that
+ *  sets the zero flag, and drops a branch that reaches it first, so a
+ *  checkpoint on a branch is stepped past it in functional mode. The
+ *  branch counts as a warm-up instruction.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "forkpool.h"
+#include "func.h"
+#include "region.h"
+
+typedef struct RetireCounter
+{
+  APEX_Tool tool;
+  uint64_t retired;
+} RetireCounter;
+
+static RetireCounter counter;
+
+static void
+count_retire(void* ctx, const APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  RetireCounter* rc = ctx;
+  (void)cpu;
+  (void)stage;
+  rc->retired++;
+}
+
+/* Runs cycles until 'target' instructions retired, returns 1 if the program ended first */
+static int
+run_until(APEX_CPU* cpu, uint64_t target)
+{
+  while (counter.retired < target) {
+    if (APEX_cpu_cycle(cpu)) {
+      return counter.retired < target;
+    }
+  }
+  return 0;
+}
+
+static int
+starts_on_branch(const APEX_CPU* cpu)
+{
+  int index = (cpu->pc - 4000) / 4;
+  if (cpu->pc < 4000 || (cpu->pc - 4000) % 4 || index >= cpu->code_memory_size) {
+    return 0;
+  }
+  return cpu->code_memory[index].op == OP_BZ || cpu->code_memory[index].op == OP_BNZ;
+}
+
+/*
+ * Simulates 'warmup' then 'length' instructions from the architectural
+ * state in 'cpu'. The region is cut short if the program ends
+ */
+void
+APEX_region_run(APEX_CPU* cpu, uint64_t warmup, uint64_t length,
+                APEX_RegionResult* result)
+{
+  memset(result, 0, sizeof(*result));
+  counter.tool.name = "region";
+  counter.tool.ctx = &counter;
+  counter.tool.on_retire = count_retire;
+  counter.retired = 0;
+  while (counter.retired < warmup + length && starts_on_branch(cpu)) {
+    APEX_FuncStats stats;
+    if (APEX_func_run(cpu, 1, 0, NULL, &stats) != 0 || stats.stopped) {
+      result->stopped = 1;
+      return;
+    }
+    counter.retired++;
+  }
+  if (APEX_hooks_register(cpu, &counter.tool) != 0) {
+    result->stopped = 1;
+    return;
+  }
+
+  int start = 0;
+  uint64_t measured_from = counter.retired;
+  if (warmup) {
+    result->stopped = run_until(cpu, warmup);
+    start = cpu->clock;
+    measured_from = counter.retired;
+  }
+  if (!result->stopped) {
+    result->stopped = run_until(cpu, warmup + length);
+  }
+  result->instructions = counter.retired - measured_from;
+  result->cycles = (uint64_t)(cpu->clock - start);
+}
+
+/* Saves the registers, zero flag, pc and data memory of 'cpu' */
+int
+APEX_checkpoint_save(APEX_Checkpoint* cp, const APEX_CPU* cpu)
+{
+  memset(cp, 0, sizeof(*cp));
+  memcpy(cp->regs, cpu->regs, sizeof(cp->regs));
+  cp->pc = cpu->pc;
+  cp->flag = zeroFlag;
+  if (mem_copy(&cp->memory, &cpu->data_memory) != 0) {
+    fprintf(stderr, "APEX_Error : Out of memory saving the data memory\n");
+    return -1;
+  }
+  return 0;
+}
+
+int
+APEX_checkpoint_restore(const APEX_Checkpoint* cp, APEX_CPU* cpu)
+{
+  memcpy(cpu->regs, cp->regs, sizeof(cp->regs));
+  cpu->pc = cp->pc;
+  zeroFlag = cp->flag;
+  mem_free(&cpu->data_memory);
+  if (mem_copy(&cpu->data_memory, &cp->memory) != 0) {
+    fprintf(stderr, "APEX_Error : Out of memory restoring the data memory\n");
+    return -1;
+  }
+  return 0;
+}
+
+void
+APEX_checkpoint_free(APEX_Checkpoint* cp)
+{
+  mem_free(&cp->memory);
+  memset(cp, 0, sizeof(*cp));
+}
+
+typedef struct RegionChild
+{
+  APEX_CPU* cpu;
+  uint64_t warmup;
+  uint64_t length;
+} RegionChild;
+
+static void
+run_child(void* arg, void* result)
+{
+  const RegionChild* child = arg;
+  APEX_region_run(child->cpu, child->warmup, child->length, result);
+}
+
+int
+APEX_region_sample(APEX_CPU* cpu, const uint64_t* starts, const uint64_t* lengths,
+                   int count, uint64_t warmup, int use_jit, int jobs,
+                   APEX_RegionResult* results, uint64_t* total)
+{
+  APEX_ForkPool pool;
+  if (APEX_forkpool_init(&pool, count, sizeof(APEX_RegionResult), jobs) != 0) {
+    return -1;
+  }
+  int status = 0;
+  uint64_t position = 0;
+  APEX_FuncStats stats;
+  stats.stopped = 0;
+  for (int i = 0; status == 0 && i < count; ++i) {
+    uint64_t from = starts[i] > warmup ? starts[i] - warmup : 0;
+    if (from > position) {
+      status = APEX_func_run(cpu, from - position, use_jit, NULL, &stats);
+      position += stats.instructions;
+      if (status == 0 && position < from) {
+        fprintf(stderr, "APEX_Error : Program ended after %llu instructions, "
+                "before the region at %llu\n", (unsigned long long)position,
+                (unsigned long long)starts[i]);
+        status = -1;
+      }
+    }
+    RegionChild child = { cpu, starts[i] - position, lengths[i] };
+    if (status == 0) {
+      status = APEX_forkpool_spawn(&pool, i, run_child, &child);
+    }
+  }
+  if (status == 0 && total) {
+    /* The rest of the program, unless the last fast-forward ended it */
+    if (!stats.stopped) {
+      status = APEX_func_run(cpu, 0, use_jit, NULL, &stats);
+      position += stats.instructions;
+    }
+    *total = position;
+  }
+  APEX_forkpool_wait(&pool);
+
+  for (int i = 0; i < count; ++i) {
+    const APEX_RegionResult* r = APEX_forkpool_result(&pool, i);
+    if (r) {
+      results[i] = *r;
+    }
+    else {
+      memset(&results[i], 0, sizeof(results[i]));
+      results[i].stopped = 1;
+      fprintf(stderr, "APEX_Error : Detailed simulation of the region at %llu failed\n",
+              (unsigned long long)starts[i]);
+      status = -1;
+    }
+  }
+  APEX_forkpool_free(&pool);
+  return status;
+}
@@ -0,0 +1,78 @@
+#ifndef _APEX_SIMPOINT_H_
+#define _APEX_SIMPOINT_H_
+/**
+ *  simpoint.h
+ *  Phase analysis and detailed simulation of representative intervals
+ *
+ *  Functional mode runs the whole program once, split into intervals of
+ *  a fixed number of instructions, and records a basic block vector for
+ *  each: the share of the interval's instructions every block executed.
+ *  The vectors are randomly projected to APEX_SIMPOINT_DIMS dimensions
+ *  and clustered with k-means for each k up to a limit, keeping the
+ *  smallest k whose BIC score comes close to the best one. A second
+ *  functional run forks a child at the start of the interval closest to
+ *  the centre of each cluster, and of a few other random members, to
+ *  simulate it in the detailed pipeline (region.h). Cluster CPIs,
+ *  weighted by the instructions of each cluster, estimate the CPI of
+ *  the whole program, with a confidence interval from the spread of the
+ *  CPIs within clusters.
+ */
+#include <stdint.h>
+
+#include "cpu.h"
+#include "region.h"
+
+/* Dimensions basic block vectors are projected to */
+#define APEX_SIMPOINT_DIMS 15
+
+typedef struct APEX_SimPointConfig
+{
+  uint64_t interval;  // Instructions per interval
+  int max_k;          // Most clusters tried
+  int samples;        // Intervals simulated per cluster, the representative included
+  uint64_t warmup;    // Detailed instructions before each interval, not measured
+  unsigned seed;
+  int jobs;           // Children at a time, 0 for one per CPU
+  int use_jit;        // Functional runs compile hot blocks
+} APEX_SimPointConfig;
+
+typedef struct APEX_SimPointPhase
+{
+  int representative;     // Interval closest to the centre
+  int num_intervals;
+  uint64_t instructions;  // In all of its intervals
+  int num_samples;        // Intervals simulated, the representative first
+  int* samples;
+  double* cpi;            // Of each sample, -1 if its simulation failed
+} APEX_SimPointPhase;
+
+typedef struct APEX_SimPoint
+{
+  APEX_SimPointConfig config;
+  int num_intervals;
+  uint64_t instructions;  // In the whole program
+  uint64_t* lengths;      // Instructions of each interval, all but the last are full
+  double* points;         // Projected vector of each interval
+  int* cluster;           // Phase of each interval
+  int k;
+  APEX_SimPointPhase* phases;
+  APEX_Checkpoint start;  // State the program started from
+} APEX_SimPoint;
+
+int
+APEX_simpoint_profile(APEX_SimPoint* sp, APEX_CPU* cpu,
+                      const APEX_SimPointConfig* config);
+
+int
+APEX_simpoint_cluster(APEX_SimPoint* sp);
+
+int
+APEX_simpoint_simulate(APEX_SimPoint* sp, APEX_CPU* cpu);
+
+void
+APEX_simpoint_report(const APEX_SimPoint* sp);
+
+void
+APEX_simpoint_free(APEX_SimPoint* sp);
+
+#endif
@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+#  timing_check.sh
+#  Checks the timing model and memo mode against the pipeline of this
+#  variant
+#
+#  Writes 'count' programs with apex_gen (default 50, seeds 1 to count,
+#  loop shapes varying with the seed), simulates each one with --record,
+#  replays its trace with the default timing parameters and runs it in
+#  memo mode. Prints the programs whose cycle counts differ, or whose
+#  final registers and data memory differ in memo mode, and exits with
+#  status 1 if any do.
+#  Further arguments are passed to apex_gen, e.g.
+#  './timing_check.sh 200 mix=alu:30,mul:30,load:20,store:10,branch:10'
+#  Run 'make' first.
+#
+
+cd "$(dirname "$0")" || exit 2
+count=${1:-50}
+[ $# -gt 0 ] && shift
+dir=$(mktemp -d) || exit 2
+trap 'rm -rf "$dir"' EXIT
+
+failed=0
+seed=1
+while [ "$seed" -le "$count" ]; do
+  ./apex_gen seed=$seed loops=$((1 + seed % 3)) body=$((10 + seed % 60)) \
+    trips=$((1 + seed % 7)) "$@" out="$dir/p.asm" 2>/dev/null || exit 2
+  ./apex_sim "$dir/p.asm" simulate 1000000 --record="$dir/p.trc" >"$dir/sim.txt" 2>/dev/null
+  pipeline=$(grep "Clock Cycle #" "$dir/sim.txt" | tail -n 1 | awk '{print $4}')
+  model=$(./apex_sim "$dir/p.trc" timing 0 2>/dev/null |
+    grep "^Cycles" | awk '{print $3}')
+  memo=$(./apex_sim "$dir/p.asm" memo 1000000 2>&1 >"$dir/memo.txt" |
+    grep "spans replayed" | awk '{print $3}')
+  if [ -z "$pipeline" ] || [ "$pipeline" != "$model" ] || [ "$pipeline" != "$memo" ]; then
+    echo "seed $seed : pipeline ${pipeline:-?} cycles, timing model ${model:-?}, memo ${memo:-?}"
+    failed=$((failed + 1))
+  else
+    sed -n '/Simulation Complete/,$p' "$dir/sim.txt" | grep -v "^Trace" >"$dir/sim.state"
+    if ! sed -n '/Simulation Complete/,$p' "$dir/memo.txt" | cmp -s - "$dir/sim.state"; then
+      echo "seed $seed : memo mode ends with other registers or data memory"
+      failed=$((failed + 1))
+    fi
+  fi
+  seed=$((seed + 1))
+done
+
+echo "$((count - failed)) of $count programs agree in the timing model and memo mode"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,71 @@
+#ifndef _APEX_TRACE_H_
+#define _APEX_TRACE_H_
+/**
+ *  trace.h
+ *  Binary trace of the committed instruction stream
+ *
+ *  File layout, all fields in host byte order:
+ *
+ *    APEX_TraceHeader                  24 bytes
+ *    APEX_TraceRecord[num_records]     12 bytes each, in commit order
+ *
+ *  Recorded by the --record tool and replayed by the timing model,
+ *  which needs no code or data memory to do so. The header keeps the
+ *  cycles the pipeline took, so a replay can be checked against it.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#define APEX_TRACE_MAGIC 0x54585041u  // "APXT"
+#define APEX_TRACE_VERSION 2
+
+/* Set in APEX_TraceRecord.op when a branch redirected fetch */
+#define APEX_TRACE_TAKEN 0x80
+#define APEX_TRACE_OP(rec) ((rec)->op & 0x7f)
+
+typedef struct APEX_TraceHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t num_records;
+  uint64_t cycles;  // Simulated by the pipeline, 0 if unknown
+} APEX_TraceHeader;
+
+typedef struct APEX_TraceRecord
+{
+  uint32_t pc;
+  uint8_t op;    // OP_* code, plus APEX_TRACE_TAKEN
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+  uint32_t addr; // LOAD/STORE address, or target of a taken branch
+} APEX_TraceRecord;
+
+/* Read only mapping of a trace file */
+typedef struct APEX_Trace
+{
+  void* map;
+  size_t map_size;
+  const APEX_TraceRecord* records;
+  uint64_t num_records;
+  uint64_t cycles;
+} APEX_Trace;
+
+struct CPU_Stage;
+
+/*
+ * Fills 'rec' for the instruction retiring from 'stage'. '*taken_pc' is
+ * the branch that last redirected fetch, to 'taken_target'; it is
+ * cleared once that branch retires
+ */
+void
+APEX_trace_fill(APEX_TraceRecord* rec, const struct CPU_Stage* stage,
+                int* taken_pc, int taken_target);
+
+int
+APEX_trace_open(APEX_Trace* trace, const char* filename);
+
+void
+APEX_trace_close(APEX_Trace* trace);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ *  apex_as.c
+ *  Converts a text APEX program into the pre-assembled object format
+ *  read by apex_sim, see object.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "object.h"
+
+int
+main(int argc, char const* argv[])
+{
+  if (argc < 3) {
+    fprintf(stderr,
+            "APEX_Help : Usage %s <input_file> <output_file> [--data=FILE[@ADDRESS]]\n"
+            "            --data  initial data memory, raw 32 bit words loaded at\n"
+            "                    byte ADDRESS (default 0)\n",
+            argv[0]);
+    exit(1);
+  }
+
+  APEX_DataImage img;
+  memset(&img, 0, sizeof(img));
+  for (int i = 3; i < argc; ++i) {
+    if (strncmp(argv[i], "--data=", 7) == 0) {
+      APEX_data_image_close(&img);
+      if (APEX_data_image_open(&img, argv[i] + 7) != 0) {
+        exit(1);
+      }
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Unknown option %s\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  int size = 0;
+  APEX_Instruction* code = create_code_memory(argv[1], &size);
+  if (!code) {
+    fprintf(stderr, "APEX_Error : Unable to read program %s\n", argv[1]);
+    APEX_data_image_close(&img);
+    exit(1);
+  }
+
+  int status = APEX_object_write(argv[2], code, size, img.words,
+                                 img.num_words, img.base);
+  free(code);
+  APEX_data_image_close(&img);
+  if (status != 0) {
+    exit(1);
+  }
+  printf("%s : %d instructions, %d data words at %u\n", argv[2], size,
+         img.num_words, img.base);
+  return 0;
+}
@@ -7,124 +7,437 @@
  *  Gaurav Kothari (gkothar1@binghamton.edu)
  *  State University of New York, Binghamton
  */
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "cpu.h"
 
+/* Opcode names, indexed by the OP_* codes in cpu.h */
+static const char* opcode_names[NUM_OPCODES] = {
+  "NOP", "MOVC", "STORE", "LOAD", "ADD", "SUB",  "AND",
+  "OR",  "EX-OR", "MUL",  "HALT", "BZ",  "BNZ", "JUMP"
+};
+
+/* Operand usage, indexed by the OP_* codes in cpu.h */
+static const int opcode_operands[NUM_OPCODES] = {
+  0,                                                  // NOP
+  WRITES_RD | WRITES_FLAG,                            // MOVC
+  READS_RS1 | READS_RS2 | WRITES_FLAG | WRITES_MEM,   // STORE
+  READS_RS1 | WRITES_RD | WRITES_FLAG | READS_MEM,    // LOAD
+  READS_RS1 | READS_RS2 | WRITES_RD | WRITES_FLAG,    // ADD
+  READS_RS1 | READS_RS2 | WRITES_RD | WRITES_FLAG,    // SUB
+  READS_RS1 | READS_RS2 | WRITES_RD | WRITES_FLAG,    // AND
+  READS_RS1 | READS_RS2 | WRITES_RD | WRITES_FLAG,    // OR
+  READS_RS1 | READS_RS2 | WRITES_RD | WRITES_FLAG,    // EX-OR
+  READS_RS1 | READS_RS2 | WRITES_RD | WRITES_FLAG,    // MUL
+  0,                                                  // HALT
+  READS_FLAG | IS_BRANCH,                             // BZ
+  READS_FLAG | IS_BRANCH,                             // BNZ
+  READS_RS1 | IS_BRANCH                               // JUMP
+};
+
 /*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
+ * Operands written after the opcode, indexed by the OP_* codes in cpu.h.
+ * 'd' is rd, 's' is rs1 and 't' is rs2 as "R<n>", 'I' is a "#<n>" literal
  */
-static int
-get_num_from_string(char* buffer)
+static const char* opcode_formats[NUM_OPCODES] = {
+  "",    // NOP
+  "dI",  // MOVC
+  "stI", // STORE
+  "dsI", // LOAD
+  "dst", // ADD
+  "dst", // SUB
+  "dst", // AND
+  "dst", // OR
+  "dst", // EX-OR
+  "dst", // MUL
+  "",    // HALT
+  "I",   // BZ
+  "I",   // BNZ
+  "sI"   // JUMP
+};
+
+/*
+ * Maps an opcode string to its OP_* code, OP_NOP when unknown
+ */
+int
+get_opcode(const char* name)
 {
-  char str[16];
-  int j = 0;
-  for (int i = 1; buffer[i] != '\0'; ++i) {
-    str[j] = buffer[i];
-    j++;
+  for (int op = 0; op < NUM_OPCODES; ++op) {
+    if (strcmp(name, opcode_names[op]) == 0) {
+      return op;
+    }
   }
-  str[j] = '\0';
-  return atoi(str);
+  return OP_NOP;
+}
+
+const char*
+get_opcode_name(int op)
+{
+  if (op < 0 || op >= NUM_OPCODES) {
+    return opcode_names[OP_NOP];
+  }
+  return opcode_names[op];
 }
 
 /*
- * This function is related to parsing input file
- *
- * Note : you can edit this function to add new instructions
+ * Registers, flag and memory an opcode reads and writes, as a mask of
+ * the READS_ and WRITES_ flags in cpu.h
  */
+int
+get_opcode_operands(int op)
+{
+  if (op < 0 || op >= NUM_OPCODES) {
+    return 0;
+  }
+  return opcode_operands[op];
+}
+
+/* A label and the address of the instruction following it */
+typedef struct Symbol
+{
+  char* name;
+  int address;
+  int line;
+} Symbol;
+
+/* Literal operand naming a label, patched once all labels are known */
+typedef struct Fixup
+{
+  char* name;
+  int index;     // Instruction holding the reference
+  int relative;  // BZ/BNZ take an offset from their own pc
+  int line;
+} Fixup;
+
+/* Parser state, the position is kept for error messages */
+typedef struct ParseState
+{
+  const char* filename;
+  int line;
+
+  Symbol* symbols;
+  int num_symbols;
+  int max_symbols;
+
+  Fixup* fixups;
+  int num_fixups;
+  int max_fixups;
+} ParseState;
+
 static void
-create_APEX_instruction(APEX_Instruction* ins, char* buffer)
+parse_error_at(const ParseState* ps, int line, const char* fmt, ...)
 {
-  char* token = strtok(buffer, ",");
-  int token_num = 0;
-  char tokens[6][128];
-  while (token != NULL) {
-    strcpy(tokens[token_num], token);
-    token_num++;
-    token = strtok(NULL, ",");
+  va_list ap;
+  fprintf(stderr, "APEX_Error : %s:%d: ", ps->filename, line);
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
+#define parse_error(ps, ...) parse_error_at((ps), (ps)->line, __VA_ARGS__)
+
+/* Grows 'array' holding 'max' elements of 'elem_size' bytes to hold one more */
+static int
+reserve_one(void** array, int count, int* max, size_t elem_size)
+{
+  if (count < *max) {
+    return 0;
+  }
+  if (*max > INT_MAX / 2) {
+    return -1;
   }
+  int grown_max = *max ? 2 * *max : 64;
+  void* grown = realloc(*array, elem_size * grown_max);
+  if (!grown) {
+    return -1;
+  }
+  *array = grown;
+  *max = grown_max;
+  return 0;
+}
 
-  strcpy(ins->opcode, tokens[0]);
+static char*
+trim(char* text)
+{
+  while (isspace((unsigned char)*text)) {
+    text++;
+  }
+  char* end = text + strlen(text);
+  while (end > text && isspace((unsigned char)end[-1])) {
+    *--end = '\0';
+  }
+  return text;
+}
 
-  if (strcmp(ins->opcode, "MOVC") == 0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->imm = get_num_from_string(tokens[2]);
+/* Labels start with a letter, '_' or '.', followed by those or digits */
+static int
+is_label_name(const char* text)
+{
+  if (!isalpha((unsigned char)*text) && *text != '_' && *text != '.') {
+    return 0;
+  }
+  for (; *text; ++text) {
+    if (!isalnum((unsigned char)*text) && *text != '_' && *text != '.') {
+      return 0;
+    }
   }
+  return 1;
+}
 
-  if (strcmp(ins->opcode, "STORE") == 0) {
-    ins->rs1 = get_num_from_string(tokens[1]);
-    ins->rs2 = get_num_from_string(tokens[2]);
-    ins->imm = get_num_from_string(tokens[3]);
+/*
+ * Splits the next comma separated field off '*cursor' in place and
+ * trims blanks around it. Returns NULL once the line is consumed
+ */
+static char*
+next_field(char** cursor)
+{
+  char* field = *cursor;
+  if (!field) {
+    return NULL;
+  }
+  char* comma = strchr(field, ',');
+  if (comma) {
+    *comma = '\0';
+    *cursor = comma + 1;
   }
+  else {
+    *cursor = NULL;
+  }
+  return trim(field);
+}
 
-  if (strcmp(ins->opcode, "LOAD") == 0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->imm = get_num_from_string(tokens[3]);
+/* Parses "<prefix><decimal>" into 'value', the whole field must match */
+static int
+parse_number(const char* field, char prefix, long* value)
+{
+  char* end;
+  if (field[0] != prefix || field[1] == '\0') {
+    return -1;
+  }
+  errno = 0;
+  *value = strtol(field + 1, &end, 10);
+  if (*end != '\0' || errno || *value < INT_MIN || *value > INT_MAX) {
+    return -1;
   }
+  return 0;
+}
 
-  if (strcmp(ins->opcode, "ADD") == 0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+static int
+add_fixup(ParseState* ps, const char* name, int index, int relative)
+{
+  if (reserve_one((void**)&ps->fixups, ps->num_fixups, &ps->max_fixups,
+                  sizeof(*ps->fixups)) != 0) {
+    return -1;
   }
+  Fixup* fixup = &ps->fixups[ps->num_fixups];
+  fixup->name = strdup(name);
+  if (!fixup->name) {
+    return -1;
+  }
+  fixup->index = index;
+  fixup->relative = relative;
+  fixup->line = ps->line;
+  ps->num_fixups++;
+  return 0;
+}
 
-  if (strcmp(ins->opcode, "SUB") == 0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+/*
+ * Splits a leading "name:" label definition off 'line'. Returns 0 and
+ * the rest of the line in '*rest', or -1 on errors
+ */
+static int
+parse_label(ParseState* ps, char* line, int address, char** rest)
+{
+  char* colon = strchr(line, ':');
+  *rest = line;
+  if (!colon) {
+    return 0;
   }
 
-  if (strcmp(ins->opcode, "AND") == 0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+  *colon = '\0';
+  char* name = trim(line);
+  if (!is_label_name(name)) {
+    parse_error(ps, "invalid label name '%s'", name);
+    return -1;
+  }
+  if (reserve_one((void**)&ps->symbols, ps->num_symbols, &ps->max_symbols,
+                  sizeof(*ps->symbols)) != 0) {
+    parse_error(ps, "out of memory");
+    return -1;
+  }
+  Symbol* symbol = &ps->symbols[ps->num_symbols];
+  symbol->name = strdup(name);
+  if (!symbol->name) {
+    parse_error(ps, "out of memory");
+    return -1;
   }
+  symbol->address = address;
+  symbol->line = ps->line;
+  ps->num_symbols++;
+  *rest = colon + 1;
+  return 0;
+}
 
-  if (strcmp(ins->opcode, "OR") == 0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+/*
+ * Parses one instruction line in place into 'ins', the 'index'th
+ * instruction of the program. Returns 1 for an instruction, 0 for a
+ * blank or label only line and -1 on errors
+ */
+static int
+parse_instruction(ParseState* ps, APEX_Instruction* ins, int index, char* line)
+{
+  char* cursor;
+  if (parse_label(ps, line, 4000 + 4 * index, &cursor) != 0) {
+    return -1;
+  }
+  char* name = next_field(&cursor);
+  if (!*name && !cursor) {
+    return 0;
   }
 
-  if (strcmp(ins->opcode, "EX-OR") == 0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+  /* Unused operand fields are zero, so assembled records are stable */
+  memset(ins, 0, sizeof(*ins));
+  int op = get_opcode(name);
+  if (op == OP_NOP && strcmp(name, "NOP") != 0) {
+    parse_error(ps, "unknown opcode '%s'", name);
+    return -1;
   }
+  ins->op = (uint8_t)op;
 
-  if (strcmp(ins->opcode, "MUL") == 0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+  int count = 0;
+  for (const char* f = opcode_formats[op]; *f; ++f) {
+    char* field = next_field(&cursor);
+    long value;
+    count++;
+    if (!field || !*field) {
+      parse_error(ps, "%s expects %d operands, operand %d is missing",
+                  name, (int)strlen(opcode_formats[op]), count);
+      return -1;
+    }
+    if (*f == 'I') {
+      if (is_label_name(field)) {
+        if (add_fixup(ps, field, index, op == OP_BZ || op == OP_BNZ) != 0) {
+          parse_error(ps, "out of memory");
+          return -1;
+        }
+        continue;
+      }
+      if (parse_number(field, '#', &value) != 0) {
+        parse_error(ps, "operand %d of %s must be a literal like #10 or a label, got '%s'",
+                    count, name, field);
+        return -1;
+      }
+      ins->imm = (int)value;
+      continue;
+    }
+    if (parse_number(field, 'R', &value) != 0 || value < 0 || value > 15) {
+      parse_error(ps, "operand %d of %s must be a register R0-R15, got '%s'",
+                  count, name, field);
+      return -1;
+    }
+    if (*f == 'd') {
+      ins->rd = (uint8_t)value;
+    }
+    else if (*f == 's') {
+      ins->rs1 = (uint8_t)value;
+    }
+    else {
+      ins->rs2 = (uint8_t)value;
+    }
   }
 
-  if (strcmp(ins->opcode, "HALT") == 0) {
+  if (cursor) {
+    parse_error(ps, "too many operands for %s", name);
+    return -1;
+  }
+  return 1;
+}
+
+/* Orders labels by name, definitions of the same name by line */
+static int
+by_name(const void* a, const void* b)
+{
+  const Symbol* x = a;
+  const Symbol* y = b;
+  int order = strcmp(x->name, y->name);
+  return order ? order : x->line - y->line;
+}
+
+static int
+by_name_only(const void* a, const void* b)
+{
+  return strcmp(((const Symbol*)a)->name, ((const Symbol*)b)->name);
+}
+
+/*
+ * Patches label references into the literal fields. BZ/BNZ get the
+ * offset from their own pc, other instructions the absolute address
+ */
+static int
+resolve_labels(ParseState* ps, APEX_Instruction* code_memory)
+{
+  int failed = 0;
+  if (!ps->num_symbols && !ps->num_fixups) {
+    return 0;
+  }
+  if (ps->num_symbols) {
+    qsort(ps->symbols, ps->num_symbols, sizeof(*ps->symbols), by_name);
+  }
+  for (int i = 1; i < ps->num_symbols; ++i) {
+    if (strcmp(ps->symbols[i].name, ps->symbols[i - 1].name) == 0) {
+      parse_error_at(ps, ps->symbols[i].line,
+                     "label '%s' already defined on line %d",
+                     ps->symbols[i].name, ps->symbols[i - 1].line);
+      failed = 1;
+    }
   }
 
-  if (strcmp(ins->opcode, "BZ") == 0) {
-    ins->imm = get_num_from_string(tokens[1]);
+  for (int i = 0; i < ps->num_fixups; ++i) {
+    Fixup* fixup = &ps->fixups[i];
+    Symbol key = { fixup->name, 0, 0 };
+    Symbol* symbol = NULL;
+    if (ps->num_symbols) {
+      symbol = bsearch(&key, ps->symbols, ps->num_symbols,
+                       sizeof(*ps->symbols), by_name_only);
+    }
+    if (!symbol) {
+      parse_error_at(ps, fixup->line, "undefined label '%s'", fixup->name);
+      failed = 1;
+      continue;
+    }
+    int pc = 4000 + 4 * fixup->index;
+    code_memory[fixup->index].imm =
+      fixup->relative ? symbol->address - pc : symbol->address;
   }
+  return failed ? -1 : 0;
+}
 
-  if (strcmp(ins->opcode, "BNZ") == 0) {
-    ins->imm = get_num_from_string(tokens[1]);
+static void
+free_parse_state(ParseState* ps)
+{
+  for (int i = 0; i < ps->num_symbols; ++i) {
+    free(ps->symbols[i].name);
   }
-  
-  if (strcmp(ins->opcode, "JUMP") == 0) {
-    ins->rs1 = get_num_from_string(tokens[1]);
-    ins->imm = get_num_from_string(tokens[2]);
+  for (int i = 0; i < ps->num_fixups; ++i) {
+    free(ps->fixups[i].name);
   }
-  
+  free(ps->symbols);
+  free(ps->fixups);
 }
 
 /*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
+ * Parses the program in a single pass, 'filename' may be "-" for
+ * standard input so programs can be piped in. Code memory grows
+ * geometrically as instructions are read and label references are
+ * patched at the end. Returns NULL on errors, which are reported with
+ * their line number
  */
 APEX_Instruction*
 create_code_memory(const char* filename, int* size)
@@ -133,40 +446,58 @@ create_code_memory(const char* filename, int* size)
     return NULL;
   }
 
-  FILE* fp = fopen(filename, "r");
+  int from_stdin = strcmp(filename, "-") == 0;
+  FILE* fp = from_stdin ? stdin : fopen(filename, "r");
   if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to open %s\n", filename);
     return NULL;
   }
 
+  ParseState ps;
+  memset(&ps, 0, sizeof(ps));
+  ps.filename = from_stdin ? "<stdin>" : filename;
+  APEX_Instruction* code_memory = NULL;
+  int code_memory_size = 0;
+  int capacity = 0;
+  int failed = 0;
   char* line = NULL;
   size_t len = 0;
-  ssize_t nread;
-  int code_memory_size = 0;
 
-  while ((nread = getline(&line, &len, fp)) != -1) {
-    code_memory_size++;
-  }
-  *size = code_memory_size;
-  if (!code_memory_size) {
-    fclose(fp);
-    return NULL;
+  while (getline(&line, &len, fp) != -1) {
+    ps.line++;
+    if (reserve_one((void**)&code_memory, code_memory_size, &capacity,
+                    sizeof(*code_memory)) != 0) {
+      parse_error(&ps, "out of memory");
+      failed = 1;
+      break;
+    }
+
+    int status =
+      parse_instruction(&ps, &code_memory[code_memory_size], code_memory_size, line);
+    if (status < 0) {
+      failed = 1;
+      break;
+    }
+    code_memory_size += status;
   }
 
-  APEX_Instruction* code_memory =
-    malloc(sizeof(*code_memory) * code_memory_size);
-  if (!code_memory) {
+  if (!failed && ferror(fp)) {
+    fprintf(stderr, "APEX_Error : Error reading %s\n", ps.filename);
+    failed = 1;
+  }
+  if (!failed && resolve_labels(&ps, code_memory) != 0) {
+    failed = 1;
+  }
+  free_parse_state(&ps);
+  free(line);
+  if (!from_stdin) {
     fclose(fp);
-    return NULL;
   }
 
-  rewind(fp);
-  int current_instruction = 0;
-  while ((nread = getline(&line, &len, fp)) != -1) {
-    create_APEX_instruction(&code_memory[current_instruction], line);
-    current_instruction++;
+  *size = failed ? 0 : code_memory_size;
+  if (failed || !code_memory_size) {
+    free(code_memory);
+    return NULL;
   }
-
-  free(line);
-  fclose(fp);
   return code_memory;
 }
@@ -0,0 +1,161 @@
+/*
+ *  forkpool.c
+ *  Child processes forked from the simulator, reporting over pipes
+ *
+ *  Everything the simulator keeps, the APEX_CPU, its data memory and
+ *  the stage state cpu.c holds in globals, lives in the address space
+ *  of the process, so fork() is the whole snapshot. stdio is flushed
+ *  before forking and children leave with _exit(), so nothing buffered
+ *  is written twice. A result fits in PIPE_BUF, so a child never waits
+ *  for the parent to read it.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "forkpool.h"
+
+/*
+ * Prepares a pool of 'count' children with 'result_size' byte results.
+ * 'jobs' of 0 or less runs one child per online CPU at a time
+ */
+int
+APEX_forkpool_init(APEX_ForkPool* pool, int count, size_t result_size, int jobs)
+{
+  memset(pool, 0, sizeof(*pool));
+  if (result_size > PIPE_BUF) {
+    fprintf(stderr, "APEX_Error : Child results are limited to %d bytes\n", PIPE_BUF);
+    return -1;
+  }
+  if (jobs <= 0) {
+    jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  pool->count = count;
+  pool->jobs = jobs > 0 ? jobs : 1;
+  pool->result_size = result_size;
+  pool->pids = calloc(count ? count : 1, sizeof(*pool->pids));
+  pool->fds = calloc(count ? count : 1, sizeof(*pool->fds));
+  pool->ok = calloc(count ? count : 1, sizeof(*pool->ok));
+  pool->results = calloc(count ? count : 1, result_size);
+  if (!pool->pids || !pool->fds || !pool->ok || !pool->results) {
+    fprintf(stderr, "APEX_Error : Out of memory for %d child processes\n", count);
+    APEX_forkpool_free(pool);
+    return -1;
+  }
+  return 0;
+}
+
+/* Waits for any remaining children, then frees the pool */
+void
+APEX_forkpool_free(APEX_ForkPool* pool)
+{
+  if (pool->running) {
+    APEX_forkpool_wait(pool);
+  }
+  free(pool->pids);
+  free(pool->fds);
+  free(pool->ok);
+  free(pool->results);
+  memset(pool, 0, sizeof(*pool));
+}
+
+/* Waits for one child and reads its result, returns -1 if none is running */
+static int
+collect_one(APEX_ForkPool* pool)
+{
+  int wstatus;
+  pid_t pid;
+  do {
+    pid = wait(&wstatus);
+  } while (pid < 0 && errno == EINTR);
+  if (pid < 0) {
+    pool->running = 0;
+    return -1;
+  }
+  for (int i = 0; i < pool->count; ++i) {
+    if (pool->pids[i] != pid) {
+      continue;
+    }
+    char* result = pool->results + (size_t)i * pool->result_size;
+    ssize_t got;
+    do {
+      got = read(pool->fds[i], result, pool->result_size);
+    } while (got < 0 && errno == EINTR);
+    pool->ok[i] = got == (ssize_t)pool->result_size && WIFEXITED(wstatus) &&
+                  WEXITSTATUS(wstatus) == 0;
+    close(pool->fds[i]);
+    pool->pids[i] = 0;
+    pool->running--;
+    break;
+  }
+  return 0;
+}
+
+/*
+ * Forks child 'index' to run body(arg, result). The child sees the
+ * process as it is now; 'arg' is only read by the child
+ */
+int
+APEX_forkpool_spawn(APEX_ForkPool* pool, int index, APEX_ForkBody body, void* arg)
+{
+  while (pool->running >= pool->jobs) {
+    if (collect_one(pool) != 0) {
+      break;
+    }
+  }
+  int p[2];
+  if (pipe(p) != 0) {
+    fprintf(stderr, "APEX_Error : Unable to create a pipe for child %d\n", index);
+    return -1;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    char result[PIPE_BUF];
+    memset(result, 0, pool->result_size);
+    close(p[0]);
+    body(arg, result);
+    ssize_t put = write(p[1], result, pool->result_size);
+    fflush(stderr);
+    _exit(put == (ssize_t)pool->result_size ? 0 : 1);
+  }
+  close(p[1]);
+  if (pid < 0) {
+    fprintf(stderr, "APEX_Error : Unable to fork child %d\n", index);
+    close(p[0]);
+    return -1;
+  }
+  pool->pids[index] = pid;
+  pool->fds[index] = p[0];
+  pool->running++;
+  return 0;
+}
+
+/* Waits for every running child, returns -1 if any child failed */
+int
+APEX_forkpool_wait(APEX_ForkPool* pool)
+{
+  while (pool->running > 0) {
+    if (collect_one(pool) != 0) {
+      break;
+    }
+  }
+  for (int i = 0; i < pool->count; ++i) {
+    if (pool->pids[i] || !pool->ok[i]) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Result of child 'index', NULL if it failed or was never forked */
+const void*
+APEX_forkpool_result(const APEX_ForkPool* pool, int index)
+{
+  return pool->ok[index] ? pool->results + (size_t)index * pool->result_size : NULL;
+}
@@ -0,0 +1,538 @@
+/*
+ *  func.c
+ *  Functional execution with a basic block translation cache
+ *
+ *  A block is translated on first use from code memory: its body holds
+ *  one micro-op per instruction up to the first BZ, BNZ, JUMP or HALT,
+ *  which becomes the terminator. Blocks are found by start pc in an
+ *  open addressing hash table and remember the block each exit led to
+ *  last, so a loop runs block to block without looking anything up.
+ *
+ *  Branches follow the pipelines: BZ/BNZ/JUMP compute their target
+ *  through the ALU in Execute when the zero flag allows it, and again
+ *  in Memory, where the zero flag decides whether fetch is redirected.
+ *  The target computation overwrites the zero flag both times.
+ *
+ *  Micro-ops are direct threaded: each one holds the address of its
+ *  handler, and every handler ends by jumping to the handler of the
+ *  next micro-op (GCC computed goto), so each of them has an indirect
+ *  branch of its own for the host to predict. Block terminators are
+ *  micro-ops too. Without computed goto, or built with
+ *  ENABLE_THREADED_DISPATCH=0, the same handlers are cases of a switch.
+ *
+ *  With the JIT enabled, a body interpreted APEX_JIT_THRESHOLD times is
+ *  compiled to native code (jit.c); terminators and chaining stay here.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "func.h"
+#include "jit.h"
+
+enum
+{
+  TERM_NEXT,  // Falls through into the next block
+  TERM_BZ,
+  TERM_BNZ,
+  TERM_JUMP,
+  TERM_HALT
+};
+
+/* Terminator of a block that falls through into the next one */
+#define FUNC_OP_NEXT NUM_OPCODES
+#define NUM_FUNC_OPS (NUM_OPCODES + 1)
+
+typedef struct FuncOp
+{
+  const void* handler;  // Handler address, NULL with switch dispatch
+  uint8_t op;           // OP_* code, or FUNC_OP_NEXT
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+  int32_t imm;          // Literal, absolute target of BZ/BNZ
+} FuncOp;
+
+typedef struct FuncBlock
+{
+  int pc;           // Address of the first instruction
+  int num_ops;      // Instructions in the body
+  int term;         // TERM_* ending the block, one more instruction unless TERM_NEXT
+  int term_pc;      // Address of the terminator, or of the next block
+  int stops;        // Holds the last instruction of code memory
+  uint32_t runs;    // Times the body was interpreted
+  APEX_JitBlock code;         // Compiled body, NULL while interpreted
+  struct FuncBlock* next[2];  // Last block reached by falling through / branching
+  FuncOp ops[];               // Body, then the terminator
+} FuncBlock;
+
+/* Architectural state the micro-op handlers work on */
+typedef struct FuncState
+{
+  int* regs;
+  APEX_Memory* mem;
+  int flag;    // Zero flag
+  int target;  // Target of the last taken branch
+  int status;  // -1 once a STORE could not allocate memory
+} FuncState;
+
+/* Handler addresses by micro-op code, set by run_ops(NULL, NULL) */
+static const void* const* func_handlers;
+
+typedef struct FuncCache
+{
+  FuncBlock** slots;
+  size_t num_slots;   // Power of 2
+  size_t num_blocks;
+} FuncCache;
+
+static size_t
+hash_pc(int pc)
+{
+  return (size_t)(((uint32_t)pc >> 2) * 0x9e3779b1u);
+}
+
+static FuncBlock*
+cache_find(const FuncCache* cache, int pc)
+{
+  size_t mask = cache->num_slots - 1;
+  for (size_t i = hash_pc(pc) & mask;; i = (i + 1) & mask) {
+    FuncBlock* b = cache->slots[i];
+    if (!b || b->pc == pc) {
+      return b;
+    }
+  }
+}
+
+static int
+cache_insert(FuncCache* cache, FuncBlock* block)
+{
+  if ((cache->num_blocks + 1) * 2 > cache->num_slots) {
+    size_t num_slots = cache->num_slots * 2;
+    FuncBlock** slots = calloc(num_slots, sizeof(*slots));
+    if (!slots) {
+      return -1;
+    }
+    for (size_t i = 0; i < cache->num_slots; ++i) {
+      FuncBlock* b = cache->slots[i];
+      if (b) {
+        size_t j = hash_pc(b->pc) & (num_slots - 1);
+        while (slots[j]) {
+          j = (j + 1) & (num_slots - 1);
+        }
+        slots[j] = b;
+      }
+    }
+    free(cache->slots);
+    cache->slots = slots;
+    cache->num_slots = num_slots;
+  }
+  size_t mask = cache->num_slots - 1;
+  size_t i = hash_pc(block->pc) & mask;
+  while (cache->slots[i]) {
+    i = (i + 1) & mask;
+  }
+  cache->slots[i] = block;
+  cache->num_blocks++;
+  return 0;
+}
+
+static void
+cache_free(FuncCache* cache)
+{
+  for (size_t i = 0; i < cache->num_slots; ++i) {
+    free(cache->slots[i]);
+  }
+  free(cache->slots);
+  memset(cache, 0, sizeof(*cache));
+}
+
+static int
+in_code(const APEX_CPU* cpu, int pc)
+{
+  return pc >= 4000 && (pc - 4000) % 4 == 0 &&
+         (pc - 4000) / 4 < cpu->code_memory_size;
+}
+
+static void
+set_op(FuncOp* op, const APEX_Instruction* ins, int code)
+{
+  op->op = code;
+  op->handler = func_handlers ? func_handlers[code] : NULL;
+  op->rd = ins->rd & 15;
+  op->rs1 = ins->rs1 & 15;
+  op->rs2 = ins->rs2 & 15;
+  op->imm = ins->imm;
+}
+
+/* Translates the block starting at 'pc', which must be in code memory */
+static FuncBlock*
+translate(const APEX_CPU* cpu, int pc)
+{
+  int first = (pc - 4000) / 4;
+  int avail = cpu->code_memory_size - first;
+  int max_ops = avail < APEX_FUNC_MAX_BLOCK ? avail : APEX_FUNC_MAX_BLOCK;
+  FuncBlock* b = malloc(sizeof(*b) + sizeof(FuncOp) * (max_ops + 1));
+  if (!b) {
+    return NULL;
+  }
+  memset(b, 0, sizeof(*b));
+  b->pc = pc;
+  b->term = TERM_NEXT;
+
+  int n = 0;
+  while (n < max_ops) {
+    const APEX_Instruction* ins = &cpu->code_memory[first + n];
+    if (ins->op == OP_BZ || ins->op == OP_BNZ || ins->op == OP_JUMP ||
+        ins->op == OP_HALT) {
+      b->term = ins->op == OP_BZ    ? TERM_BZ
+                : ins->op == OP_BNZ ? TERM_BNZ
+                : ins->op == OP_JUMP ? TERM_JUMP
+                                     : TERM_HALT;
+      set_op(&b->ops[n], ins, ins->op);
+      if (ins->op != OP_JUMP) {
+        b->ops[n].imm = (int)((uint32_t)pc + 4u * n + (uint32_t)ins->imm);
+      }
+      break;
+    }
+    set_op(&b->ops[n], ins, ins->op < NUM_OPCODES ? ins->op : OP_NOP);
+    n++;
+  }
+  if (b->term == TERM_NEXT) {
+    const APEX_Instruction none = { 0 };
+    set_op(&b->ops[n], &none, FUNC_OP_NEXT);
+  }
+  b->num_ops = n;
+  b->term_pc = pc + 4 * n;
+  int last = first + n - (b->term == TERM_NEXT ? 1 : 0);
+  b->stops = last == cpu->code_memory_size - 1;
+  return b;
+}
+
+/* Cached block at 'pc', translated on first use. NULL when out of memory */
+static FuncBlock*
+get_block(FuncCache* cache, const APEX_CPU* cpu, int pc, APEX_FuncStats* stats)
+{
+  FuncBlock* b = cache_find(cache, pc);
+  if (b) {
+    return b;
+  }
+  b = translate(cpu, pc);
+  if (!b || cache_insert(cache, b) != 0) {
+    free(b);
+    fprintf(stderr, "APEX_Error : Out of memory translating pc(%d)\n", pc);
+    return NULL;
+  }
+  stats->blocks++;
+  return b;
+}
+
+static inline int
+wrap_add(int a, int b)
+{
+  return (int)((uint32_t)a + (uint32_t)b);
+}
+
+/*
+ * Resolves terminator 'op' with operation code 'code' and zero flag
+ * 'z'. Returns 1 if a branch is taken, leaving its target in st->target
+ */
+static inline int
+resolve(const FuncOp* op, int code, int z, FuncState* st)
+{
+  int target;
+  switch (code) {
+    case OP_BZ:
+      target = op->imm;
+      if (z == 1) {
+        z = target == 0;
+      }
+      break;
+    case OP_BNZ:
+      target = op->imm;
+      if (z != 1) {
+        z = target == 0;
+      }
+      break;
+    case OP_JUMP:
+      target = wrap_add(st->regs[op->rs1], op->imm);
+      if (z != 1) {
+        z = target == 0;
+      }
+      break;
+    default:
+      st->flag = z;  // HALT or FUNC_OP_NEXT
+      return 0;
+  }
+  /* Memory redirects fetch unless the zero flag is set */
+  if (z == 1) {
+    st->flag = z;
+    return 0;
+  }
+  st->flag = target == 0;
+  st->target = target;
+  return 1;
+}
+
+/*
+ * Executes micro-ops from 'op' through the terminator of its block.
+ * Returns 1 if a branch is taken, leaving its target in st->target.
+ * Called with 'op' NULL, sets func_handlers and returns
+ */
+static int
+run_ops(const FuncOp* op, FuncState* st)
+{
+#if ENABLE_THREADED_DISPATCH
+  static const void* const handlers[NUM_FUNC_OPS] = {
+    [OP_NOP] = &&do_OP_NOP,     [OP_MOVC] = &&do_OP_MOVC,
+    [OP_STORE] = &&do_OP_STORE, [OP_LOAD] = &&do_OP_LOAD,
+    [OP_ADD] = &&do_OP_ADD,     [OP_SUB] = &&do_OP_SUB,
+    [OP_AND] = &&do_OP_AND,     [OP_OR] = &&do_OP_OR,
+    [OP_EXOR] = &&do_OP_EXOR,   [OP_MUL] = &&do_OP_MUL,
+    [OP_HALT] = &&do_OP_HALT,   [OP_BZ] = &&do_OP_BZ,
+    [OP_BNZ] = &&do_OP_BNZ,     [OP_JUMP] = &&do_OP_JUMP,
+    [FUNC_OP_NEXT] = &&do_FUNC_OP_NEXT,
+  };
+#endif
+  if (!op) {
+#if ENABLE_THREADED_DISPATCH
+    func_handlers = handlers;
+#endif
+    return 0;
+  }
+
+  int* regs = st->regs;
+  int z = st->flag;
+  int r;
+
+#if ENABLE_THREADED_DISPATCH
+#define HANDLER(code) do_##code
+#define NEXT() goto *(++op)->handler
+  goto *op->handler;
+#else
+#define HANDLER(code) case code
+#define NEXT() ++op; continue
+  for (;;) {
+    switch (op->op) {
+#endif
+
+  HANDLER(OP_NOP):
+    NEXT();  // Leaves the zero flag alone
+  HANDLER(OP_MOVC):
+    r = op->imm;
+    regs[op->rd] = r;
+    z = r == 0;
+    NEXT();
+  HANDLER(OP_ADD):
+    r = wrap_add(regs[op->rs1], regs[op->rs2]);
+    regs[op->rd] = r;
+    z = r == 0;
+    NEXT();
+  HANDLER(OP_SUB):
+    r = (int)((uint32_t)regs[op->rs1] - (uint32_t)regs[op->rs2]);
+    regs[op->rd] = r;
+    z = r == 0;
+    NEXT();
+  HANDLER(OP_AND):
+    r = regs[op->rs1] & regs[op->rs2];
+    regs[op->rd] = r;
+    z = r == 0;
+    NEXT();
+  HANDLER(OP_OR):
+    r = regs[op->rs1] | regs[op->rs2];
+    regs[op->rd] = r;
+    z = r == 0;
+    NEXT();
+  HANDLER(OP_EXOR):
+    r = regs[op->rs1] ^ regs[op->rs2];
+    regs[op->rd] = r;
+    z = r == 0;
+    NEXT();
+  HANDLER(OP_MUL):
+    r = (int)((uint32_t)regs[op->rs1] * (uint32_t)regs[op->rs2]);
+    regs[op->rd] = r;
+    z = r == 0;
+    NEXT();
+  HANDLER(OP_LOAD):
+    /* The address computation sets the zero flag */
+    r = wrap_add(regs[op->rs1], op->imm);
+    regs[op->rd] = mem_read(st->mem, (uint32_t)r);
+    z = r == 0;
+    NEXT();
+  HANDLER(OP_STORE):
+    r = wrap_add(regs[op->rs2], op->imm);
+    if (mem_write(st->mem, (uint32_t)r, regs[op->rs1]) != 0) {
+      fprintf(stderr, "APEX_Error : Out of memory storing to address %d\n", r);
+      st->status = -1;
+    }
+    z = r == 0;
+    NEXT();
+
+  /* Terminators */
+  HANDLER(OP_BZ):
+    return resolve(op, OP_BZ, z, st);
+  HANDLER(OP_BNZ):
+    return resolve(op, OP_BNZ, z, st);
+  HANDLER(OP_JUMP):
+    return resolve(op, OP_JUMP, z, st);
+  HANDLER(OP_HALT):
+  HANDLER(FUNC_OP_NEXT):
+    st->flag = z;
+    return 0;
+
+#if !ENABLE_THREADED_DISPATCH
+    }
+  }
+#endif
+#undef HANDLER
+#undef NEXT
+}
+
+/*
+ * Runs block 'b' and returns 1 if its branch is taken. A body
+ * interpreted often enough is compiled if 'jit' is not NULL
+ */
+static int
+run_block(FuncBlock* b, APEX_Jit* jit, const APEX_CPU* cpu, FuncState* st)
+{
+  if (b->code) {
+    if (b->code(st->regs, st->mem, &st->flag) != 0) {
+      st->status = -1;
+    }
+    const FuncOp* term = &b->ops[b->num_ops];
+    return resolve(term, term->op, st->flag, st);
+  }
+  if (jit && b->num_ops > 0 && ++b->runs == APEX_JIT_THRESHOLD) {
+    b->code = APEX_jit_compile(jit, &cpu->code_memory[(b->pc - 4000) / 4],
+                               b->num_ops);
+  }
+  return run_ops(b->ops, st);
+}
+
+/* Adds 'count' instructions of the block at 'pc' to 'profile' */
+static inline void
+profile_add(APEX_FuncProfile* profile, int pc, int count)
+{
+  int index = (pc - 4000) / 4;
+  if (!profile->counts[index]) {
+    profile->touched[profile->num_touched++] = index;
+  }
+  profile->counts[index] += (uint64_t)count;
+}
+
+/*
+ * Runs the program from cpu->pc until HALT, the last instruction of
+ * code memory, a transfer outside of code memory or 'max_instructions'
+ * (0 for no limit), compiling hot blocks if 'use_jit' is set and
+ * counting the instructions of each block in 'profile' unless it is
+ * NULL. Registers, data memory, pc and zero flag are left in 'cpu', so
+ * a run stopped by the limit can be continued by another call
+ */
+int
+APEX_func_run(APEX_CPU* cpu, uint64_t max_instructions, int use_jit,
+              APEX_FuncProfile* profile, APEX_FuncStats* stats)
+{
+  FuncCache cache;
+  cache.num_slots = 1024;
+  cache.num_blocks = 0;
+  cache.slots = calloc(cache.num_slots, sizeof(*cache.slots));
+  memset(stats, 0, sizeof(*stats));
+  if (!cache.slots) {
+    return -1;
+  }
+
+  FuncState st;
+  st.regs = cpu->regs;
+  st.mem = &cpu->data_memory;
+  st.flag = zeroFlag;
+  st.target = 0;
+  st.status = 0;
+  run_ops(NULL, NULL);
+  uint64_t executed = 0;
+  int status = 0;
+  int pc = cpu->pc;
+  FuncBlock* b = NULL;
+  APEX_Jit jit_state;
+  APEX_Jit* jit = NULL;
+  if (use_jit) {
+    if (APEX_jit_init(&jit_state) == 0) {
+      jit = &jit_state;
+    }
+    else {
+      fprintf(stderr, "APEX_CPU : Running without the JIT\n");
+    }
+  }
+  stats->stopped = 1;
+  if (!in_code(cpu, pc)) {
+    fprintf(stderr, "APEX_CPU : pc(%d) is outside code memory, stopping\n", pc);
+  }
+  else if (!(b = get_block(&cache, cpu, pc, stats))) {
+    status = -1;
+  }
+
+  while (b) {
+    int len = b->num_ops + (b->term != TERM_NEXT);
+    if (max_instructions && max_instructions - executed < (uint64_t)len) {
+      /* The limit falls inside the body, the terminator is not reached */
+      int count = (int)(max_instructions - executed);
+      FuncOp ops[APEX_FUNC_MAX_BLOCK + 1];
+      const APEX_Instruction none = { 0 };
+      memcpy(ops, b->ops, sizeof(*ops) * count);
+      set_op(&ops[count], &none, FUNC_OP_NEXT);
+      run_ops(ops, &st);
+      if (profile && count > 0) {
+        profile_add(profile, b->pc, count);
+      }
+      executed += count;
+      pc = b->pc + 4 * count;
+      stats->stopped = 0;
+      break;
+    }
+    int taken = run_block(b, jit, cpu, &st);
+    if (profile) {
+      profile_add(profile, b->pc, len);
+    }
+    executed += len;
+    if (b->term == TERM_HALT) {
+      pc = b->term_pc + 4;
+      break;
+    }
+
+    pc = taken ? st.target : b->term_pc + (b->term != TERM_NEXT ? 4 : 0);
+    if (b->stops) {
+      break;
+    }
+
+    /* Follow the chain, looking the successor up only when it changed */
+    FuncBlock* next = b->next[taken];
+    if (!next || next->pc != pc) {
+      if (!in_code(cpu, pc)) {
+        fprintf(stderr, "APEX_CPU : pc(%d) is outside code memory, stopping\n",
+                pc);
+        break;
+      }
+      next = get_block(&cache, cpu, pc, stats);
+      stats->lookups++;
+      if (!next) {
+        status = -1;
+        break;
+      }
+      b->next[taken] = next;
+    }
+    b = next;
+  }
+
+  cpu->pc = pc;
+  zeroFlag = st.flag;
+  if (st.status != 0) {
+    status = -1;
+  }
+  cpu->ins_completed = (int)executed;
+  stats->instructions = executed;
+  if (jit) {
+    stats->compiled = jit->blocks;
+    APEX_jit_free(jit);
+  }
+  cache_free(&cache);
+  return status;
+}
@@ -0,0 +1,48 @@
+#ifndef _APEX_JIT_H_
+#define _APEX_JIT_H_
+/**
+ *  jit.h
+ *  Translation of basic block bodies to native x86-64 code
+ *
+ *  Functional mode hands the body of a hot block, the instructions
+ *  before its BZ, BNZ, JUMP or HALT, to APEX_jit_compile(). The result
+ *  is a function that runs the body on the register file and data
+ *  memory of the CPU and leaves the zero flag as the ALU would. Only
+ *  built for x86-64 Linux; elsewhere APEX_jit_init() fails and blocks
+ *  stay interpreted.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* Times a block body is interpreted before it is compiled */
+#define APEX_JIT_THRESHOLD 16
+
+/* Size of the code buffer, blocks compiled after it fills stay interpreted */
+#define APEX_JIT_CODE_SIZE (64u << 20)
+
+/*
+ * Compiled block body. Returns 0, or -1 if a STORE could not allocate
+ * its page
+ */
+typedef int (*APEX_JitBlock)(int* regs, APEX_Memory* mem, int* zero_flag);
+
+typedef struct APEX_Jit
+{
+  uint8_t* code;    // Executable buffer
+  size_t size;
+  size_t used;
+  uint64_t blocks;  // Blocks compiled
+} APEX_Jit;
+
+int
+APEX_jit_init(APEX_Jit* jit);
+
+void
+APEX_jit_free(APEX_Jit* jit);
+
+APEX_JitBlock
+APEX_jit_compile(APEX_Jit* jit, const APEX_Instruction* ins, int count);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef _APEX_LOCKSTEP_H_
+#define _APEX_LOCKSTEP_H_
+/**
+ *  lockstep.h
+ *  Functional execution of one program on many data memory images
+ *
+ *  Every instance, or lane, has its own register file, zero flag, pc
+ *  and data memory, kept in structure of arrays layout: register r of
+ *  all lanes is one array, and each data memory page holds every word
+ *  for all lanes, the lanes of a word side by side. Lanes at the same
+ *  pc execute each instruction together, ALU operations as AVX2 vector
+ *  operations over the lanes when the host has AVX2. After a branch
+ *  the lanes may disagree on the pc; the lanes at the lowest pc run
+ *  next, under a mask, until the others are reached.
+ */
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* Most instances of one run */
+#define APEX_LOCKSTEP_MAX_LANES 65536
+
+/* Lanes are padded to a multiple of this, the lanes of one AVX2 register */
+#define APEX_LOCKSTEP_ALIGN 8
+
+typedef struct APEX_LaneTable
+{
+  int32_t* pages[MEM_TABLE_SIZE];  // MEM_PAGE_WORDS * stride words each
+} APEX_LaneTable;
+
+/* Function applying an ALU operation to the masked lanes, see lockstep.c */
+typedef void (*APEX_LaneKernel)(int op, int32_t* dst, const int32_t* a,
+                                const int32_t* b, int32_t imm,
+                                const int32_t* mask, int32_t* flag, int n);
+
+/* Function telling whether 'v' holds the same value in all masked lanes */
+typedef int (*APEX_LaneUniform)(const int32_t* v, int32_t value,
+                                const int32_t* mask, int n);
+
+typedef struct APEX_Lockstep
+{
+  int num_lanes;
+  int stride;          // num_lanes padded to APEX_LOCKSTEP_ALIGN
+  int32_t* regs;       // regs[r * stride + lane]
+  int32_t* flag;       // Zero flag of each lane
+  int32_t* pc;
+  int32_t* mask;       // -1 for the lanes executing the current instruction
+  int32_t* address;    // LOAD/STORE address of each lane
+  uint64_t* executed;  // Instructions executed by each lane
+  uint8_t* done;       // Lane has stopped
+  APEX_LaneTable* tables[MEM_DIR_SIZE];
+  size_t num_pages;
+  APEX_LaneKernel kernel;
+  APEX_LaneUniform uniform;
+  const char* kernel_name;
+} APEX_Lockstep;
+
+typedef struct APEX_LockstepStats
+{
+  uint64_t instructions;  // Executed by all lanes together
+  uint64_t steps;         // Instructions dispatched, each for one group of lanes
+  uint64_t masked_steps;  // Steps that left some running lane out
+  uint64_t groups;        // Times the lanes were regrouped
+} APEX_LockstepStats;
+
+int
+APEX_lockstep_init(APEX_Lockstep* ls, const APEX_CPU* cpu, int num_lanes);
+
+void
+APEX_lockstep_free(APEX_Lockstep* ls);
+
+int
+APEX_lockstep_load_image(APEX_Lockstep* ls, int lane, const char* spec);
+
+int
+APEX_lockstep_run(APEX_Lockstep* ls, const APEX_CPU* cpu,
+                  uint64_t max_instructions, APEX_LockstepStats* stats);
+
+uint64_t
+APEX_lockstep_hash(const APEX_Lockstep* ls, int lane);
+
+int
+APEX_lockstep_extract(const APEX_Lockstep* ls, int lane, APEX_CPU* cpu);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ *  mem.c
+ *  Demand allocated two level page table for data memory
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+void
+mem_init(APEX_Memory* mem)
+{
+  memset(mem, 0, sizeof(*mem));
+}
+
+void
+mem_free(APEX_Memory* mem)
+{
+  for (int d = 0; d < MEM_DIR_SIZE; ++d) {
+    APEX_MemTable* table = mem->tables[d];
+    if (!table) {
+      continue;
+    }
+    for (int t = 0; t < MEM_TABLE_SIZE; ++t) {
+      free(table->pages[t]);
+    }
+    free(table);
+  }
+  mem_init(mem);
+}
+
+/*
+ * Allocates the zero filled page holding 'address', and its table if
+ * needed. Returns NULL when out of memory
+ */
+APEX_MemPage*
+mem_page_alloc(APEX_Memory* mem, uint32_t address)
+{
+  APEX_MemTable** table = &mem->tables[address >> (32 - MEM_DIR_BITS)];
+  if (!*table) {
+    *table = calloc(1, sizeof(**table));
+    if (!*table) {
+      return NULL;
+    }
+  }
+  APEX_MemPage** page =
+    &(*table)->pages[(address >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+  if (!*page) {
+    *page = calloc(1, sizeof(**page));
+    if (!*page) {
+      return NULL;
+    }
+    mem->num_pages++;
+  }
+  return *page;
+}
+
+/*
+ * Stores 'count' words starting at byte 'address', a page at a time.
+ * The range wraps around the top of the address space
+ */
+int
+mem_write_words(APEX_Memory* mem, uint32_t address, const int* words,
+                size_t count)
+{
+  while (count) {
+    APEX_MemPage* page = mem_page_alloc(mem, address);
+    if (!page) {
+      return -1;
+    }
+    size_t first = (address >> 2) & (MEM_PAGE_WORDS - 1);
+    size_t n = MEM_PAGE_WORDS - first;
+    if (n > count) {
+      n = count;
+    }
+    memcpy(&page->words[first], words, sizeof(*words) * n);
+    words += n;
+    count -= n;
+    address += (uint32_t)(n * sizeof(*words));
+  }
+  return 0;
+}
+
+/*
+ * Makes 'dst' an independent copy of 'src', holding the same pages.
+ * 'dst' must be freed or freshly initialised
+ */
+int
+mem_copy(APEX_Memory* dst, const APEX_Memory* src)
+{
+  mem_init(dst);
+  for (int d = 0; d < MEM_DIR_SIZE; ++d) {
+    const APEX_MemTable* table = src->tables[d];
+    if (!table) {
+      continue;
+    }
+    for (int t = 0; t < MEM_TABLE_SIZE; ++t) {
+      if (!table->pages[t]) {
+        continue;
+      }
+      uint32_t address = ((uint32_t)d << (32 - MEM_DIR_BITS)) |
+                         ((uint32_t)t << MEM_PAGE_BITS);
+      APEX_MemPage* page = mem_page_alloc(dst, address);
+      if (!page) {
+        mem_free(dst);
+        return -1;
+      }
+      memcpy(page, table->pages[t], sizeof(*page));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,495 @@
+/*
+ *  memtrace.c
+ *  Memory access trace analysis: reuse distance, working set and strides
+ *
+ *  Every LOAD/STORE effective address computed in Execute is streamed
+ *  through three analyses that keep bounded state:
+ *
+ *  - LRU stack (reuse) distance in blocks, using a Fenwick tree over the
+ *    last access time of each tracked block. Timestamps are renumbered
+ *    when the tree fills up, and once 'max' blocks are tracked the least
+ *    recently used one is forgotten.
+ *  - Distinct blocks touched per window of accesses, kept as a series
+ *    whose resolution halves whenever it fills up.
+ *  - Distribution of address strides between consecutive accesses and
+ *    between consecutive accesses of the same static instruction.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "addr_map.h"
+#include "tools.h"
+
+#define MT_BUCKETS 34
+#define MT_SERIES 1024
+#define MT_MAX_STRIDES 4096
+#define MT_TOP_STRIDES 10
+
+typedef struct MemTrace
+{
+  APEX_Tool tool;
+
+  /* Options */
+  uint32_t block;      // Bytes per tracked block
+  uint32_t interval;   // Accesses per working set window
+  uint32_t max_blocks; // Blocks tracked for reuse distance
+  FILE* out;           // Optional raw trace
+
+  /* Reuse distance, map value is window id << 32 | timestamp */
+  AddrMap last;
+  uint32_t* tree;      // Fenwick tree over timestamps 1..size
+  uint32_t* owner;     // Block accessed at each timestamp
+  uint32_t size;
+  uint32_t now;
+  uint64_t hist[MT_BUCKETS];
+  uint64_t cold;
+  uint64_t evicted;
+
+  /* Working set */
+  uint32_t window;
+  uint64_t distinct;
+  uint64_t series[MT_SERIES];
+  int series_len;
+  uint64_t series_span;  // Windows summed into one series entry
+  uint64_t pending_sum;
+  uint64_t pending_windows;
+
+  /* Strides */
+  int have_prev;
+  uint32_t prev_addr;
+  AddrMap pc_last;
+  AddrMap global_strides;
+  AddrMap pc_strides;
+  uint64_t other_global;
+  uint64_t other_pc;
+
+  uint64_t loads;
+  uint64_t stores;
+} MemTrace;
+
+static void
+tree_add(MemTrace* mt, uint32_t i, int delta)
+{
+  for (; i <= mt->size; i += i & -i) {
+    mt->tree[i] += delta;
+  }
+}
+
+static uint32_t
+tree_prefix(MemTrace* mt, uint32_t i)
+{
+  uint32_t sum = 0;
+  for (; i > 0; i -= i & -i) {
+    sum += mt->tree[i];
+  }
+  return sum;
+}
+
+/* Lowest timestamp still marked, i.e. the least recently used block */
+static uint32_t
+tree_first(MemTrace* mt)
+{
+  uint32_t pos = 0;
+  uint32_t step = 1;
+  while (2 * step <= mt->size) {
+    step *= 2;
+  }
+  for (; step > 0; step >>= 1) {
+    if (pos + step <= mt->size && mt->tree[pos + step] == 0) {
+      pos += step;
+    }
+  }
+  return pos + 1;
+}
+
+/* Renumbers the live timestamps 1..n once the tree is full */
+static void
+compact(MemTrace* mt)
+{
+  uint32_t next = 1;
+  memset(mt->tree, 0, sizeof(*mt->tree) * (mt->size + 1));
+  for (uint32_t t = 1; t <= mt->size; ++t) {
+    uint64_t* value = addr_map_get(&mt->last, mt->owner[t]);
+    if (value && (uint32_t)*value == t) {
+      *value = (*value & ~0xffffffffull) | next;
+      mt->owner[next] = mt->owner[t];
+      tree_add(mt, next, 1);
+      next++;
+    }
+  }
+  mt->now = next;
+}
+
+static int
+bucket_of(uint64_t distance)
+{
+  int b = 0;
+  while (distance) {
+    distance >>= 1;
+    b++;
+  }
+  return b;
+}
+
+static void
+close_window(MemTrace* mt)
+{
+  mt->pending_sum += mt->distinct;
+  mt->pending_windows++;
+  mt->distinct = 0;
+  mt->window++;
+  if (mt->pending_windows < mt->series_span) {
+    return;
+  }
+  if (mt->series_len == MT_SERIES) {
+    for (int i = 0; i < MT_SERIES / 2; ++i) {
+      mt->series[i] = mt->series[2 * i] + mt->series[2 * i + 1];
+    }
+    mt->series_len = MT_SERIES / 2;
+    mt->series_span *= 2;
+    return;
+  }
+  mt->series[mt->series_len++] = mt->pending_sum;
+  mt->pending_sum = 0;
+  mt->pending_windows = 0;
+}
+
+static void
+count_stride(AddrMap* strides, uint64_t* other, int32_t stride)
+{
+  uint64_t* count = addr_map_get(strides, (uint32_t)stride);
+  if (!count && strides->count < MT_MAX_STRIDES) {
+    count = addr_map_put(strides, (uint32_t)stride);
+  }
+  if (count) {
+    (*count)++;
+  }
+  else {
+    (*other)++;
+  }
+}
+
+static void
+access_block(MemTrace* mt, uint32_t key)
+{
+  uint64_t* value = addr_map_get(&mt->last, key);
+  if (value) {
+    uint32_t last = (uint32_t)*value;
+    uint64_t distance = tree_prefix(mt, mt->now - 1) - tree_prefix(mt, last);
+    mt->hist[bucket_of(distance)]++;
+    tree_add(mt, last, -1);
+    if ((*value >> 32) != mt->window) {
+      mt->distinct++;
+    }
+  }
+  else {
+    mt->cold++;
+    mt->distinct++;
+    if (mt->last.count == mt->max_blocks) {
+      uint32_t oldest = tree_first(mt);
+      tree_add(mt, oldest, -1);
+      addr_map_remove(&mt->last, mt->owner[oldest]);
+      mt->evicted++;
+    }
+    value = addr_map_put(&mt->last, key);
+    if (!value) {
+      return;
+    }
+  }
+  *value = ((uint64_t)mt->window << 32) | mt->now;
+  mt->owner[mt->now] = key;
+  tree_add(mt, mt->now, 1);
+  mt->now++;
+  if (mt->now > mt->size) {
+    compact(mt);
+  }
+}
+
+static void
+on_issue(void* ctx, const APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  MemTrace* mt = ctx;
+  uint32_t addr = (uint32_t)stage->mem_address;
+  (void)cpu;
+  if (stage->op != OP_LOAD && stage->op != OP_STORE) {
+    return;
+  }
+  if (stage->op == OP_LOAD) {
+    mt->loads++;
+  }
+  else {
+    mt->stores++;
+  }
+
+  if (mt->out) {
+    /* Raw record: pc with bit 0 set for stores, then the address */
+    int32_t rec[2] = { stage->pc | (stage->op == OP_STORE), (int32_t)addr };
+    fwrite(rec, sizeof(rec), 1, mt->out);
+  }
+
+  access_block(mt, addr / mt->block);
+
+  if (mt->have_prev) {
+    count_stride(&mt->global_strides, &mt->other_global,
+                 (int32_t)(addr - mt->prev_addr));
+  }
+  mt->prev_addr = addr;
+  mt->have_prev = 1;
+
+  uint64_t* pc_last = addr_map_get(&mt->pc_last, (uint32_t)stage->pc);
+  if (pc_last) {
+    count_stride(&mt->pc_strides, &mt->other_pc,
+                 (int32_t)(addr - (uint32_t)*pc_last));
+  }
+  else {
+    pc_last = addr_map_put(&mt->pc_last, (uint32_t)stage->pc);
+  }
+  if (pc_last) {
+    *pc_last = addr;
+  }
+
+  if ((mt->loads + mt->stores) % mt->interval == 0) {
+    close_window(mt);
+  }
+}
+
+typedef struct StrideCount
+{
+  int32_t stride;
+  uint64_t count;
+} StrideCount;
+
+static int
+by_count(const void* a, const void* b)
+{
+  const StrideCount* x = a;
+  const StrideCount* y = b;
+  return (x->count < y->count) - (x->count > y->count);
+}
+
+/* Prints the most frequent strides of 'strides' */
+static void
+print_strides(const char* title, AddrMap* strides, uint64_t other)
+{
+  StrideCount* sorted = malloc(sizeof(*sorted) * (strides->count + 1));
+  size_t n = 0;
+  uint64_t total = other;
+  if (!sorted) {
+    return;
+  }
+  for (size_t i = 0; i < strides->capacity; ++i) {
+    if (strides->used[i]) {
+      sorted[n].stride = (int32_t)strides->keys[i];
+      sorted[n].count = strides->values[i];
+      total += sorted[n].count;
+      n++;
+    }
+  }
+  qsort(sorted, n, sizeof(*sorted), by_count);
+
+  printf("%s (%llu pairs)\n", title, (unsigned long long)total);
+  for (size_t i = 0; i < n && i < MT_TOP_STRIDES; ++i) {
+    printf("  stride %+8d bytes : %10llu  %5.1f%%\n",
+           sorted[i].stride,
+           (unsigned long long)sorted[i].count,
+           100.0 * sorted[i].count / total);
+  }
+  if (n > MT_TOP_STRIDES) {
+    uint64_t rest = 0;
+    for (size_t i = MT_TOP_STRIDES; i < n; ++i) {
+      rest += sorted[i].count;
+    }
+    printf("  %-6zu more strides     : %10llu  %5.1f%%\n",
+           n - MT_TOP_STRIDES, (unsigned long long)rest, 100.0 * rest / total);
+  }
+  if (other) {
+    printf("  untracked strides     : %10llu  %5.1f%%\n",
+           (unsigned long long)other, 100.0 * other / total);
+  }
+  free(sorted);
+}
+
+static void
+on_finish(void* ctx, const APEX_CPU* cpu)
+{
+  MemTrace* mt = ctx;
+  uint64_t accesses = mt->loads + mt->stores;
+  (void)cpu;
+
+  if (mt->out) {
+    fflush(mt->out);
+  }
+
+  printf("--------------------------------\n");
+  printf("------MEMORY ACCESS TRACE------\n");
+  printf("--------------------------------\n");
+  printf("Accesses                 : %llu (%llu LOAD, %llu STORE)\n",
+         (unsigned long long)accesses,
+         (unsigned long long)mt->loads,
+         (unsigned long long)mt->stores);
+  printf("Block size               : %u bytes\n", mt->block);
+  if (mt->evicted) {
+    printf("Footprint                : more than %u blocks\n", mt->max_blocks);
+  }
+  else {
+    printf("Footprint                : %llu blocks\n",
+           (unsigned long long)mt->cold);
+  }
+  if (!accesses) {
+    return;
+  }
+
+  printf("Reuse distance (distinct blocks between uses, LRU hit rate of a\n"
+         "fully associative cache of that many blocks is the cumulative %%)\n");
+  uint64_t cumulative = 0;
+  for (int b = 0; b < MT_BUCKETS; ++b) {
+    if (!mt->hist[b]) {
+      continue;
+    }
+    cumulative += mt->hist[b];
+    uint64_t lo = b ? 1ull << (b - 1) : 0;
+    uint64_t hi = b ? (1ull << b) - 1 : 0;
+    printf("  %10llu - %-10llu : %10llu  %5.1f%%  cumulative %5.1f%%\n",
+           (unsigned long long)lo, (unsigned long long)hi,
+           (unsigned long long)mt->hist[b],
+           100.0 * mt->hist[b] / accesses,
+           100.0 * cumulative / accesses);
+  }
+  printf("  cold or > %-10u    : %10llu  %5.1f%%\n",
+         mt->max_blocks, (unsigned long long)mt->cold,
+         100.0 * mt->cold / accesses);
+
+  printf("Working set (distinct blocks per %u accesses)\n", mt->interval);
+  int rows = mt->series_len;
+  int group = 1;
+  while (rows / group > 32) {
+    group *= 2;
+  }
+  for (int i = 0; i < rows; i += group) {
+    uint64_t sum = 0;
+    int n = 0;
+    for (int j = i; j < rows && j < i + group; ++j, ++n) {
+      sum += mt->series[j];
+    }
+    uint64_t first = (uint64_t)i * mt->series_span * mt->interval;
+    uint64_t last = (uint64_t)(i + n) * mt->series_span * mt->interval;
+    printf("  accesses %10llu - %-10llu : %8.1f\n",
+           (unsigned long long)first, (unsigned long long)last,
+           (double)sum / (double)(n * mt->series_span));
+  }
+  if (mt->window == 0) {
+    printf("  accesses %10u - %-10llu : %8llu\n", 0,
+           (unsigned long long)accesses, (unsigned long long)mt->distinct);
+  }
+
+  print_strides("Global strides", &mt->global_strides, mt->other_global);
+  print_strides("Per instruction strides", &mt->pc_strides, mt->other_pc);
+}
+
+static void
+on_release(void* ctx)
+{
+  MemTrace* mt = ctx;
+  if (mt->out) {
+    fclose(mt->out);
+  }
+  addr_map_free(&mt->last);
+  addr_map_free(&mt->pc_last);
+  addr_map_free(&mt->global_strides);
+  addr_map_free(&mt->pc_strides);
+  free(mt->tree);
+  free(mt->owner);
+  free(mt);
+}
+
+/* Parses "block:N,window:N,max:N,out:FILE" */
+static int
+parse_options(MemTrace* mt, const char* spec)
+{
+  char item[256];
+  const char* p = spec;
+  while (p && *p) {
+    const char* end = strchr(p, ',');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+    if (len >= sizeof(item)) {
+      return -1;
+    }
+    memcpy(item, p, len);
+    item[len] = '\0';
+    p = end ? end + 1 : NULL;
+
+    char* value = strchr(item, ':');
+    if (!value) {
+      return -1;
+    }
+    *value++ = '\0';
+    if (strcmp(item, "block") == 0) {
+      mt->block = (uint32_t)atoi(value);
+    }
+    else if (strcmp(item, "window") == 0) {
+      mt->interval = (uint32_t)atoi(value);
+    }
+    else if (strcmp(item, "max") == 0) {
+      mt->max_blocks = (uint32_t)atoi(value);
+    }
+    else if (strcmp(item, "out") == 0) {
+      mt->out = fopen(value, "wb");
+      if (!mt->out) {
+        return -1;
+      }
+      setvbuf(mt->out, NULL, _IOFBF, 1 << 20);
+    }
+    else {
+      return -1;
+    }
+  }
+  if (mt->block == 0 || mt->interval == 0 || mt->max_blocks == 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int
+APEX_memtrace_attach(APEX_CPU* cpu, const char* options)
+{
+  MemTrace* mt = calloc(1, sizeof(*mt));
+  if (!mt) {
+    return -1;
+  }
+  mt->block = 4;
+  mt->interval = 4096;
+  mt->max_blocks = 1 << 18;
+  mt->series_span = 1;
+  if (options && parse_options(mt, options) != 0) {
+    fprintf(stderr, "APEX_Error : Invalid memtrace options '%s'\n", options);
+    on_release(mt);
+    return -1;
+  }
+
+  /* Twice as many timestamps as blocks keeps compaction amortised O(1) */
+  mt->size = 2 * mt->max_blocks;
+  mt->now = 1;
+  mt->tree = calloc(mt->size + 1, sizeof(*mt->tree));
+  mt->owner = calloc(mt->size + 1, sizeof(*mt->owner));
+  if (!mt->tree || !mt->owner ||
+      addr_map_init(&mt->last, 1024) != 0 ||
+      addr_map_init(&mt->pc_last, 64) != 0 ||
+      addr_map_init(&mt->global_strides, 64) != 0 ||
+      addr_map_init(&mt->pc_strides, 64) != 0) {
+    on_release(mt);
+    return -1;
+  }
+
+  mt->tool.name = "memtrace";
+  mt->tool.ctx = mt;
+  mt->tool.on_issue = on_issue;
+  mt->tool.on_finish = on_finish;
+  mt->tool.on_release = on_release;
+  if (APEX_hooks_register(cpu, &mt->tool) != 0) {
+    on_release(mt);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,110 @@
+#ifndef _APEX_OBJECT_H_
+#define _APEX_OBJECT_H_
+/**
+ *  object.h
+ *  Pre-assembled binary format of APEX programs
+ *
+ *  File layout, all fields in the byte order of the host that wrote the
+ *  file, which byte_order records:
+ *
+ *    APEX_ObjHeader                       32 bytes
+ *    APEX_ObjInstruction[num_instructions] 8 bytes each
+ *    int32_t[num_data_words]              initial data memory, loaded
+ *                                         at byte address data_base
+ *
+ *  'apex_as' converts a text program into this format. The simulator
+ *  maps the file instead of parsing it and runs the instruction records
+ *  in place, and keeps the same format as a cache of the text programs
+ *  it has parsed.
+ *
+ *  Objects are mapped and run in place, so they are never converted. A
+ *  host of the other byte order rejects the file, and the name of a
+ *  cached object carries the byte order, so a cache directory shared by
+ *  such hosts keeps one object for each.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define APEX_OBJ_MAGIC 0x58455041u  // "APEX"
+#define APEX_OBJ_VERSION 2
+
+/* Reads back as 0x04030201 on a host of the other byte order */
+#define APEX_OBJ_BYTE_ORDER 0x01020304u
+
+typedef struct APEX_ObjHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_instructions;
+  uint32_t num_data_words;
+  uint32_t data_base;
+  uint32_t byte_order;  // APEX_OBJ_BYTE_ORDER
+  uint32_t reserved[2];
+} APEX_ObjHeader;
+
+/* Encoded instruction, op is an OP_* code */
+typedef struct APEX_ObjInstruction
+{
+  uint8_t op;
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+  int32_t imm;
+} APEX_ObjInstruction;
+
+/* Read only mapping of an object file */
+typedef struct APEX_Object
+{
+  void* map;
+  size_t map_size;
+  const APEX_ObjHeader* header;
+  const APEX_ObjInstruction* code;
+  const int32_t* data;
+} APEX_Object;
+
+/* Read only mapping of a raw image of 32 bit words in host byte order */
+typedef struct APEX_DataImage
+{
+  char filename[4096];
+  uint32_t base;  // Byte address of the first word
+  void* map;
+  size_t map_size;
+  const int32_t* words;
+  int num_words;
+} APEX_DataImage;
+
+int
+APEX_object_open(APEX_Object* obj, const char* filename);
+
+void
+APEX_object_close(APEX_Object* obj);
+
+const APEX_Instruction*
+APEX_object_code_memory(const APEX_Object* obj, int* size);
+
+int
+APEX_object_load(APEX_CPU* cpu, const char* filename);
+
+int
+APEX_object_parse_cached(APEX_CPU* cpu, const char* filename);
+
+void
+APEX_object_free_code(APEX_CPU* cpu);
+
+int
+APEX_data_image_open(APEX_DataImage* img, const char* spec);
+
+void
+APEX_data_image_close(APEX_DataImage* img);
+
+int
+APEX_data_image_load(APEX_CPU* cpu, const char* spec);
+
+int
+APEX_object_write(const char* filename, const APEX_Instruction* code,
+                  int size, const int32_t* data, int data_words,
+                  uint32_t data_base);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _APEX_OUTPUT_H_
+#define _APEX_OUTPUT_H_
+/**
+ *  output.h
+ *  Per cycle simulator output
+ *
+ *  Cycle headers and stage contents are queued as fixed size records
+ *  in a single producer, single consumer ring. A writer thread formats
+ *  them and writes standard output in large blocks, so the simulation
+ *  thread never waits on the terminal or disk. Output between
+ *  APEX_output_start() and APEX_output_stop() must go through these
+ *  functions to keep its order.
+ */
+#include "cpu.h"
+
+/* Set this flag to 0 to format and print synchronously, without a thread */
+#ifndef ENABLE_ASYNC_OUTPUT
+#define ENABLE_ASYNC_OUTPUT 1
+#endif
+
+void
+APEX_output_start(void);
+
+void
+APEX_output_stop(void);
+
+void
+APEX_output_cycle(int clock);
+
+void
+APEX_output_stage(const char* name, const CPU_Stage* stage);
+
+void
+APEX_output_text(const char* text);
+
+/* Stage name printed by display mode for F, DRF, EX, MEM or WB */
+const char*
+APEX_output_stage_name(int stage_id);
+
+/* Inverse of APEX_output_stage_name(), -1 for an unknown name */
+int
+APEX_output_stage_id(const char* name);
+
+#endif
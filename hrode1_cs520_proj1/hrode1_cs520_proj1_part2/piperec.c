@@ -0,0 +1,286 @@
+/*
+ *  piperec.c
+ *  Recording indexed per cycle pipeline traces
+ *
+ *  The recorder is an analysis tool: it collects what each stage shows
+ *  during a cycle and writes the cycle when it ends, together with the
+ *  registers whose value or valid bit changed. The index is kept in
+ *  memory, one entry per chunk, and written after the last cycle.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipetrace.h"
+#include "tools.h"
+
+typedef struct PipeRecorder
+{
+  APEX_Tool tool;
+  FILE* out;
+  uint64_t offset;     // Bytes written so far
+  uint32_t interval;
+
+  /* Keyframe taken at the end of a chunk, written before the next cycle */
+  APEX_PipeKeyframe keyframe;
+  int keyframe_pending;
+
+  /* Register file and zero flag as last written */
+  int regs[16];
+  int regs_valid[16];
+  int zero_flag;
+
+  /* Stage contents of the running cycle and pc per stage of the last one */
+  int num_shown;
+  APEX_PipeShown shown[APEX_PIPE_MAX_SHOWN];
+  uint32_t last_pc[NUM_STAGES];
+
+  APEX_PipeIndex* index;
+  uint64_t num_chunks;
+  uint64_t max_chunks;
+  uint64_t num_cycles;
+  int failed;
+} PipeRecorder;
+
+static void
+put(PipeRecorder* pr, const void* data, size_t size)
+{
+  if (fwrite(data, size, 1, pr->out) != 1) {
+    pr->failed = 1;
+  }
+  pr->offset += size;
+}
+
+static void
+take_keyframe(APEX_PipeKeyframe* kf, const APEX_CPU* cpu)
+{
+  memset(kf, 0, sizeof(*kf));
+  kf->cycle = (uint64_t)cpu->clock;
+  kf->pc = cpu->pc;
+  kf->zero_flag = zeroFlag;
+  for (int i = 0; i < 16; ++i) {
+    kf->regs[i] = cpu->regs[i];
+    kf->regs_valid |= (cpu->regs_valid[i] == 1) << i;
+  }
+  kf->ins_completed = (uint32_t)cpu->ins_completed;
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    const CPU_Stage* s = &cpu->stage[i];
+    APEX_PipeLatch* l = &kf->stage[i];
+    l->pc = s->pc;
+    l->imm = s->imm;
+    l->rs1_value = s->rs1_value;
+    l->rs2_value = s->rs2_value;
+    l->buffer = s->buffer;
+    l->mem_address = s->mem_address;
+    l->op = (uint8_t)s->op;
+    l->rd = (uint8_t)s->rd;
+    l->rs1 = (uint8_t)s->rs1;
+    l->rs2 = (uint8_t)s->rs2;
+    l->busy = (uint8_t)(s->busy != 0);
+    l->stalled = (uint8_t)(s->stalled != 0);
+  }
+}
+
+/* Starts a chunk with the pending keyframe */
+static void
+begin_chunk(PipeRecorder* pr)
+{
+  if (pr->num_chunks == pr->max_chunks) {
+    uint64_t max = pr->max_chunks ? pr->max_chunks * 2 : 256;
+    APEX_PipeIndex* index = realloc(pr->index, max * sizeof(*index));
+    if (!index) {
+      pr->failed = 1;
+      return;
+    }
+    pr->index = index;
+    pr->max_chunks = max;
+  }
+  APEX_PipeIndex* entry = &pr->index[pr->num_chunks++];
+  memset(entry, 0, sizeof(*entry));
+  entry->cycle = pr->keyframe.cycle + 1;
+  entry->offset = pr->offset;
+  put(pr, &pr->keyframe, sizeof(pr->keyframe));
+  pr->keyframe_pending = 0;
+}
+
+static void
+on_show(void* ctx, const APEX_CPU* cpu, int stage_id, const CPU_Stage* stage)
+{
+  PipeRecorder* pr = ctx;
+  (void)cpu;
+  if (stage_id < 0 || pr->num_shown == APEX_PIPE_MAX_SHOWN) {
+    return;
+  }
+  APEX_PipeShown* s = &pr->shown[pr->num_shown++];
+  s->pc = (uint32_t)stage->pc;
+  s->imm = stage->imm;
+  s->stage = (uint8_t)stage_id;
+  s->op = (uint8_t)stage->op;
+  s->regs = (uint16_t)((stage->rd & 15) << 8 | (stage->rs1 & 15) << 4 |
+                       (stage->rs2 & 15));
+}
+
+static void
+on_cycle(void* ctx, const APEX_CPU* cpu)
+{
+  PipeRecorder* pr = ctx;
+  if (pr->keyframe_pending) {
+    begin_chunk(pr);
+  }
+  if (pr->num_chunks == 0) {
+    return;
+  }
+
+  /* Entering a stage, marked and added to the chunk's bloom filter */
+  APEX_PipeIndex* entry = &pr->index[pr->num_chunks - 1];
+  uint32_t last_pc[NUM_STAGES] = { 0 };
+  for (int i = 0; i < pr->num_shown; ++i) {
+    APEX_PipeShown* s = &pr->shown[i];
+    if (s->pc != 0 && s->pc != pr->last_pc[s->stage]) {
+      s->stage |= APEX_PIPE_ENTERED;
+      APEX_pipetrace_bloom_add(entry->bloom, APEX_PIPE_STAGE(s), s->pc);
+    }
+    last_pc[APEX_PIPE_STAGE(s)] = s->pc;
+  }
+  memcpy(pr->last_pc, last_pc, sizeof(last_pc));
+
+  /* One write per cycle: header, stage contents, register changes */
+  uint8_t record[sizeof(APEX_PipeCycle) + sizeof(pr->shown) +
+                 17 * sizeof(APEX_PipeWrite)];
+  APEX_PipeWrite writes[17];
+  int num_writes = 0;
+  for (int i = 0; i < 16; ++i) {
+    if (cpu->regs[i] != pr->regs[i] || cpu->regs_valid[i] != pr->regs_valid[i]) {
+      APEX_PipeWrite* w = &writes[num_writes++];
+      w->reg = (uint8_t)i;
+      w->valid = (uint8_t)(cpu->regs_valid[i] == 1);
+      w->reserved = 0;
+      w->value = cpu->regs[i];
+      pr->regs[i] = cpu->regs[i];
+      pr->regs_valid[i] = cpu->regs_valid[i];
+    }
+  }
+  if (zeroFlag != pr->zero_flag) {
+    APEX_PipeWrite* w = &writes[num_writes++];
+    w->reg = APEX_PIPE_ZERO_FLAG;
+    w->valid = 1;
+    w->reserved = 0;
+    w->value = zeroFlag;
+    pr->zero_flag = zeroFlag;
+  }
+
+  APEX_PipeCycle c = { (uint8_t)pr->num_shown, (uint8_t)num_writes, 0 };
+  size_t shown_size = sizeof(pr->shown[0]) * pr->num_shown;
+  size_t writes_size = sizeof(writes[0]) * num_writes;
+  memcpy(record, &c, sizeof(c));
+  memcpy(record + sizeof(c), pr->shown, shown_size);
+  memcpy(record + sizeof(c) + shown_size, writes, writes_size);
+  put(pr, record, sizeof(c) + shown_size + writes_size);
+  pr->num_shown = 0;
+  pr->num_cycles++;
+
+  if (cpu->clock % pr->interval == 0) {
+    take_keyframe(&pr->keyframe, cpu);
+    pr->keyframe_pending = 1;
+  }
+}
+
+/* Writes the index, 8 byte aligned, and the trailer locating it */
+static void
+on_finish(void* ctx, const APEX_CPU* cpu)
+{
+  PipeRecorder* pr = ctx;
+  static const uint8_t zeros[8];
+  (void)cpu;
+
+  put(pr, zeros, (8 - pr->offset % 8) % 8);
+  APEX_PipeTrailer t;
+  memset(&t, 0, sizeof(t));
+  t.index_offset = pr->offset;
+  t.num_chunks = pr->num_chunks;
+  t.num_cycles = pr->num_cycles;
+  t.magic = APEX_PIPETRACE_MAGIC;
+  t.version = APEX_PIPETRACE_VERSION;
+  put(pr, pr->index, sizeof(pr->index[0]) * pr->num_chunks);
+  put(pr, &t, sizeof(t));
+  fflush(pr->out);
+  printf("Pipeline trace : %llu cycles, %llu keyframes\n",
+         (unsigned long long)pr->num_cycles, (unsigned long long)pr->num_chunks);
+}
+
+static void
+on_release(void* ctx)
+{
+  PipeRecorder* pr = ctx;
+  if (pr->out && (fclose(pr->out) != 0 || pr->failed)) {
+    fprintf(stderr, "APEX_Error : Unable to write pipeline trace\n");
+  }
+  free(pr->index);
+  free(pr);
+}
+
+/* Parses "FILE[,keyframe:N]" */
+int
+APEX_pipetrace_attach(APEX_CPU* cpu, const char* options)
+{
+  char filename[4096];
+  const char* comma = options ? strchr(options, ',') : NULL;
+  size_t len = comma ? (size_t)(comma - options) : (options ? strlen(options) : 0);
+  long interval = APEX_PIPETRACE_INTERVAL;
+
+  if (len == 0 || len >= sizeof(filename)) {
+    fprintf(stderr, "APEX_Error : --pipetrace needs a file name\n");
+    return -1;
+  }
+  memcpy(filename, options, len);
+  filename[len] = '\0';
+  if (comma) {
+    char* end;
+    if (strncmp(comma + 1, "keyframe:", 9) != 0 ||
+        (interval = strtol(comma + 10, &end, 10)) <= 0 || *end != '\0' ||
+        interval > (1 << 24)) {
+      fprintf(stderr, "APEX_Error : Invalid --pipetrace option %s\n", comma + 1);
+      return -1;
+    }
+  }
+
+  PipeRecorder* pr = calloc(1, sizeof(*pr));
+  if (!pr) {
+    return -1;
+  }
+  pr->out = fopen(filename, "wb");
+  if (!pr->out) {
+    fprintf(stderr, "APEX_Error : Unable to create pipeline trace %s\n", filename);
+    free(pr);
+    return -1;
+  }
+  setvbuf(pr->out, NULL, _IOFBF, 1 << 20);
+  pr->interval = (uint32_t)interval;
+
+  APEX_PipeHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = APEX_PIPETRACE_MAGIC;
+  h.version = APEX_PIPETRACE_VERSION;
+  h.interval = pr->interval;
+  put(pr, &h, sizeof(h));
+
+  /* State before the first cycle */
+  take_keyframe(&pr->keyframe, cpu);
+  pr->keyframe_pending = 1;
+  memcpy(pr->regs, cpu->regs, sizeof(pr->regs));
+  memcpy(pr->regs_valid, cpu->regs_valid, sizeof(pr->regs_valid));
+  pr->zero_flag = zeroFlag;
+
+  pr->tool.name = "pipetrace";
+  pr->tool.ctx = pr;
+  pr->tool.on_show = on_show;
+  pr->tool.on_cycle = on_cycle;
+  pr->tool.on_finish = on_finish;
+  pr->tool.on_release = on_release;
+  if (APEX_hooks_register(cpu, &pr->tool) != 0) {
+    on_release(pr);
+    return -1;
+  }
+  return 0;
+}
+
@@ -0,0 +1,66 @@
+#ifndef _APEX_REGION_H_
+#define _APEX_REGION_H_
+/**
+ *  region.h
+ *  Detailed simulation of one region of a program
+ *
+ *  The region starts from an architectural checkpoint: the registers,
+ *  zero flag, data memory and pc that functional mode (func.h) left in
+ *  the CPU. The pipeline starts empty at cpu->pc, its first 'warmup'
+ *  retired instructions refill it and are not measured, and the next
+ *  'length' are. Running the pipeline changes the CPU for good, so a
+ *  region normally runs in a forked child (forkpool.h), on a CPU whose
+ *  pipeline never ran.
+ *
+ *  Instructions are counted as the pipeline retires them. The forwarding
+ *  pipelines retire only one of two back-to-back MULs, so there a region
+ *  covers more of the program than functional mode counts for it.
+ */
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* Architectural state functional mode can restart from */
+typedef struct APEX_Checkpoint
+{
+  int regs[16];
+  int pc;
+  int flag;  // Zero flag
+  APEX_Memory memory;
+} APEX_Checkpoint;
+
+typedef struct APEX_RegionResult
+{
+  int stopped;            // Program ended before the end of the region
+  uint64_t instructions;  // Measured instructions retired
+  uint64_t cycles;        // Cycles between the end of warm-up and the last of them
+} APEX_RegionResult;
+
+void
+APEX_region_run(APEX_CPU* cpu, uint64_t warmup, uint64_t length,
+                APEX_RegionResult* result);
+
+int
+APEX_checkpoint_save(APEX_Checkpoint* cp, const APEX_CPU* cpu);
+
+int
+APEX_checkpoint_restore(const APEX_Checkpoint* cp, APEX_CPU* cpu);
+
+void
+APEX_checkpoint_free(APEX_Checkpoint* cp);
+
+/**
+ * Runs functional mode from the state in 'cpu', instruction 0, and
+ * forks a region at each of the 'count' increasing 'starts', of
+ * 'lengths[i]' instructions after up to 'warmup' more, 'jobs' at a
+ * time. If 'total' is not NULL the functional run continues to the end
+ * of the program and stores its instruction count there. A region the
+ * program ends in during warm-up measures no instructions. Returns -1
+ * if a child failed or the program ended before a start
+ */
+int
+APEX_region_sample(APEX_CPU* cpu, const uint64_t* starts, const uint64_t* lengths,
+                   int count, uint64_t warmup, int use_jit, int jobs,
+                   APEX_RegionResult* results, uint64_t* total);
+
+#endif
@@ -0,0 +1,543 @@
+/*
+ *  simpoint.c
+ *  Phase analysis and detailed simulation of representative intervals
+ *
+ *  Every block, by code memory index, has a fixed random vector with
+ *  components uniform in [-1, 1], computed from a hash of the seed, the
+ *  index and the dimension, so nothing is stored per block. The
+ *  projected vector of an interval is the sum of those vectors, each
+ *  scaled by the share of the interval's instructions in that block.
+ *
+ *  BIC is the score of X-means (Pelleg and Moore) with one spherical
+ *  variance for all clusters, as in SimPoint, and the smallest k
+ *  scoring at least APEX_SIMPOINT_BIC of the way from the worst score
+ *  to the best is kept.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "func.h"
+#include "region.h"
+#include "simpoint.h"
+
+#define DIMS APEX_SIMPOINT_DIMS
+
+/* k-means runs from different starting centres, the best one is kept */
+#define KMEANS_TRIES 5
+#define KMEANS_MAX_ITERATIONS 100
+
+/* Share of the BIC range the chosen k must reach */
+#define APEX_SIMPOINT_BIC 0.9
+
+/*
+ * Smallest variance per dimension the BIC assumes. Intervals of a loop
+ * differ by rounding noise only, which would otherwise look like many
+ * tight clusters
+ */
+#define APEX_SIMPOINT_MIN_VARIANCE 1e-6
+
+static uint64_t
+mix64(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+/* Component 'dim' of the random vector of block 'index' */
+static double
+projection(unsigned seed, int index, int dim)
+{
+  uint64_t h = mix64(((uint64_t)seed << 40) ^ ((uint64_t)index << 8) ^ (uint64_t)dim);
+  return (double)(h >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+/* Uniform in [0, 1) */
+static double
+random_unit(uint64_t* state)
+{
+  *state = mix64(*state + 0x9e3779b97f4a7c15ull);
+  return (double)(*state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double
+distance2(const double* a, const double* b)
+{
+  double d = 0;
+  for (int i = 0; i < DIMS; ++i) {
+    d += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  return d;
+}
+
+/* Saves the starting state and runs the whole program, one interval at a time */
+int
+APEX_simpoint_profile(APEX_SimPoint* sp, APEX_CPU* cpu,
+                      const APEX_SimPointConfig* config)
+{
+  memset(sp, 0, sizeof(*sp));
+  sp->config = *config;
+  if (APEX_checkpoint_save(&sp->start, cpu) != 0) {
+    return -1;
+  }
+
+  APEX_FuncProfile profile;
+  profile.counts = calloc(cpu->code_memory_size, sizeof(*profile.counts));
+  profile.touched = calloc(cpu->code_memory_size, sizeof(*profile.touched));
+  profile.num_touched = 0;
+  int status = profile.counts && profile.touched ? 0 : -1;
+  int capacity = 0;
+  while (status == 0) {
+    APEX_FuncStats stats;
+    status = APEX_func_run(cpu, config->interval, config->use_jit, &profile, &stats);
+    if (status == 0 && stats.instructions) {
+      if (sp->num_intervals == capacity) {
+        capacity = capacity ? capacity * 2 : 256;
+        uint64_t* lengths = realloc(sp->lengths, sizeof(*lengths) * capacity);
+        sp->lengths = lengths ? lengths : sp->lengths;
+        double* points = realloc(sp->points, sizeof(*points) * DIMS * capacity);
+        sp->points = points ? points : sp->points;
+        if (!lengths || !points) {
+          status = -1;
+          break;
+        }
+      }
+      double* point = &sp->points[sp->num_intervals * DIMS];
+      memset(point, 0, sizeof(*point) * DIMS);
+      for (int t = 0; t < profile.num_touched; ++t) {
+        int index = profile.touched[t];
+        double share = (double)profile.counts[index] / stats.instructions;
+        for (int d = 0; d < DIMS; ++d) {
+          point[d] += share * projection(config->seed, index, d);
+        }
+        profile.counts[index] = 0;
+      }
+      profile.num_touched = 0;
+      sp->lengths[sp->num_intervals++] = stats.instructions;
+      sp->instructions += stats.instructions;
+    }
+    if (stats.stopped) {
+      break;
+    }
+  }
+  if (status != 0) {
+    fprintf(stderr, "APEX_Error : Profiling run failed after %d intervals\n",
+            sp->num_intervals);
+  }
+  free(profile.counts);
+  free(profile.touched);
+  return status;
+}
+
+/*
+ * k-means of the intervals into 'k' clusters from k-means++ starting
+ * centres. Returns the sum of squared distances to the centres
+ */
+static double
+kmeans(const double* points, int n, int k, uint64_t* rng, double* centres,
+       int* assign, double* nearest)
+{
+  /* k-means++, each next centre drawn by squared distance to the nearest one */
+  memcpy(centres, &points[(int)(random_unit(rng) * n) * DIMS], sizeof(double) * DIMS);
+  for (int i = 0; i < n; ++i) {
+    nearest[i] = distance2(&points[i * DIMS], centres);
+  }
+  for (int c = 1; c < k; ++c) {
+    double total = 0;
+    for (int i = 0; i < n; ++i) {
+      total += nearest[i];
+    }
+    int pick = 0;
+    double r = random_unit(rng) * total;
+    while (pick < n - 1 && (r -= nearest[pick]) >= 0) {
+      pick++;
+    }
+    memcpy(&centres[c * DIMS], &points[pick * DIMS], sizeof(double) * DIMS);
+    for (int i = 0; i < n; ++i) {
+      double d = distance2(&points[i * DIMS], &centres[c * DIMS]);
+      nearest[i] = d < nearest[i] ? d : nearest[i];
+    }
+  }
+
+  for (int i = 0; i < n; ++i) {
+    assign[i] = -1;
+  }
+  double sse = 0;
+  for (int iteration = 0; iteration < KMEANS_MAX_ITERATIONS; ++iteration) {
+    int changed = 0;
+    sse = 0;
+    for (int i = 0; i < n; ++i) {
+      int best = 0;
+      double best_d = distance2(&points[i * DIMS], centres);
+      for (int c = 1; c < k; ++c) {
+        double d = distance2(&points[i * DIMS], &centres[c * DIMS]);
+        if (d < best_d) {
+          best = c;
+          best_d = d;
+        }
+      }
+      changed |= assign[i] != best;
+      assign[i] = best;
+      sse += best_d;
+    }
+    if (!changed) {
+      break;
+    }
+    /* Empty clusters keep their centre */
+    for (int c = 0; c < k; ++c) {
+      double sum[DIMS] = { 0 };
+      int members = 0;
+      for (int i = 0; i < n; ++i) {
+        if (assign[i] == c) {
+          members++;
+          for (int d = 0; d < DIMS; ++d) {
+            sum[d] += points[i * DIMS + d];
+          }
+        }
+      }
+      for (int d = 0; members && d < DIMS; ++d) {
+        centres[c * DIMS + d] = sum[d] / members;
+      }
+    }
+  }
+  return sse;
+}
+
+/* Bayesian information criterion of a clustering, higher is better */
+static double
+bic(const int* assign, int n, int k, double sse)
+{
+  if (n <= k) {
+    return -HUGE_VAL;
+  }
+  double variance = sse / ((double)DIMS * (n - k));
+  if (variance < APEX_SIMPOINT_MIN_VARIANCE) {
+    variance = APEX_SIMPOINT_MIN_VARIANCE;
+  }
+  int sizes[k];
+  memset(sizes, 0, sizeof(sizes));
+  for (int i = 0; i < n; ++i) {
+    sizes[assign[i]]++;
+  }
+  double likelihood = -0.5 * n * DIMS * log(2 * M_PI * variance) - 0.5 * DIMS * (n - k);
+  for (int c = 0; c < k; ++c) {
+    if (sizes[c]) {
+      likelihood += sizes[c] * log((double)sizes[c] / n);
+    }
+  }
+  double parameters = (k - 1) + (double)k * DIMS + 1;
+  return likelihood - 0.5 * parameters * log((double)n);
+}
+
+/*
+ * Clusters the intervals, then picks the representative and the
+ * sampled intervals of every phase
+ */
+int
+APEX_simpoint_cluster(APEX_SimPoint* sp)
+{
+  const int n = sp->num_intervals;
+  int max_k = sp->config.max_k < n ? sp->config.max_k : n;
+  if (max_k < 1) {
+    fprintf(stderr, "APEX_Error : The program has no complete interval to cluster\n");
+    return -1;
+  }
+  double* scores = calloc(max_k + 1, sizeof(*scores));
+  int* assigns = calloc((size_t)(max_k + 1) * n, sizeof(*assigns));
+  int* assign = calloc(n, sizeof(*assign));
+  double* centres = calloc((size_t)max_k * DIMS, sizeof(*centres));
+  double* nearest = calloc(n, sizeof(*nearest));
+  if (!scores || !assigns || !assign || !centres || !nearest) {
+    free(scores);
+    free(assigns);
+    free(assign);
+    free(centres);
+    free(nearest);
+    fprintf(stderr, "APEX_Error : Out of memory clustering %d intervals\n", n);
+    return -1;
+  }
+
+  double lowest = HUGE_VAL;
+  double highest = -HUGE_VAL;
+  for (int k = 1; k <= max_k; ++k) {
+    double best = HUGE_VAL;
+    for (int t = 0; t < KMEANS_TRIES; ++t) {
+      uint64_t rng = mix64(((uint64_t)sp->config.seed << 32) ^ (uint64_t)(k * KMEANS_TRIES + t));
+      double sse = kmeans(sp->points, n, k, &rng, centres, assign, nearest);
+      if (sse < best) {
+        best = sse;
+        memcpy(&assigns[(size_t)k * n], assign, sizeof(*assign) * n);
+      }
+    }
+    scores[k] = bic(&assigns[(size_t)k * n], n, k, best);
+    if (scores[k] > -HUGE_VAL) {
+      lowest = scores[k] < lowest ? scores[k] : lowest;
+      highest = scores[k] > highest ? scores[k] : highest;
+    }
+  }
+  sp->k = 1;
+  for (int k = 1; k <= max_k; ++k) {
+    if (scores[k] > -HUGE_VAL &&
+        scores[k] >= lowest + APEX_SIMPOINT_BIC * (highest - lowest)) {
+      sp->k = k;
+      break;
+    }
+  }
+
+  /* Renumber the chosen clusters without gaps, as phases */
+  const int* chosen = &assigns[(size_t)sp->k * n];
+  int renumber[sp->k];
+  int num_phases = 0;
+  for (int c = 0; c < sp->k; ++c) {
+    renumber[c] = -1;
+  }
+  sp->cluster = malloc(sizeof(*sp->cluster) * n);
+  if (!sp->cluster) {
+    num_phases = -1;
+  }
+  for (int i = 0; num_phases >= 0 && i < n; ++i) {
+    if (renumber[chosen[i]] < 0) {
+      renumber[chosen[i]] = num_phases++;
+    }
+    sp->cluster[i] = renumber[chosen[i]];
+  }
+  free(scores);
+  free(assigns);
+  free(assign);
+  free(nearest);
+  if (num_phases < 0) {
+    free(centres);
+    return -1;
+  }
+  sp->k = num_phases;
+
+  /* Centres, representatives and sampled intervals of the phases */
+  sp->phases = calloc(sp->k, sizeof(*sp->phases));
+  if (!sp->phases) {
+    free(centres);
+    return -1;
+  }
+  memset(centres, 0, sizeof(*centres) * sp->k * DIMS);
+  for (int i = 0; i < n; ++i) {
+    APEX_SimPointPhase* phase = &sp->phases[sp->cluster[i]];
+    phase->num_intervals++;
+    phase->instructions += sp->lengths[i];
+    for (int d = 0; d < DIMS; ++d) {
+      centres[sp->cluster[i] * DIMS + d] += sp->points[i * DIMS + d];
+    }
+  }
+  uint64_t rng = mix64(sp->config.seed ^ 0x5eedull);
+  for (int p = 0; p < sp->k; ++p) {
+    APEX_SimPointPhase* phase = &sp->phases[p];
+    double* centre = &centres[p * DIMS];
+    for (int d = 0; d < DIMS; ++d) {
+      centre[d] /= phase->num_intervals;
+    }
+    int* members = malloc(sizeof(*members) * phase->num_intervals);
+    int want = sp->config.samples < phase->num_intervals ? sp->config.samples
+                                                         : phase->num_intervals;
+    phase->samples = malloc(sizeof(*phase->samples) * (want ? want : 1));
+    phase->cpi = malloc(sizeof(*phase->cpi) * (want ? want : 1));
+    if (!members || !phase->samples || !phase->cpi) {
+      free(members);
+      free(centres);
+      return -1;
+    }
+    int count = 0;
+    double best_d = HUGE_VAL;
+    for (int i = 0; i < n; ++i) {
+      if (sp->cluster[i] != p) {
+        continue;
+      }
+      double d = distance2(&sp->points[i * DIMS], centre);
+      if (d < best_d) {
+        best_d = d;
+        phase->representative = i;
+      }
+      members[count++] = i;
+    }
+    /* The representative, then random other members */
+    phase->samples[phase->num_samples++] = phase->representative;
+    for (int i = 0; i < count && phase->num_samples < want; ++i) {
+      int j = i + (int)(random_unit(&rng) * (count - i));
+      int pick = members[j];
+      members[j] = members[i];
+      members[i] = pick;
+      if (pick != phase->representative) {
+        phase->samples[phase->num_samples++] = pick;
+      }
+    }
+    free(members);
+  }
+  free(centres);
+  return 0;
+}
+
+typedef struct Selected
+{
+  int interval;
+  int phase;
+  int sample;
+} Selected;
+
+static int
+by_interval(const void* a, const void* b)
+{
+  return ((const Selected*)a)->interval - ((const Selected*)b)->interval;
+}
+
+/*
+ * Runs the program again from its starting state, forking a detailed
+ * simulation at the start of every sampled interval
+ */
+int
+APEX_simpoint_simulate(APEX_SimPoint* sp, APEX_CPU* cpu)
+{
+  int count = 0;
+  for (int p = 0; p < sp->k; ++p) {
+    count += sp->phases[p].num_samples;
+  }
+  Selected* selected = malloc(sizeof(*selected) * count);
+  uint64_t* starts = malloc(sizeof(*starts) * count);
+  uint64_t* lengths = malloc(sizeof(*lengths) * count);
+  APEX_RegionResult* results = malloc(sizeof(*results) * count);
+  int status = selected && starts && lengths && results ? 0 : -1;
+  if (status == 0) {
+    count = 0;
+    for (int p = 0; p < sp->k; ++p) {
+      for (int s = 0; s < sp->phases[p].num_samples; ++s) {
+        Selected sel = { sp->phases[p].samples[s], p, s };
+        selected[count++] = sel;
+      }
+    }
+    qsort(selected, count, sizeof(*selected), by_interval);
+    for (int i = 0; i < count; ++i) {
+      starts[i] = (uint64_t)selected[i].interval * sp->config.interval;
+      lengths[i] = sp->lengths[selected[i].interval];
+    }
+    status = APEX_checkpoint_restore(&sp->start, cpu);
+  }
+  if (status == 0) {
+    status = APEX_region_sample(cpu, starts, lengths, count, sp->config.warmup,
+                                sp->config.use_jit, sp->config.jobs, results, NULL);
+    for (int i = 0; i < count; ++i) {
+      const APEX_RegionResult* r = &results[i];
+      sp->phases[selected[i].phase].cpi[selected[i].sample] =
+        r->instructions ? (double)r->cycles / r->instructions : -1;
+    }
+  }
+  free(selected);
+  free(starts);
+  free(lengths);
+  free(results);
+  return status;
+}
+
+void
+APEX_simpoint_report(const APEX_SimPoint* sp)
+{
+  double representative = 0;
+  double estimate = 0;
+  double variance = 0;
+  double measured = 0;
+  uint64_t detailed = 0;
+  int single = 0;
+  int unmeasured = 0;
+
+  printf("--------------------------------\n");
+  printf("------SIMPOINT------\n");
+  printf("--------------------------------\n");
+  printf("Intervals            : %d of %llu instructions, %llu instructions in all\n",
+         sp->num_intervals, (unsigned long long)sp->config.interval,
+         (unsigned long long)sp->instructions);
+  printf("Phases               : %d\n", sp->k);
+  printf("%-6s %-8s %-10s %-15s %-8s %-8s %s\n", "Phase", "Weight", "Intervals",
+         "Representative", "Samples", "CPI", "Spread");
+  for (int p = 0; p < sp->k; ++p) {
+    const APEX_SimPointPhase* phase = &sp->phases[p];
+    double weight = (double)phase->instructions / sp->instructions;
+    double sum = 0;
+    double sum2 = 0;
+    int m = 0;
+    for (int s = 0; s < phase->num_samples; ++s) {
+      if (phase->cpi[s] >= 0) {
+        sum += phase->cpi[s];
+        sum2 += phase->cpi[s] * phase->cpi[s];
+        detailed += sp->lengths[phase->samples[s]];
+        m++;
+      }
+    }
+    double mean = m ? sum / m : 0;
+    double spread = m > 1 ? (sum2 - m * mean * mean) / (m - 1) : 0;
+    spread = spread > 0 ? sqrt(spread) : 0;
+    if (m) {
+      representative += weight * (phase->cpi[0] >= 0 ? phase->cpi[0] : mean);
+      estimate += weight * mean;
+      measured += weight;
+    }
+    else {
+      unmeasured++;
+    }
+    if (m > 1) {
+      /* Stratified sampling, with the finite population correction */
+      double fpc = 1.0 - (double)m / phase->num_intervals;
+      variance += weight * weight * spread * spread / m * fpc;
+    }
+    else if (phase->num_intervals > 1) {
+      single++;
+    }
+    printf("%-6d %-8.4f %-10d %-15d %-8d ", p, weight, phase->num_intervals,
+           phase->representative, m);
+    if (m) {
+      printf("%-8.4f ", mean);
+    }
+    else {
+      printf("%-8s ", "-");
+    }
+    if (m > 1) {
+      printf("%.4f\n", spread);
+    }
+    else {
+      printf("-\n");
+    }
+  }
+  /* Phases the program ended in before any measurement share out their weight */
+  if (measured > 0) {
+    representative /= measured;
+    estimate /= measured;
+    variance /= measured * measured;
+  }
+  double margin = 1.96 * sqrt(variance);
+  printf("CPI, representatives : %.4f\n", representative);
+  printf("CPI, all samples     : %.4f +- %.4f (95%%)\n", estimate, margin);
+  printf("Estimated cycles     : %.0f +- %.0f\n", estimate * sp->instructions,
+         margin * sp->instructions);
+  printf("Detailed instructions: %llu (%.2f%% of the program)\n",
+         (unsigned long long)detailed,
+         sp->instructions ? 100.0 * detailed / sp->instructions : 0.0);
+  if (single) {
+    printf("Phases with one sample, not in the interval : %d\n", single);
+  }
+  if (unmeasured) {
+    printf("Phases ending the program during warm-up     : %d\n", unmeasured);
+  }
+}
+
+void
+APEX_simpoint_free(APEX_SimPoint* sp)
+{
+  for (int p = 0; sp->phases && p < sp->k; ++p) {
+    free(sp->phases[p].samples);
+    free(sp->phases[p].cpi);
+  }
+  free(sp->phases);
+  free(sp->lengths);
+  free(sp->points);
+  free(sp->cluster);
+  APEX_checkpoint_free(&sp->start);
+  memset(sp, 0, sizeof(*sp));
+}
@@ -0,0 +1,187 @@
+/*
+ *  smarts.c
+ *  Systematic sampling of a program until its CPI reaches a confidence target
+ *
+ *  Every window is simulated from a fresh pipeline, so windows are
+ *  independent and the interval assumes random sampling, as SMARTS does
+ *  for systematic samples. The finite population correction counts the
+ *  windows that fit in the program.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "func.h"
+#include "smarts.h"
+
+static uint64_t
+mix64(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+/* z with P(|Z| <= z) = 'confidence' for a standard normal Z */
+static double
+normal_quantile(double confidence)
+{
+  double low = 0;
+  double high = 10;
+  for (int i = 0; i < 64; ++i) {
+    double z = 0.5 * (low + high);
+    if (erfc(z / M_SQRT2) > 1.0 - confidence) {
+      low = z;
+    }
+    else {
+      high = z;
+    }
+  }
+  return 0.5 * (low + high);
+}
+
+/* Updates the estimate and the relative half-width of its interval */
+static void
+update_estimate(APEX_Smarts* sm)
+{
+  int n = sm->samples;
+  sm->cpi = n ? sm->sum / n : 0;
+  if (n < 2 || sm->cpi <= 0) {
+    sm->error = HUGE_VAL;
+    return;
+  }
+  double variance = (sm->sum2 - n * sm->cpi * sm->cpi) / (n - 1);
+  double population = (double)sm->instructions / sm->config.window;
+  double fpc = n < population ? 1.0 - n / population : 0;
+  sm->error = variance > 0 ? sm->z * sqrt(variance / n * fpc) / sm->cpi : 0;
+}
+
+/*
+ * One round of 'count' windows, one every 'period' instructions from a
+ * random offset
+ */
+static int
+sample_round(APEX_Smarts* sm, APEX_CPU* cpu, int count, uint64_t period)
+{
+  const APEX_SmartsConfig* config = &sm->config;
+  uint64_t window = config->window < sm->instructions ? config->window : sm->instructions;
+  uint64_t slack = period > window ? period - window : 0;
+  uint64_t offset = slack ? mix64(((uint64_t)config->seed << 32) ^ sm->rounds) % (slack + 1) : 0;
+
+  uint64_t* starts = malloc(sizeof(*starts) * count);
+  uint64_t* lengths = malloc(sizeof(*lengths) * count);
+  APEX_RegionResult* results = malloc(sizeof(*results) * count);
+  int status = starts && lengths && results ? 0 : -1;
+  for (int i = 0; status == 0 && i < count; ++i) {
+    starts[i] = offset + (uint64_t)i * period;
+    lengths[i] = window;
+  }
+  if (status == 0) {
+    status = APEX_checkpoint_restore(&sm->start, cpu);
+  }
+  if (status == 0) {
+    status = APEX_region_sample(cpu, starts, lengths, count, config->warmup,
+                                config->use_jit, config->jobs, results, NULL);
+  }
+  for (int i = 0; status == 0 && i < count; ++i) {
+    /* A window the program ends in during warm-up measures nothing */
+    if (results[i].instructions) {
+      double cpi = (double)results[i].cycles / results[i].instructions;
+      sm->sum += cpi;
+      sm->sum2 += cpi * cpi;
+      sm->samples++;
+    }
+    sm->detailed += (starts[i] < config->warmup ? starts[i] : config->warmup) +
+                    results[i].instructions;
+  }
+  free(starts);
+  free(lengths);
+  free(results);
+  sm->rounds++;
+  return status;
+}
+
+/*
+ * Counts the instructions of the program, then samples it in rounds
+ * until the confidence target or the round limit is reached
+ */
+int
+APEX_smarts_run(APEX_Smarts* sm, APEX_CPU* cpu, const APEX_SmartsConfig* config)
+{
+  memset(sm, 0, sizeof(*sm));
+  sm->config = *config;
+  sm->z = normal_quantile(config->confidence);
+  sm->error = HUGE_VAL;
+  if (APEX_checkpoint_save(&sm->start, cpu) != 0) {
+    return -1;
+  }
+  APEX_FuncStats stats;
+  if (APEX_func_run(cpu, 0, config->use_jit, NULL, &stats) != 0) {
+    return -1;
+  }
+  sm->instructions = stats.instructions;
+  if (!sm->instructions) {
+    fprintf(stderr, "APEX_Error : The program executes no instructions\n");
+    return -1;
+  }
+
+  /* Windows with their warm-up never overlap */
+  uint64_t spacing = config->window + config->warmup;
+  int most = (int)(sm->instructions / spacing);
+  most = most > 0 ? most : 1;
+  int count = config->samples < most ? config->samples : most;
+  int status = 0;
+  while (status == 0 && sm->rounds < config->max_rounds) {
+    status = sample_round(sm, cpu, count, sm->instructions / count);
+    update_estimate(sm);
+    if (status != 0 || sm->error <= config->error || sm->samples >= most) {
+      break;
+    }
+    /* Windows the target needs at the spread seen so far, as many as still fit */
+    double cv = sm->error * sqrt((double)sm->samples) / sm->z;
+    double needed = ceil(pow(sm->z * cv / config->error, 2)) - sm->samples;
+    count = needed < most - sm->samples ? (int)needed : most - sm->samples;
+    count = count > 2 ? count : 2;
+  }
+  return status;
+}
+
+void
+APEX_smarts_report(const APEX_Smarts* sm)
+{
+  const APEX_SmartsConfig* config = &sm->config;
+  printf("--------------------------------\n");
+  printf("------SMARTS------\n");
+  printf("--------------------------------\n");
+  printf("Instructions         : %llu\n", (unsigned long long)sm->instructions);
+  printf("Windows              : %d of %llu instructions after %llu of warm-up\n",
+         sm->samples, (unsigned long long)config->window,
+         (unsigned long long)config->warmup);
+  printf("Rounds               : %d\n", sm->rounds);
+  printf("CPI                  : %.4f", sm->cpi);
+  if (sm->error < HUGE_VAL) {
+    printf(" +- %.2f%% (%.0f%%, target %.2f%%)\n", 100 * sm->error,
+           100 * config->confidence, 100 * config->error);
+  }
+  else {
+    printf(" (too few windows for an interval)\n");
+  }
+  printf("Estimated cycles     : %.0f\n", sm->cpi * sm->instructions);
+  printf("Detailed instructions: %llu (%.2f%% of the program)\n",
+         (unsigned long long)sm->detailed, 100.0 * sm->detailed / sm->instructions);
+  if (sm->error > config->error) {
+    printf("Target not reached   : %s\n", sm->rounds >= config->max_rounds
+                                              ? "round limit"
+                                              : "every window of the program sampled");
+  }
+}
+
+void
+APEX_smarts_free(APEX_Smarts* sm)
+{
+  APEX_checkpoint_free(&sm->start);
+  memset(sm, 0, sizeof(*sm));
+}
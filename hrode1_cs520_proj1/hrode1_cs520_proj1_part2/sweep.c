@@ -0,0 +1,423 @@
+/*
+ *  sweep.c
+ *  Parameter sweeps continuing from one shared pipeline snapshot
+ *
+ *  The children are forked through forkpool.c; the snapshot is the
+ *  process itself. A child writes the results of its configurations to
+ *  an array shared with the parent, as they may not fit in a pipe.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "forkpool.h"
+#include "object.h"
+#include "sweep.h"
+#include "trace.h"
+
+/* Watches for the first retirement of a pc, until disarmed */
+typedef struct SnapshotTool
+{
+  APEX_Tool tool;
+  int pc;
+  int armed;
+  int reached;
+} SnapshotTool;
+
+/* Keeps the committed instruction stream, from the start of the program */
+typedef struct SweepRecorder
+{
+  APEX_Tool tool;
+  APEX_TraceRecord* records;
+  uint64_t num_records;
+  uint64_t capacity;
+  int failed;
+  int taken_pc;  // Branch that redirected fetch, 0 if none
+  int taken_target;
+  int last_retire;  // Cycle of the last retirement, counted from 1
+
+  /* At the snapshot */
+  uint64_t prefix;
+  int prefix_retire;
+  int clock;
+} SweepRecorder;
+
+static SnapshotTool snapshot;
+static SweepRecorder recorder;
+
+static void
+snapshot_retire(void* ctx, const APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  SnapshotTool* st = ctx;
+  (void)cpu;
+  if (st->armed && stage->pc == st->pc) {
+    st->reached = 1;
+    st->armed = 0;
+  }
+}
+
+static void
+record_flush(void* ctx, const APEX_CPU* cpu, int pc, int target)
+{
+  SweepRecorder* sr = ctx;
+  (void)cpu;
+  sr->taken_pc = pc;
+  sr->taken_target = target;
+}
+
+static void
+record_retire(void* ctx, const APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  SweepRecorder* sr = ctx;
+  if (sr->failed) {
+    return;
+  }
+  if (sr->num_records == sr->capacity) {
+    uint64_t capacity = sr->capacity ? 2 * sr->capacity : 4096;
+    APEX_TraceRecord* grown = realloc(sr->records, sizeof(*grown) * capacity);
+    if (!grown) {
+      sr->failed = 1;
+      return;
+    }
+    sr->records = grown;
+    sr->capacity = capacity;
+  }
+  APEX_trace_fill(&sr->records[sr->num_records++], stage, &sr->taken_pc,
+                  sr->taken_target);
+  sr->last_retire = cpu->clock + 1;
+}
+
+/*
+ * Parses one configuration, "-" or an empty spec keeps the timing
+ * parameters of this variant. Returns -1 on a malformed item
+ */
+int
+APEX_sweep_parse(APEX_SweepConfig* config, const char* spec)
+{
+  memset(config, 0, sizeof(*config));
+  APEX_timing_defaults(&config->timing);
+  config->spec = strdup(spec);
+  config->items = strdup(spec);
+  if (!config->spec || !config->items) {
+    APEX_sweep_config_free(config);
+    return -1;
+  }
+  if (strcmp(spec, "-") == 0) {
+    return 0;
+  }
+  /* APEX_timing_parse() runs strtok() itself */
+  char* save = NULL;
+  for (char* item = strtok_r(config->items, ",", &save); item;
+       item = strtok_r(NULL, ",", &save)) {
+    if (strncmp(item, "cycles:", 7) == 0 && atoi(item + 7) > 0) {
+      config->cycles = atoi(item + 7);
+    }
+    else if (strncmp(item, "image:", 6) == 0 && item[6] &&
+             config->num_images < APEX_SWEEP_MAX_IMAGES) {
+      config->images[config->num_images++] = item + 6;
+    }
+    else if (APEX_timing_parse(&config->timing, item) != 0) {
+      fprintf(stderr, "APEX_Error : Invalid sweep configuration item '%s' in '%s'\n",
+              item, spec);
+      APEX_sweep_config_free(config);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void
+APEX_sweep_config_free(APEX_SweepConfig* config)
+{
+  free(config->spec);
+  free(config->items);
+  memset(config, 0, sizeof(*config));
+}
+
+/*
+ * Simulates up to the end of cycle 'at_cycle', or, when 'at_pc' is not
+ * 0, up to the cycle in which the instruction at 'at_pc' first retires.
+ * Returns -1 if the program ended before
+ */
+int
+APEX_sweep_snapshot(APEX_CPU* cpu, int at_cycle, int at_pc)
+{
+  recorder.tool.name = "sweep";
+  recorder.tool.ctx = &recorder;
+  recorder.tool.on_retire = record_retire;
+  recorder.tool.on_flush = record_flush;
+  if (APEX_hooks_register(cpu, &recorder.tool) != 0) {
+    return -1;
+  }
+  if (at_pc) {
+    snapshot.tool.name = "snapshot";
+    snapshot.tool.ctx = &snapshot;
+    snapshot.tool.on_retire = snapshot_retire;
+    snapshot.pc = at_pc;
+    snapshot.armed = 1;
+    if (APEX_hooks_register(cpu, &snapshot.tool) != 0) {
+      return -1;
+    }
+  }
+  while (at_pc ? !snapshot.reached : cpu->clock < at_cycle) {
+    if (APEX_cpu_cycle(cpu) && !snapshot.reached &&
+        (at_pc || cpu->clock < at_cycle)) {
+      snapshot.armed = 0;
+      fprintf(stderr, "APEX_Error : Program ended in cycle %d, before the snapshot\n",
+              cpu->clock);
+      return -1;
+    }
+  }
+  recorder.prefix = recorder.num_records;
+  recorder.prefix_retire = recorder.last_retire;
+  recorder.clock = cpu->clock;
+  return 0;
+}
+
+/* FNV-1a, 64 bit, of the registers, zero flag and non zero data memory words */
+static uint64_t
+state_hash(const APEX_CPU* cpu)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (int r = 0; r < 16; ++r) {
+    h = (h ^ (uint32_t)cpu->regs[r]) * 0x100000001b3ull;
+  }
+  h = (h ^ (uint32_t)zeroFlag) * 0x100000001b3ull;
+  for (int d = 0; d < MEM_DIR_SIZE; ++d) {
+    const APEX_MemTable* table = cpu->data_memory.tables[d];
+    for (int t = 0; table && t < MEM_TABLE_SIZE; ++t) {
+      const APEX_MemPage* page = table->pages[t];
+      for (int w = 0; page && w < MEM_PAGE_WORDS; ++w) {
+        if (page->words[w]) {
+          uint32_t address = ((uint32_t)d << (32 - MEM_DIR_BITS)) |
+                             ((uint32_t)t << MEM_PAGE_BITS) | ((uint32_t)w << 2);
+          h = (h ^ address) * 0x100000001b3ull;
+          h = (h ^ (uint32_t)page->words[w]) * 0x100000001b3ull;
+        }
+      }
+    }
+  }
+  return h;
+}
+
+/* Whether two configurations give the pipeline the same inputs */
+static int
+same_run(const APEX_SweepConfig* a, const APEX_SweepConfig* b, int cycles)
+{
+  if ((a->cycles ? a->cycles : cycles) != (b->cycles ? b->cycles : cycles) ||
+      a->num_images != b->num_images) {
+    return 0;
+  }
+  for (int i = 0; i < a->num_images; ++i) {
+    if (strcmp(a->images[i], b->images[i]) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Replays the whole recorded stream through the timing model of
+ * 'config'. Its cycles after the snapshot are counted from the last
+ * instruction retired before it, plus the cycles the pipeline went on
+ * to the snapshot, which is where the pipeline itself is with the
+ * defaults of this variant
+ */
+static void
+replay(const APEX_SweepConfig* config, APEX_SweepResult* result)
+{
+  APEX_timing_init(&result->timing, &config->timing);
+  uint64_t prefix_wb = 0;
+  for (uint64_t i = 0; i < recorder.num_records; ++i) {
+    uint64_t wb = APEX_timing_step(&result->timing, &recorder.records[i]);
+    if (i + 1 == recorder.prefix) {
+      prefix_wb = wb;
+    }
+  }
+  uint64_t start = prefix_wb + (uint64_t)(recorder.clock - recorder.prefix_retire);
+  result->model_cycles = result->timing.retire > start ? result->timing.retire - start : 0;
+}
+
+typedef struct SweepRun
+{
+  APEX_CPU* cpu;
+  const APEX_SweepConfig* configs;
+  int count;
+  int first;  // Configuration that starts the run
+  const int* runs;
+  int cycles;
+  APEX_SweepResult* results;
+} SweepRun;
+
+/*
+ * Continues the pipeline under the inputs of configuration 'first',
+ * then replays the stream for every configuration sharing them.
+ * Returns -1 if the pipeline could not run
+ */
+static int
+run_pipeline(const SweepRun* run)
+{
+  const APEX_SweepConfig* config = &run->configs[run->first];
+  APEX_CPU* cpu = run->cpu;
+  APEX_SweepResult pipeline;
+  memset(&pipeline, 0, sizeof(pipeline));
+  for (int i = 0; i < config->num_images; ++i) {
+    if (APEX_data_image_load(cpu, config->images[i]) != 0) {
+      return -1;
+    }
+  }
+
+  int limit = config->cycles ? config->cycles : run->cycles;
+  int start_clock = cpu->clock;
+  while (limit <= 0 || cpu->clock < limit) {
+    if (APEX_cpu_cycle(cpu)) {
+      pipeline.stopped = 1;
+      break;
+    }
+  }
+  if (recorder.failed) {
+    fprintf(stderr, "APEX_Error : Out of memory recording the instruction stream\n");
+    return -1;
+  }
+  pipeline.cycles = (uint64_t)(cpu->clock - start_clock);
+  pipeline.instructions = recorder.num_records - recorder.prefix;
+  pipeline.state_hash = state_hash(cpu);
+
+  for (int i = run->first; i < run->count; ++i) {
+    if (run->runs[i] != run->first) {
+      continue;
+    }
+    APEX_SweepResult* result = &run->results[i];
+    *result = pipeline;
+    replay(&run->configs[i], result);
+  }
+  return 0;
+}
+
+/* Body of a child, one pipeline run */
+static void
+run_child(void* arg, void* out)
+{
+  *(int*)out = run_pipeline(arg) == 0 ? 1 : -1;
+}
+
+/*
+ * Continues the pipeline from the current state of 'cpu' once for each
+ * set of configurations that give it the same inputs, data images and
+ * cycle limit, up to cycle 'cycles' (0 for the end of the program)
+ * unless a configuration says otherwise. Configurations that differ
+ * only in timing parameters replay the stream of their run. A single
+ * run stays in this process, more are forked, at most 'jobs' at a
+ * time (0 for one per CPU). Returns -1 if any configuration failed
+ */
+int
+APEX_sweep_run(APEX_CPU* cpu, const APEX_SweepConfig* configs, int count,
+               int cycles, int jobs, APEX_SweepResult* results)
+{
+  /* First configuration of the run of each one, and the index of its run */
+  int* runs = malloc(sizeof(*runs) * (count ? count : 1));
+  int* slots = malloc(sizeof(*slots) * (count ? count : 1));
+  if (!runs || !slots) {
+    free(runs);
+    free(slots);
+    return -1;
+  }
+  int num_runs = 0;
+  for (int i = 0; i < count; ++i) {
+    runs[i] = i;
+    for (int j = 0; j < i && runs[i] == i; ++j) {
+      if (runs[j] == j && same_run(&configs[j], &configs[i], cycles)) {
+        runs[i] = j;
+      }
+    }
+    slots[i] = runs[i] == i ? num_runs++ : slots[runs[i]];
+  }
+  memset(results, 0, sizeof(*results) * count);
+  for (int i = 0; i < count; ++i) {
+    results[i].status = -1;
+  }
+
+  SweepRun run = { cpu, configs, count, 0, runs, cycles, results };
+  if (num_runs == 1) {
+    if (run_pipeline(&run) == 0) {
+      for (int i = 0; i < count; ++i) {
+        results[i].status = 0;
+      }
+    }
+  }
+  else if (num_runs > 1) {
+    size_t size = sizeof(*results) * count;
+    run.results = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                       -1, 0);
+    APEX_ForkPool pool;
+    if (run.results == MAP_FAILED) {
+      fprintf(stderr, "APEX_Error : Unable to share the results of %d configurations\n",
+              count);
+    }
+    else if (APEX_forkpool_init(&pool, num_runs, sizeof(int), jobs) == 0) {
+      for (int i = 0; i < count; ++i) {
+        if (runs[i] == i) {
+          run.first = i;
+          APEX_forkpool_spawn(&pool, slots[i], run_child, &run);
+        }
+      }
+      APEX_forkpool_wait(&pool);
+      for (int i = 0; i < count; ++i) {
+        const int* ok = APEX_forkpool_result(&pool, slots[i]);
+        if (ok && *ok == 1) {
+          results[i] = run.results[i];
+          results[i].status = 0;
+        }
+      }
+      APEX_forkpool_free(&pool);
+    }
+    if (run.results != MAP_FAILED) {
+      munmap(run.results, size);
+    }
+  }
+
+  int status = 0;
+  for (int i = 0; i < count; ++i) {
+    if (results[i].status != 0) {
+      fprintf(stderr, "APEX_Error : Configuration %d (%s) failed\n", i,
+              configs[i].spec);
+      status = -1;
+    }
+  }
+  free(runs);
+  free(slots);
+  free(recorder.records);
+  recorder.records = NULL;
+  recorder.num_records = recorder.capacity = 0;
+  return status;
+}
+
+void
+APEX_sweep_report(const APEX_SweepConfig* configs,
+                  const APEX_SweepResult* results, int count)
+{
+  printf("--------------------------------\n");
+  printf("------SWEEP------\n");
+  printf("--------------------------------\n");
+  printf("%-4s %-13s %-10s %-6s %-12s %-6s %-5s %-16s %s\n", "#", "Instructions",
+         "Cycles", "IPC", "Model cycles", "IPC", "End", "State", "Configuration");
+  for (int i = 0; i < count; ++i) {
+    const APEX_SweepResult* r = &results[i];
+    const APEX_TimingConfig* c = &configs[i].timing;
+    if (r->status != 0) {
+      printf("%-4d failed %s\n", i, configs[i].spec);
+      continue;
+    }
+    uint64_t model = r->model_cycles;
+    printf("%-4d %-13llu %-10llu %-6.3f %-12llu %-6.3f %-5s %016llx "
+           "forward:%d,store_bypass:%d,mul:%d,branch:%s (%s)\n",
+           i, (unsigned long long)r->instructions, (unsigned long long)r->cycles,
+           r->cycles ? (double)r->instructions / r->cycles : 0.0,
+           (unsigned long long)model,
+           model ? (double)r->instructions / model : 0.0,
+           r->stopped ? "halt" : "limit", (unsigned long long)r->state_hash,
+           c->forwarding, c->store_bypass, c->mul_latency,
+           c->branch_stage == EX ? "EX" : "MEM", configs[i].spec);
+  }
+}
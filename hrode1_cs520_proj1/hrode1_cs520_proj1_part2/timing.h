@@ -0,0 +1,88 @@
+#ifndef _APEX_TIMING_H_
+#define _APEX_TIMING_H_
+/**
+ *  timing.h
+ *  Trace driven timing model of the 5 stage APEX pipeline
+ *
+ *  The model consumes the committed instruction stream one record at a
+ *  time and computes when each instruction occupies Fetch, Decode/RF,
+ *  Execute, Memory and Writeback, from the register, zero flag and
+ *  functional unit dependences only. No ALU or memory semantics are
+ *  evaluated, so a recorded trace can be replayed under many timing
+ *  configurations. With the defaults of a variant it takes the cycles
+ *  of that variant's pipeline.
+ */
+#include <stdint.h>
+
+#include "trace.h"
+
+typedef struct APEX_TimingConfig
+{
+  int forwarding;    // Results forwarded from EX/MEM to Decode/RF
+  int store_bypass;  // A STORE after a LOAD of its address does not wait for operands
+  int mul_latency;   // Execute cycles of MUL
+  int branch_stage;  // Stage in which taken branches redirect fetch, EX or MEM
+  int branch_decode; // Cycles BZ/BNZ hold Decode/RF whatever the zero flag, 0 to wait for it
+  int mul_pair;      // The instruction after a MUL follows it to Execute unchecked
+} APEX_TimingConfig;
+
+/* Writers of one register kept for the valid bit, more than are ever in flight */
+#define APEX_TIMING_WRITERS 4
+
+/* Execute and Writeback cycles of an instruction writing a register */
+typedef struct APEX_TimingWriter
+{
+  uint64_t ex_first;
+  uint64_t ex_last;
+  uint64_t wb;
+} APEX_TimingWriter;
+
+typedef struct APEX_Timing
+{
+  APEX_TimingConfig config;
+
+  /* First Decode/RF cycle that can read each value */
+  uint64_t reg_ready[16];
+  uint64_t flag_ready;
+
+  /* Latest writers of each register, newest first. Without forwarding
+   * a register is read once its valid bit is clear: the bit is set by
+   * any writer in Execute and cleared by any writer in Writeback */
+  APEX_TimingWriter writers[16][APEX_TIMING_WRITERS];
+
+  /* Stage occupancy of the previous instruction */
+  uint64_t fetch;
+  uint64_t decode;
+  uint64_t ex_free;   // First cycle Execute can accept an instruction
+  uint64_t redirect;  // First fetch cycle after a taken branch
+  uint64_t retire;    // Writeback cycle
+  int last_op;        // Of the previous instruction
+  uint32_t last_addr;
+
+  /* Statistics */
+  uint64_t instructions;
+  uint64_t stall_data;
+  uint64_t stall_flag;
+  uint64_t stall_ex;
+  uint64_t flush;
+} APEX_Timing;
+
+void
+APEX_timing_defaults(APEX_TimingConfig* config);
+
+int
+APEX_timing_parse(APEX_TimingConfig* config, const char* spec);
+
+void
+APEX_timing_init(APEX_Timing* t, const APEX_TimingConfig* config);
+
+uint64_t
+APEX_timing_step(APEX_Timing* t, const APEX_TraceRecord* rec);
+
+void
+APEX_timing_report(const APEX_Timing* t);
+
+int
+APEX_timing_replay(const char* filename, int cycles, const char* spec);
+
+#endif
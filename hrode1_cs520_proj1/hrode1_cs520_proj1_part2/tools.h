@@ -0,0 +1,46 @@
+#ifndef _APEX_TOOLS_H_
+#define _APEX_TOOLS_H_
+/**
+ *  tools.h
+ *  Analysis tools built on the hook interface, each one attaches
+ *  itself to a CPU and prints its report when the simulation ends
+ */
+#include "cpu.h"
+
+/*
+ * Dataflow critical path of the committed instruction stream.
+ * 'latencies' optionally overrides per opcode latencies, e.g. "MUL:3,LOAD:2"
+ */
+int
+APEX_critpath_attach(APEX_CPU* cpu, const char* latencies);
+
+/*
+ * Reuse distance, working set and stride histograms of LOAD/STORE
+ * addresses. 'options' is "block:BYTES,window:ACCESSES,max:BLOCKS,out:FILE"
+ */
+int
+APEX_memtrace_attach(APEX_CPU* cpu, const char* options);
+
+/*
+ * Per opcode counts and dependence distances, zero flag producer to
+ * consumer distance and taken/not taken counts of every branch site
+ */
+int
+APEX_insmix_attach(APEX_CPU* cpu);
+
+/*
+ * Writes the committed instruction stream to 'filename' as a binary
+ * trace (see trace.h) for replay by the timing model
+ */
+int
+APEX_trace_record_attach(APEX_CPU* cpu, const char* filename);
+
+/*
+ * Writes the stage contents, register and zero flag changes of every
+ * cycle to an indexed pipeline trace (see pipetrace.h). 'options' is
+ * "FILE[,keyframe:CYCLES]"
+ */
+int
+APEX_pipetrace_attach(APEX_CPU* cpu, const char* options);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ *  trace.c
+ *  Recording and reading committed instruction traces
+ *
+ *  The recorder is an analysis tool: it writes one record per retired
+ *  instruction from the Writeback hook, and marks branches that the
+ *  Memory stage reported as redirecting fetch.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tools.h"
+#include "trace.h"
+
+typedef struct TraceRecorder
+{
+  APEX_Tool tool;
+  FILE* out;
+  uint64_t num_records;
+  int taken_pc;     // Branch that redirected fetch, 0 if none
+  int taken_target;
+} TraceRecorder;
+
+static void
+on_flush(void* ctx, const APEX_CPU* cpu, int pc, int target)
+{
+  TraceRecorder* tr = ctx;
+  (void)cpu;
+  tr->taken_pc = pc;
+  tr->taken_target = target;
+}
+
+void
+APEX_trace_fill(APEX_TraceRecord* rec, const CPU_Stage* stage, int* taken_pc,
+                int taken_target)
+{
+  int operands = get_opcode_operands(stage->op);
+  rec->pc = (uint32_t)stage->pc;
+  rec->op = (uint8_t)stage->op;
+  rec->rd = (uint8_t)(stage->rd & 15);
+  rec->rs1 = (uint8_t)(stage->rs1 & 15);
+  rec->rs2 = (uint8_t)(stage->rs2 & 15);
+  rec->addr = 0;
+  if (operands & (READS_MEM | WRITES_MEM)) {
+    rec->addr = (uint32_t)stage->mem_address;
+  }
+  if ((operands & IS_BRANCH) && *taken_pc == stage->pc) {
+    rec->op |= APEX_TRACE_TAKEN;
+    rec->addr = (uint32_t)taken_target;
+    *taken_pc = 0;
+  }
+}
+
+static void
+on_retire(void* ctx, const APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  TraceRecorder* tr = ctx;
+  APEX_TraceRecord rec;
+  (void)cpu;
+
+  APEX_trace_fill(&rec, stage, &tr->taken_pc, tr->taken_target);
+  fwrite(&rec, sizeof(rec), 1, tr->out);
+  tr->num_records++;
+}
+
+/*
+ * Patches the record count and cycles into the header, when the output
+ * can seek
+ */
+static void
+on_finish(void* ctx, const APEX_CPU* cpu)
+{
+  TraceRecorder* tr = ctx;
+  uint64_t cycles = (uint64_t)cpu->clock;
+  if (fseek(tr->out, offsetof(APEX_TraceHeader, num_records), SEEK_SET) == 0) {
+    fwrite(&tr->num_records, sizeof(tr->num_records), 1, tr->out);
+    fwrite(&cycles, sizeof(cycles), 1, tr->out);
+    fseek(tr->out, 0, SEEK_END);
+  }
+  fflush(tr->out);
+  printf("Trace : %llu instructions recorded\n",
+         (unsigned long long)tr->num_records);
+}
+
+static void
+on_release(void* ctx)
+{
+  TraceRecorder* tr = ctx;
+  if (tr->out && fclose(tr->out) != 0) {
+    fprintf(stderr, "APEX_Error : Unable to write trace\n");
+  }
+  free(tr);
+}
+
+int
+APEX_trace_record_attach(APEX_CPU* cpu, const char* filename)
+{
+  if (!filename || !*filename) {
+    fprintf(stderr, "APEX_Error : --record needs a file name\n");
+    return -1;
+  }
+  TraceRecorder* tr = calloc(1, sizeof(*tr));
+  if (!tr) {
+    return -1;
+  }
+  tr->out = fopen(filename, "wb");
+  if (!tr->out) {
+    fprintf(stderr, "APEX_Error : Unable to create trace %s\n", filename);
+    free(tr);
+    return -1;
+  }
+  setvbuf(tr->out, NULL, _IOFBF, 1 << 20);
+
+  APEX_TraceHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = APEX_TRACE_MAGIC;
+  h.version = APEX_TRACE_VERSION;
+  fwrite(&h, sizeof(h), 1, tr->out);
+
+  tr->tool.name = "record";
+  tr->tool.ctx = tr;
+  tr->tool.on_retire = on_retire;
+  tr->tool.on_flush = on_flush;
+  tr->tool.on_finish = on_finish;
+  tr->tool.on_release = on_release;
+  if (APEX_hooks_register(cpu, &tr->tool) != 0) {
+    on_release(tr);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Maps a trace file. A record count of 0 in the header (output that
+ * could not seek) means the records run to the end of the file
+ */
+int
+APEX_trace_open(APEX_Trace* trace, const char* filename)
+{
+  memset(trace, 0, sizeof(*trace));
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "APEX_Error : Unable to open trace %s\n", filename);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size < (off_t)sizeof(APEX_TraceHeader)) {
+    fprintf(stderr, "APEX_Error : %s is not a trace file\n", filename);
+    close(fd);
+    return -1;
+  }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "APEX_Error : Unable to map %s\n", filename);
+    return -1;
+  }
+  trace->map = map;
+  trace->map_size = st.st_size;
+
+  const APEX_TraceHeader* h = map;
+  uint64_t available =
+    (st.st_size - sizeof(*h)) / sizeof(APEX_TraceRecord);
+  if (h->magic != APEX_TRACE_MAGIC || h->version != APEX_TRACE_VERSION ||
+      h->num_records > available) {
+    fprintf(stderr, "APEX_Error : %s is not a version %d trace file\n",
+            filename, APEX_TRACE_VERSION);
+    APEX_trace_close(trace);
+    return -1;
+  }
+  trace->records = (const APEX_TraceRecord*)(h + 1);
+  trace->num_records = h->num_records ? h->num_records : available;
+  trace->cycles = h->cycles;
+  return 0;
+}
+
+void
+APEX_trace_close(APEX_Trace* trace)
+{
+  if (trace->map) {
+    munmap(trace->map, trace->map_size);
+  }
+  memset(trace, 0, sizeof(*trace));
+}